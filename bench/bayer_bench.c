@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <linux/videodev2.h>
+
+#include "libyuv.h"
+
+#define LOG_TAG "bayer_bench"
+#include "liblog.h"
+
+#include "utils.h"
+#include "i420.h"
+#include "threadpool.h"
+#include "bayer.h"
+
+#define BENCH_MAX_THREADS   16      /** thread counts per run */
+
+#ifndef V4L2_PIX_FMT_SRGGB12P
+#define V4L2_PIX_FMT_SRGGB12P v4l2_fourcc('p', 'R', 'C', 'C')
+#endif
+
+
+/** RGGB sensor layouts, one of each packing bayer.c has */
+struct bench_format {
+    const char  *name;
+    uint32_t    fourcc;
+    int         depth;      /** bits per sample */
+    int         num;        /** bytes per line: width * num / den */
+    int         den;
+};
+
+static const struct bench_format kBenchFormats[] = {
+    {"rggb8",   V4L2_PIX_FMT_SRGGB8,    8,  1, 1},
+    {"rggb10",  V4L2_PIX_FMT_SRGGB10,   10, 2, 1},
+    {"rggb10p", V4L2_PIX_FMT_SRGGB10P,  10, 5, 4},
+    {"rggb12p", V4L2_PIX_FMT_SRGGB12P,  12, 3, 2},
+};
+
+struct bench_options {
+    int         threads[BENCH_MAX_THREADS];
+    int         nthreads;
+    int         width;
+    int         height;
+    int         frames;
+    uint32_t    dst_format;
+    const struct bench_format *format;
+};
+
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [-t threads[,threads..]] [-s WxH] [-n frames]\n"
+            "          [-f rggb8|rggb10|rggb10p|rggb12p] [-o i420|nv12]\n"
+            "\n"
+            "demosaics a synthetic RGGB frame (default 8 bit 1920x1080) to I420 with\n"
+            "bayer_convert at each thread count (default 1,2,4,8) and reports ms per\n"
+            "frame, fps and the speedup over the first count.\n", argv0);
+}
+
+static int bench_parse(int argc, char **argv, struct bench_options *opt)
+{
+    int c;
+    char *tok;
+
+    memset(opt, 0, sizeof(*opt));
+    opt->width = 1920;
+    opt->height = 1080;
+    opt->frames = 100;
+    opt->dst_format = FOURCC_I420;
+    opt->format = &kBenchFormats[0];
+
+    while ((c = getopt(argc, argv, "t:s:n:f:o:h")) != -1) {
+        switch (c) {
+            case 't':
+                opt->nthreads = 0;
+                for (tok = strtok(optarg, ","); tok && opt->nthreads < BENCH_MAX_THREADS;
+                     tok = strtok(NULL, ",")) {
+                    opt->threads[opt->nthreads] = atoi(tok);
+                    if (opt->threads[opt->nthreads++] <= 0)
+                        return -1;
+                }
+                break;
+            case 's':
+                if (sscanf(optarg, "%dx%d", &opt->width, &opt->height) != 2)
+                    return -1;
+                break;
+            case 'n':
+                opt->frames = atoi(optarg);
+                break;
+            case 'f':
+                opt->format = NULL;
+                for (size_t i = 0; i < sizeof(kBenchFormats) / sizeof(kBenchFormats[0]); i++) {
+                    if (!strcmp(optarg, kBenchFormats[i].name))
+                        opt->format = &kBenchFormats[i];
+                }
+                if (opt->format == NULL)
+                    return -1;
+                break;
+            case 'o':
+                if (!strcmp(optarg, "i420"))
+                    opt->dst_format = FOURCC_I420;
+                else if (!strcmp(optarg, "nv12"))
+                    opt->dst_format = FOURCC_NV12;
+                else
+                    return -1;
+                break;
+            default:
+                return -1;
+        }
+    }
+
+    if (opt->nthreads == 0) {
+        for (int t = 1; t <= 8; t *= 2)
+            opt->threads[opt->nthreads++] = t;
+    }
+
+    // even for the 2x2 pattern, a multiple of 4 for the mipi groups
+    if (opt->width <= 0 || opt->height <= 0 || opt->frames <= 0 ||
+        opt->width % 4 || opt->height % 2)
+        return -1;
+    return 0;
+}
+
+
+/**
+ * noise in every sample, so nothing in the demosaic gets an easy frame.
+ * 16 bit containers keep to the depth, packed bytes are any value.
+ */
+static uint8_t *bench_frame(const struct bench_options *opt, int bytesperline)
+{
+    const size_t size = (size_t)bytesperline * opt->height;
+    uint8_t *raw = (uint8_t *)malloc(size);
+
+    if (raw == NULL)
+        return NULL;
+
+    srand(1);
+    if (opt->format->num == 2 && opt->format->den == 1) {
+        for (size_t i = 0; i < size / 2; i++)
+            ((uint16_t *)raw)[i] = rand() & ((1 << opt->format->depth) - 1);
+    } else {
+        for (size_t i = 0; i < size; i++)
+            raw[i] = rand();
+    }
+    return raw;
+}
+
+/**
+ * frames through bayer_convert on a pool of threads (workers + caller, as
+ * camss_set_convert_threads sets it up). returns the us spent converting,
+ * 0 on error
+ */
+static uint64_t bench_run(const struct bench_options *opt, const uint8_t *raw,
+                          int bytesperline, int threads)
+{
+    uint64_t start;
+    uint64_t elapsed = 0;
+    void *pool = NULL;
+    void *bayer = NULL;
+    struct i420_buffer *dst;
+
+    dst = i420_buffer_create_format(opt->dst_format, opt->width, opt->height);
+    if (dst == NULL)
+        return 0;
+
+    if (threads > 1) {
+        pool = threadpool_create(threads - 1);
+        if (pool == NULL)
+            goto bail;
+    }
+
+    bayer = bayer_create(opt->format->fourcc, opt->width, opt->height, bytesperline, pool);
+    if (bayer == NULL)
+        goto bail;
+
+    // the first frame faults the destination and scratch pages in
+    if (bayer_convert(bayer, raw, dst) != 0) {
+        ALOGE("%s: conversion failed", __func__);
+        goto bail;
+    }
+
+    for (int i = 0; i < opt->frames; i++) {
+        start = nowUs();
+        if (bayer_convert(bayer, raw, dst) != 0) {
+            ALOGE("%s: conversion %d failed", __func__, i);
+            elapsed = 0;
+            break;
+        }
+        elapsed += nowUs() - start;
+    }
+
+bail:
+    bayer_destroy(bayer);
+    threadpool_destroy(pool);
+    i420_buffer_destory(dst);
+    return elapsed;
+}
+
+
+int main(int argc, char **argv)
+{
+    uint64_t us;
+    double fps;
+    double base = 0;
+    int bytesperline;
+    uint8_t *raw;
+    struct bench_options opt;
+
+    if (bench_parse(argc, argv, &opt) != 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    bytesperline = opt.width * opt.format->num / opt.format->den;
+    raw = bench_frame(&opt, bytesperline);
+    if (raw == NULL)
+        return 1;
+
+    printf("%dx%d %s to %s, %d frames\n\n", opt.width, opt.height, opt.format->name,
+           opt.dst_format == FOURCC_NV12 ? "NV12" : "I420", opt.frames);
+    printf("%8s %10s %10s %10s\n", "threads", "ms/frame", "fps", "speedup");
+
+    for (int t = 0; t < opt.nthreads; t++) {
+        us = bench_run(&opt, raw, bytesperline, opt.threads[t]);
+        if (us == 0) {
+            printf("%8d %10s\n", opt.threads[t], "failed");
+            continue;
+        }
+
+        fps = opt.frames * 1e6 / us;
+        if (base == 0)
+            base = fps;
+        printf("%8d %10.2f %10.1f %9.2fx\n", opt.threads[t], 1000.0 / fps, fps, fps / base);
+    }
+
+    free(raw);
+    return 0;
+}
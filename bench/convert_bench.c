@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <linux/videodev2.h>
+
+#include "libyuv.h"
+
+#define LOG_TAG "convert_bench"
+#include "liblog.h"
+
+#include "utils.h"
+#include "i420.h"
+#include "threadpool.h"
+#include "synth.h"
+
+#define BENCH_MAX_THREADS   16      /** thread counts per run */
+
+
+struct bench_options {
+    int         threads[BENCH_MAX_THREADS];
+    int         nthreads;
+    int         width;
+    int         height;
+    int         frames;
+    const char  *pattern;
+};
+
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [-t threads[,threads..]] [-s WxH] [-n frames] [-P bars|gradient|noise]\n"
+            "\n"
+            "converts synth YUYV frames (default 3840x2160) to I420 with ToI420_mt at\n"
+            "each thread count (default 1,2,4,8) and reports fps and the speedup over\n"
+            "the first count. only the conversion is timed, not the rendering.\n", argv0);
+}
+
+static int bench_parse(int argc, char **argv, struct bench_options *opt)
+{
+    int c;
+    char *tok;
+
+    memset(opt, 0, sizeof(*opt));
+    opt->width = 3840;
+    opt->height = 2160;
+    opt->frames = 60;
+    opt->pattern = "bars";
+
+    while ((c = getopt(argc, argv, "t:s:n:P:h")) != -1) {
+        switch (c) {
+            case 't':
+                opt->nthreads = 0;
+                for (tok = strtok(optarg, ","); tok && opt->nthreads < BENCH_MAX_THREADS;
+                     tok = strtok(NULL, ",")) {
+                    opt->threads[opt->nthreads] = atoi(tok);
+                    if (opt->threads[opt->nthreads++] <= 0)
+                        return -1;
+                }
+                break;
+            case 's':
+                if (sscanf(optarg, "%dx%d", &opt->width, &opt->height) != 2)
+                    return -1;
+                break;
+            case 'n':
+                opt->frames = atoi(optarg);
+                break;
+            case 'P':
+                opt->pattern = optarg;
+                break;
+            default:
+                return -1;
+        }
+    }
+
+    if (opt->nthreads == 0) {
+        for (int t = 1; t <= 8; t *= 2)
+            opt->threads[opt->nthreads++] = t;
+    }
+
+    if (opt->width <= 0 || opt->height <= 0 || opt->frames <= 0)
+        return -1;
+    return 0;
+}
+
+
+/**
+ * frames through ToI420_mt on a pool of threads (workers + caller, as
+ * camss_set_convert_threads sets it up). returns the us spent converting,
+ * 0 on error
+ */
+static uint64_t bench_run(const struct bench_options *opt, int threads)
+{
+    uint64_t start;
+    uint64_t elapsed = 0;
+    void *synth;
+    void *pool = NULL;
+    uint8_t *data = NULL;
+    struct i420_buffer *dst = NULL;
+    struct synth_buffer buf;
+    const uint32_t fourcc = CanonicalFourCC(V4L2_PIX_FMT_YUYV);
+
+    synth = synth_create(opt->pattern, V4L2_PIX_FMT_YUYV, opt->width, opt->height, 0);
+    if (synth == NULL)
+        return 0;
+
+    data = (uint8_t *)malloc(synth_sizeimage(synth));
+    dst = i420_buffer_create_format(FOURCC_I420, opt->width, opt->height);
+    if (data == NULL || dst == NULL)
+        goto bail;
+
+    if (threads > 1) {
+        pool = threadpool_create(threads - 1);
+        if (pool == NULL)
+            goto bail;
+    }
+
+    synth_start(synth);
+
+    for (int i = 0; i < opt->frames; i++) {
+        if (synth_qbuf(synth, 0, data) != 0 || synth_dqbuf(synth, &buf) != 0) {
+            ALOGE("%s: synth gave no frame %d", __func__, i);
+            elapsed = 0;
+            break;
+        }
+
+        start = nowUs();
+        if (ToI420_mt(pool, data, fourcc, buf.bytesused, 0, 0,
+                      opt->width, opt->height, 0, dst) != 0) {
+            ALOGE("%s: conversion %d failed", __func__, i);
+            elapsed = 0;
+            break;
+        }
+        elapsed += nowUs() - start;
+    }
+
+    synth_stop(synth);
+
+bail:
+    threadpool_destroy(pool);
+    if (dst)
+        i420_buffer_destory(dst);
+    free(data);
+    synth_destroy(synth);
+    return elapsed;
+}
+
+
+int main(int argc, char **argv)
+{
+    uint64_t us;
+    double fps;
+    double base = 0;
+    struct bench_options opt;
+
+    if (bench_parse(argc, argv, &opt) != 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("%dx%d YUYV to I420 %s, %d frames\n\n", opt.width, opt.height, opt.pattern, opt.frames);
+    printf("%8s %10s %10s\n", "threads", "fps", "speedup");
+
+    for (int t = 0; t < opt.nthreads; t++) {
+        us = bench_run(&opt, opt.threads[t]);
+        if (us == 0) {
+            printf("%8d %10s\n", opt.threads[t], "failed");
+            continue;
+        }
+
+        fps = opt.frames * 1e6 / us;
+        if (base == 0)
+            base = fps;
+        printf("%8d %10.1f %9.2fx\n", opt.threads[t], fps, fps / base);
+    }
+
+    return 0;
+}
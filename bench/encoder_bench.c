@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <linux/videodev2.h>
+
+#define LOG_TAG "encoder_bench"
+#include "liblog.h"
+
+#include "utils.h"
+#include "fourcc.h"
+#include "i420.h"
+#include "synth.h"
+#include "encoder.h"
+
+#define BENCH_MAX_CODECS    8
+#define BENCH_MAX_THREADS   16      /** thread counts per run */
+#define BENCH_FPS           30      /** nominal, for the rate control and the kbps */
+
+
+struct bench_options {
+    const char  *codecs[BENCH_MAX_CODECS];
+    int         ncodecs;
+    int         threads[BENCH_MAX_THREADS];
+    int         nthreads;
+    int         width;
+    int         height;
+    int         frames;
+    int         bitrate;
+    int         preset;
+    const char  *pattern;
+};
+
+struct bench_result {
+    int         frames;         /** access units out, flush included */
+    uint64_t    bytes;
+    uint64_t    encode_us;      /** in encoder_encode/encoder_flush only */
+};
+
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [-c codec[,codec..]] [-t threads[,threads..]] [-s WxH] [-n frames]\n"
+            "          [-b kbps] [-p lowlatency|throughput|default] [-P bars|gradient|noise]\n"
+            "\n"
+            "encodes synth frames with each codec (default x264,vp9) at each thread\n"
+            "count (default 1,2,4,.. up to the cores) and reports fps and fps per thread.\n"
+            "only the encoder calls are timed, not the rendering.\n", argv0);
+}
+
+// "a,b,c" into up to max entries, returns how many
+static int bench_split(char *list, const char **out, int max)
+{
+    int n = 0;
+
+    for (char *tok = strtok(list, ","); tok && n < max; tok = strtok(NULL, ","))
+        out[n++] = tok;
+    return n;
+}
+
+static int bench_parse(int argc, char **argv, struct bench_options *opt)
+{
+    int c;
+    const char *tokens[BENCH_MAX_THREADS];
+    int ncores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    memset(opt, 0, sizeof(*opt));
+    opt->width = 1280;
+    opt->height = 720;
+    opt->frames = 300;
+    opt->bitrate = 4000;
+    opt->preset = ENCODER_PRESET_THROUGHPUT;
+    opt->pattern = "bars";
+
+    while ((c = getopt(argc, argv, "c:t:s:n:b:p:P:h")) != -1) {
+        switch (c) {
+            case 'c':
+                opt->ncodecs = bench_split(optarg, opt->codecs, BENCH_MAX_CODECS);
+                break;
+            case 't':
+                opt->nthreads = bench_split(optarg, tokens, BENCH_MAX_THREADS);
+                for (int i = 0; i < opt->nthreads; i++) {
+                    opt->threads[i] = atoi(tokens[i]);
+                    if (opt->threads[i] <= 0)
+                        return -1;
+                }
+                break;
+            case 's':
+                if (sscanf(optarg, "%dx%d", &opt->width, &opt->height) != 2)
+                    return -1;
+                break;
+            case 'n':
+                opt->frames = atoi(optarg);
+                break;
+            case 'b':
+                opt->bitrate = atoi(optarg);
+                break;
+            case 'p':
+                if (!strcmp(optarg, "lowlatency"))
+                    opt->preset = ENCODER_PRESET_LOWLATENCY;
+                else if (!strcmp(optarg, "throughput"))
+                    opt->preset = ENCODER_PRESET_THROUGHPUT;
+                else if (!strcmp(optarg, "default"))
+                    opt->preset = ENCODER_PRESET_DEFAULT;
+                else
+                    return -1;
+                break;
+            case 'P':
+                opt->pattern = optarg;
+                break;
+            default:
+                return -1;
+        }
+    }
+
+    if (opt->ncodecs == 0) {
+        opt->codecs[opt->ncodecs++] = "x264";
+        opt->codecs[opt->ncodecs++] = "vp9";
+    }
+
+    // 1, 2, 4, .. and the core count itself
+    if (opt->nthreads == 0) {
+        for (int t = 1; t < ncores && opt->nthreads < BENCH_MAX_THREADS - 1; t *= 2)
+            opt->threads[opt->nthreads++] = t;
+        opt->threads[opt->nthreads++] = ncores > 0 ? ncores : 1;
+    }
+
+    if (opt->width <= 0 || opt->height <= 0 || opt->frames <= 0)
+        return -1;
+    return 0;
+}
+
+
+static void bench_account(struct bench_result *res, const struct encoder_frame *out)
+{
+    res->frames++;
+    res->bytes += out->size;
+}
+
+/**
+ * one codec at one thread count: a fresh synth source and encoder, frames
+ * rendered one at a time into a single buffer, like a camera that is
+ * always ready. < 0 if the codec would not open or failed.
+ */
+static int bench_run(const struct bench_options *opt, const char *codec, int threads,
+                     struct bench_result *res)
+{
+    int ret = -1;
+    int stride;
+    uint64_t start;
+    void *synth;
+    void *encoder = NULL;
+    uint8_t *data = NULL;
+    struct synth_buffer buf;
+    struct encoder_frame out;
+    struct encoder_config config;
+    struct i420_buffer in;
+
+    memset(res, 0, sizeof(*res));
+
+    synth = synth_create(opt->pattern, V4L2_PIX_FMT_YUV420, opt->width, opt->height, 0);
+    if (synth == NULL)
+        return -1;
+
+    data = (uint8_t *)malloc(synth_sizeimage(synth));
+    if (data == NULL)
+        goto bail;
+
+    memset(&config, 0, sizeof(config));
+    config.width = opt->width;
+    config.height = opt->height;
+    config.fps_num = BENCH_FPS;
+    config.fps_den = 1;
+    config.bitrate = opt->bitrate;
+    config.keyint = 60;
+    config.format = FOURCC_I420;
+    config.preset = opt->preset;
+    config.threads = threads;
+
+    encoder = encoder_open(codec, &config);
+    if (encoder == NULL)
+        goto bail;
+
+    // synth YUV420 rows are padded to an even width, chroma to half of it
+    stride = synth_bytesperline(synth);
+    memset(&in, 0, sizeof(in));
+    in.format = FOURCC_I420;
+    in.nplanes = 3;
+    in.width = opt->width;
+    in.height = opt->height;
+    in.stride[0] = stride;
+    in.stride[1] = stride / 2;
+    in.stride[2] = stride / 2;
+    in.data = data;
+
+    synth_start(synth);
+
+    for (int i = 0; i < opt->frames; i++) {
+        if (synth_qbuf(synth, 0, data) != 0 || synth_dqbuf(synth, &buf) != 0) {
+            ALOGE("%s: synth gave no frame %d", __func__, i);
+            ret = -1;
+            goto bail;
+        }
+
+        start = nowUs();
+        ret = encoder_encode(encoder, &in, buf.timestamp, &out);
+        if (ret > 0)
+            bench_account(res, &out);
+        res->encode_us += nowUs() - start;
+        if (ret < 0)
+            goto bail;
+    }
+
+    start = nowUs();
+    while ((ret = encoder_flush(encoder, &out)) > 0)
+        bench_account(res, &out);
+    res->encode_us += nowUs() - start;
+
+    synth_stop(synth);
+
+bail:
+    encoder_close(encoder);
+    free(data);
+    synth_destroy(synth);
+    return ret;
+}
+
+
+int main(int argc, char **argv)
+{
+    struct bench_options opt;
+    struct bench_result res;
+
+    if (bench_parse(argc, argv, &opt) != 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("%dx%d %s, %d frames, %d kbps\n\n", opt.width, opt.height, opt.pattern,
+           opt.frames, opt.bitrate);
+    printf("%-6s %8s %10s %12s %10s\n", "codec", "threads", "fps", "fps/thread", "kbps");
+
+    for (int c = 0; c < opt.ncodecs; c++) {
+        for (int t = 0; t < opt.nthreads; t++) {
+            double fps;
+
+            if (bench_run(&opt, opt.codecs[c], opt.threads[t], &res) < 0) {
+                printf("%-6s %8d %10s\n", opt.codecs[c], opt.threads[t], "failed");
+                continue;
+            }
+
+            fps = res.encode_us ? res.frames * 1e6 / res.encode_us : 0;
+            printf("%-6s %8d %10.1f %12.1f %10.0f\n", opt.codecs[c], opt.threads[t],
+                   fps, fps / opt.threads[t],
+                   res.frames ? res.bytes * 8.0 * BENCH_FPS / res.frames / 1000 : 0);
+        }
+    }
+
+    return 0;
+}
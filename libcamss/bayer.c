@@ -0,0 +1,410 @@
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/videodev2.h>
+
+#include "libyuv.h"
+
+#define LOG_TAG "bayer"
+#include "liblog.h"
+
+#include "i420.h"
+#include "threadpool.h"
+#include "bayer.h"
+
+#ifndef V4L2_PIX_FMT_SBGGR12P
+#define V4L2_PIX_FMT_SBGGR12P v4l2_fourcc('p', 'B', 'C', 'C')
+#define V4L2_PIX_FMT_SGBRG12P v4l2_fourcc('p', 'G', 'C', 'C')
+#define V4L2_PIX_FMT_SGRBG12P v4l2_fourcc('p', 'g', 'C', 'C')
+#define V4L2_PIX_FMT_SRGGB12P v4l2_fourcc('p', 'R', 'C', 'C')
+#endif
+
+#define BAYER_MAX_STRIPES   32
+#define BAYER_PAD           2       /** mirrored pixels left and right of a line */
+#define BAYER_NO_ROW        (-100)  /** row -1 is a valid (mirrored) line */
+
+
+enum bayer_packing {
+    BAYER_PACK_8 = 0,       /** one byte per pixel */
+    BAYER_PACK_16,          /** lsb aligned in 16 bit little endian words */
+    BAYER_PACK_MIPI10,      /** 4 pixels in 5 bytes, msbs first */
+    BAYER_PACK_MIPI12,      /** 2 pixels in 3 bytes, msbs first */
+};
+
+struct bayer_format {
+    uint32_t    fourcc;
+    uint8_t     rx;         /** column of R in the 2x2 tile */
+    uint8_t     ry;         /** row of R */
+    uint8_t     depth;
+    uint8_t     packing;
+};
+
+static const struct bayer_format kBayerFormats[] = {
+    {V4L2_PIX_FMT_SRGGB8,   0, 0,  8, BAYER_PACK_8},
+    {V4L2_PIX_FMT_SGRBG8,   1, 0,  8, BAYER_PACK_8},
+    {V4L2_PIX_FMT_SGBRG8,   0, 1,  8, BAYER_PACK_8},
+    {V4L2_PIX_FMT_SBGGR8,   1, 1,  8, BAYER_PACK_8},
+    {V4L2_PIX_FMT_SRGGB10,  0, 0, 10, BAYER_PACK_16},
+    {V4L2_PIX_FMT_SGRBG10,  1, 0, 10, BAYER_PACK_16},
+    {V4L2_PIX_FMT_SGBRG10,  0, 1, 10, BAYER_PACK_16},
+    {V4L2_PIX_FMT_SBGGR10,  1, 1, 10, BAYER_PACK_16},
+    {V4L2_PIX_FMT_SRGGB12,  0, 0, 12, BAYER_PACK_16},
+    {V4L2_PIX_FMT_SGRBG12,  1, 0, 12, BAYER_PACK_16},
+    {V4L2_PIX_FMT_SGBRG12,  0, 1, 12, BAYER_PACK_16},
+    {V4L2_PIX_FMT_SBGGR12,  1, 1, 12, BAYER_PACK_16},
+    {V4L2_PIX_FMT_SRGGB10P, 0, 0, 10, BAYER_PACK_MIPI10},
+    {V4L2_PIX_FMT_SGRBG10P, 1, 0, 10, BAYER_PACK_MIPI10},
+    {V4L2_PIX_FMT_SGBRG10P, 0, 1, 10, BAYER_PACK_MIPI10},
+    {V4L2_PIX_FMT_SBGGR10P, 1, 1, 10, BAYER_PACK_MIPI10},
+    {V4L2_PIX_FMT_SRGGB12P, 0, 0, 12, BAYER_PACK_MIPI12},
+    {V4L2_PIX_FMT_SGRBG12P, 1, 0, 12, BAYER_PACK_MIPI12},
+    {V4L2_PIX_FMT_SGBRG12P, 0, 1, 12, BAYER_PACK_MIPI12},
+    {V4L2_PIX_FMT_SBGGR12P, 1, 1, 12, BAYER_PACK_MIPI12},
+};
+
+#define BAYER_NUM_FORMATS   (sizeof(kBayerFormats) / sizeof(kBayerFormats[0]))
+
+
+/** per stripe scratch: 3 unpacked lines and the rgb of 2 output rows */
+struct bayer_scratch {
+    uint8_t     *line[3];
+    int         tag[3];     /** source row held by line[i], BAYER_NO_ROW if none */
+    uint8_t     *rgb[2][3];
+};
+
+struct bayer_context {
+    const struct bayer_format *fmt;
+    int                 width;
+    int                 height;
+    int                 bytesperline;
+
+    void                *pool;      /** not owned */
+    int                 nscratch;
+    struct bayer_scratch scratch[BAYER_MAX_STRIPES];
+    uint8_t             *mem;
+
+    /** current frame, read by the stripe jobs */
+    const uint8_t       *src;
+    struct i420_buffer  *dst;
+    int                 rows;       /** per stripe, even */
+};
+
+
+static const struct bayer_format *bayer_find(uint32_t fourcc)
+{
+    for (unsigned int i = 0; i < BAYER_NUM_FORMATS; i++) {
+        if (kBayerFormats[i].fourcc == fourcc)
+            return &kBayerFormats[i];
+    }
+    return NULL;
+}
+
+int bayer_supported(uint32_t fourcc)
+{
+    return bayer_find(fourcc) != NULL;
+}
+
+uint32_t bayer_format(int index)
+{
+    if (index < 0 || index >= (int)BAYER_NUM_FORMATS)
+        return 0;
+    return kBayerFormats[index].fourcc;
+}
+
+
+// source row y to 8 bits with mirrored padding, the msbs are all we keep
+static void bayer_unpack(struct bayer_context *b, int y, uint8_t *line)
+{
+    const int w = b->width;
+    const uint8_t *src;
+    uint8_t *dst = line + BAYER_PAD;
+
+    // mirror rows around the edges, keeping the bayer phase
+    if (y < 0)
+        y = -y;
+    if (y >= b->height)
+        y = 2 * (b->height - 1) - y;
+    src = b->src + (size_t)y * b->bytesperline;
+
+    switch (b->fmt->packing) {
+        case BAYER_PACK_8:
+            memcpy(dst, src, w);
+            break;
+        case BAYER_PACK_16: {
+            const uint16_t *s = (const uint16_t *)src;
+            const int shift = b->fmt->depth - 8;
+            for (int x = 0; x < w; x++)
+                dst[x] = s[x] >> shift;
+            break;
+        }
+        case BAYER_PACK_MIPI10:
+            for (int x = 0, i = 0; x < w; x += 4, i += 5) {
+                dst[x] = src[i];
+                dst[x + 1] = src[i + 1];
+                dst[x + 2] = src[i + 2];
+                dst[x + 3] = src[i + 3];
+            }
+            break;
+        case BAYER_PACK_MIPI12:
+            for (int x = 0, i = 0; x < w; x += 2, i += 3) {
+                dst[x] = src[i];
+                dst[x + 1] = src[i + 1];
+            }
+            break;
+    }
+
+    dst[-1] = dst[1];
+    dst[-2] = dst[0];
+    dst[w] = dst[w - 2];
+    dst[w + 1] = dst[w - 1];
+}
+
+static const uint8_t *bayer_line(struct bayer_context *b, struct bayer_scratch *s, int y)
+{
+    int slot = (y + 3) % 3;
+
+    if (s->tag[slot] != y) {
+        bayer_unpack(b, y, s->line[slot]);
+        s->tag[slot] = y;
+    }
+    return s->line[slot] + BAYER_PAD;
+}
+
+
+/**
+ * bilinear demosaic of one row into r/g/b. pixels come in pairs starting at
+ * the R (or the G in the R column) column, the roles inside a pair only
+ * depend on the row, so the loops have no per-pixel branches. the rows are
+ * separate scratch lines: restrict lets the compiler vectorize without
+ * versioning for every pair of the 9 pointers, which it gives up on.
+ */
+static void bayer_demosaic_rg(const uint8_t *restrict u, const uint8_t *restrict c,
+                              const uint8_t *restrict d, int x0, int w,
+                              uint8_t *restrict r, uint8_t *restrict g, uint8_t *restrict bl)
+{
+    // R G R G
+    for (int x = x0; x < w; x += 2) {
+        r[x] = c[x];
+        g[x] = (c[x - 1] + c[x + 1] + u[x] + d[x] + 2) >> 2;
+        bl[x] = (u[x - 1] + u[x + 1] + d[x - 1] + d[x + 1] + 2) >> 2;
+
+        r[x + 1] = (c[x] + c[x + 2] + 1) >> 1;
+        g[x + 1] = c[x + 1];
+        bl[x + 1] = (u[x + 1] + d[x + 1] + 1) >> 1;
+    }
+}
+
+static void bayer_demosaic_gb(const uint8_t *restrict u, const uint8_t *restrict c,
+                              const uint8_t *restrict d, int x0, int w,
+                              uint8_t *restrict r, uint8_t *restrict g, uint8_t *restrict bl)
+{
+    // G B G B, G sits in the R column
+    for (int x = x0; x < w; x += 2) {
+        r[x] = (u[x] + d[x] + 1) >> 1;
+        g[x] = c[x];
+        bl[x] = (c[x - 1] + c[x + 1] + 1) >> 1;
+
+        r[x + 1] = (u[x] + u[x + 2] + d[x] + d[x + 2] + 2) >> 2;
+        g[x + 1] = (c[x] + c[x + 2] + u[x + 1] + d[x + 1] + 2) >> 2;
+        bl[x + 1] = c[x + 1];
+    }
+}
+
+static void bayer_demosaic_row(struct bayer_context *b, struct bayer_scratch *s, int y,
+                               uint8_t *r, uint8_t *g, uint8_t *bl)
+{
+    const uint8_t *u = bayer_line(b, s, y - 1);
+    const uint8_t *c = bayer_line(b, s, y);
+    const uint8_t *d = bayer_line(b, s, y + 1);
+
+    // outputs are offset by BAYER_PAD so the pair at x = -1 lands in padding
+    if (((y + b->fmt->ry) & 1) == 0)
+        bayer_demosaic_rg(u, c, d, -b->fmt->rx, b->width, r + BAYER_PAD, g + BAYER_PAD, bl + BAYER_PAD);
+    else
+        bayer_demosaic_gb(u, c, d, -b->fmt->rx, b->width, r + BAYER_PAD, g + BAYER_PAD, bl + BAYER_PAD);
+}
+
+
+// rgb of two rows to luma
+static void bayer_rgb_to_y(const uint8_t *restrict r, const uint8_t *restrict g,
+                           const uint8_t *restrict b, uint8_t *restrict y, int w)
+{
+    for (int x = 0; x < w; x++)
+        y[x] = ((66 * r[x] + 129 * g[x] + 25 * b[x] + 128) >> 8) + 16;
+}
+
+#define BAYER_AVG4(p0, p1, x)   (((p0)[x] + (p0)[(x) + 1] + (p1)[x] + (p1)[(x) + 1] + 2) >> 2)
+#define BAYER_U(r, g, b)        (((-38 * (r) - 74 * (g) + 112 * (b) + 128) >> 8) + 128)
+#define BAYER_V(r, g, b)        (((112 * (r) - 94 * (g) - 18 * (b) + 128) >> 8) + 128)
+
+// 2x2 averaged rgb to planar chroma
+static void bayer_rgb_to_uv(const uint8_t *restrict r0, const uint8_t *restrict g0, const uint8_t *restrict b0,
+                            const uint8_t *restrict r1, const uint8_t *restrict g1, const uint8_t *restrict b1,
+                            uint8_t *restrict cu, uint8_t *restrict cv, int w)
+{
+    // indexed by the chroma sample, x / 2 reads as a scatter to the vectorizer
+    for (int i = 0; i < w / 2; i++) {
+        int r = BAYER_AVG4(r0, r1, 2 * i);
+        int g = BAYER_AVG4(g0, g1, 2 * i);
+        int bb = BAYER_AVG4(b0, b1, 2 * i);
+
+        cu[i] = BAYER_U(r, g, bb);
+        cv[i] = BAYER_V(r, g, bb);
+    }
+}
+
+// same into interleaved nv12 chroma, a constant stride instead of a scatter
+static void bayer_rgb_to_uv_nv12(const uint8_t *restrict r0, const uint8_t *restrict g0, const uint8_t *restrict b0,
+                                 const uint8_t *restrict r1, const uint8_t *restrict g1, const uint8_t *restrict b1,
+                                 uint8_t *restrict uv, int w)
+{
+    for (int x = 0; x < w; x += 2) {
+        int r = BAYER_AVG4(r0, r1, x);
+        int g = BAYER_AVG4(g0, g1, x);
+        int bb = BAYER_AVG4(b0, b1, x);
+
+        uv[x] = BAYER_U(r, g, bb);
+        uv[x + 1] = BAYER_V(r, g, bb);
+    }
+}
+
+// rgb of output rows y, y + 1 to luma and one row of 4:2:0 chroma
+static void bayer_rgb_to_yuv(struct bayer_context *b, struct bayer_scratch *s, int y)
+{
+    struct i420_buffer *dst = b->dst;
+    const int w = b->width;
+    uint8_t *y0 = i420_buffer_dataY(dst) + y * dst->stride[0];
+    uint8_t *cu = i420_buffer_dataU(dst) + (y / 2) * dst->stride[1];
+    const uint8_t *r0 = s->rgb[0][0] + BAYER_PAD, *g0 = s->rgb[0][1] + BAYER_PAD, *b0 = s->rgb[0][2] + BAYER_PAD;
+    const uint8_t *r1 = s->rgb[1][0] + BAYER_PAD, *g1 = s->rgb[1][1] + BAYER_PAD, *b1 = s->rgb[1][2] + BAYER_PAD;
+
+    bayer_rgb_to_y(r0, g0, b0, y0, w);
+    bayer_rgb_to_y(r1, g1, b1, y0 + dst->stride[0], w);
+
+    if (dst->format == FOURCC_NV12)
+        bayer_rgb_to_uv_nv12(r0, g0, b0, r1, g1, b1, cu, w);
+    else
+        bayer_rgb_to_uv(r0, g0, b0, r1, g1, b1, cu,
+                        i420_buffer_dataV(dst) + (y / 2) * dst->stride[2], w);
+}
+
+
+static void bayer_stripe(void *arg, int job)
+{
+    struct bayer_context *b = (struct bayer_context *)arg;
+    struct bayer_scratch *s = &b->scratch[job];
+    int y0 = job * b->rows;
+    int y1 = y0 + b->rows;
+
+    if (y1 > b->height)
+        y1 = b->height;
+
+    s->tag[0] = s->tag[1] = s->tag[2] = BAYER_NO_ROW;
+
+    for (int y = y0; y < y1; y += 2) {
+        bayer_demosaic_row(b, s, y, s->rgb[0][0], s->rgb[0][1], s->rgb[0][2]);
+        bayer_demosaic_row(b, s, y + 1, s->rgb[1][0], s->rgb[1][1], s->rgb[1][2]);
+        bayer_rgb_to_yuv(b, s, y);
+    }
+}
+
+
+void *bayer_create(uint32_t fourcc, int width, int height, int bytesperline, void *pool)
+{
+    size_t linesize;
+    uint8_t *p;
+    struct bayer_context *b;
+    const struct bayer_format *fmt = bayer_find(fourcc);
+
+    if (fmt == NULL) {
+        ALOGE("%s: '%.4s' is not a bayer format", __func__, (char*)&fourcc);
+        return NULL;
+    }
+
+    if (width < 4 || height < 4 || (width & 3) || (height & 1)) {
+        ALOGE("%s: bad size %dx%d", __func__, width, height);
+        return NULL;
+    }
+
+    b = (struct bayer_context *)calloc(1, sizeof(*b));
+    if (b == NULL) {
+        ALOGE("%s: Failed to allocate bayer", __func__);
+        return NULL;
+    }
+
+    b->fmt = fmt;
+    b->width = width;
+    b->height = height;
+    b->bytesperline = bytesperline;
+    b->pool = pool;
+
+    b->nscratch = pool ? threadpool_size(pool) : 1;
+    if (b->nscratch > BAYER_MAX_STRIPES)
+        b->nscratch = BAYER_MAX_STRIPES;
+
+    // 3 lines + 2 x rgb per stripe, one allocation
+    linesize = (width + 2 * BAYER_PAD + 63) & ~63;
+    b->mem = (uint8_t *)malloc(linesize * 9 * b->nscratch);
+    if (b->mem == NULL) {
+        ALOGE("%s: Failed to allocate scratch", __func__);
+        free(b);
+        return NULL;
+    }
+
+    p = b->mem;
+    for (int i = 0; i < b->nscratch; i++) {
+        struct bayer_scratch *s = &b->scratch[i];
+        for (int j = 0; j < 3; j++, p += linesize)
+            s->line[j] = p;
+        for (int j = 0; j < 2; j++)
+            for (int k = 0; k < 3; k++, p += linesize)
+                s->rgb[j][k] = p;
+    }
+
+    ALOGD("%s: '%.4s' %dx%d depth %d, %d stripes", __func__, (char*)&fourcc,
+          width, height, fmt->depth, b->nscratch);
+    return b;
+}
+
+
+void bayer_destroy(void *handle)
+{
+    struct bayer_context *b = (struct bayer_context *)handle;
+
+    if (b == NULL)
+        return;
+
+    free(b->mem);
+    free(b);
+}
+
+
+int bayer_convert(void *handle, const uint8_t *src, struct i420_buffer *dst)
+{
+    int nstripes;
+    struct bayer_context *b = (struct bayer_context *)handle;
+
+    if (dst->width != b->width || dst->height != b->height ||
+        (dst->format != FOURCC_I420 && dst->format != FOURCC_NV12)) {
+        ALOGE("%s: bad destination '%.4s' %dx%d", __func__,
+              (char*)&dst->format, dst->width, dst->height);
+        return -1;
+    }
+
+    b->src = src;
+    b->dst = dst;
+
+    b->rows = (b->height + b->nscratch - 1) / b->nscratch;
+    b->rows = (b->rows + 1) & ~1;
+    nstripes = (b->height + b->rows - 1) / b->rows;
+
+    if (b->pool == NULL || nstripes == 1) {
+        bayer_stripe(b, 0);
+        return 0;
+    }
+
+    return threadpool_run(b->pool, nstripes, bayer_stripe, b);
+}
@@ -0,0 +1,37 @@
+#ifndef __BAYER_H__
+#define __BAYER_H__
+
+#include <stdint.h>
+
+#include "i420.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// 1 if fourcc is a raw bayer format bayer_convert handles
+int bayer_supported(uint32_t fourcc);
+
+// enumerate the supported fourccs, 0 past the last one
+uint32_t bayer_format(int index);
+
+/**
+ * demosaic raw bayer (RGGB/GRBG/GBRG/BGGR; 8 bit, 10/12 bit in 16 bit
+ * words, or mipi packed 10/12 bit) to I420 or NV12. bilinear
+ * interpolation, bt.601 limited range. pool (threadpool.h, may be NULL)
+ * splits each frame into stripes and is not owned.
+ */
+void *bayer_create(uint32_t fourcc, int width, int height, int bytesperline, void *pool);
+
+void bayer_destroy(void *handle);
+
+// dst format FOURCC_I420 or FOURCC_NV12, same size as the sensor
+int bayer_convert(void *handle, const uint8_t *src, struct i420_buffer *dst);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BAYER_H__ */
@@ -7,10 +7,12 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdarg.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/epoll.h>
 
 #include <linux/videodev2.h>
 
@@ -23,12 +25,38 @@
 #include "utils.h"
 #include "fourcc.h"
 #include "i420.h"
+#include "i420_pool.h"
+#include "frame.h"
+#include "reactor.h"
+#include "ring.h"
+#include "threadpool.h"
+#include "mjpeg.h"
+#include "recorder.h"
+#include "synth.h"
+#include "bayer.h"
+#include "motion.h"
+#include "yuv10.h"
 #include "camss.h"
 
+#ifndef V4L2_PIX_FMT_P010
+#define V4L2_PIX_FMT_P010           v4l2_fourcc('P', '0', '1', '0')
+#endif
+#ifndef V4L2_PIX_FMT_Y210
+#define V4L2_PIX_FMT_Y210           v4l2_fourcc('Y', '2', '1', '0')
+#endif
+#ifndef V4L2_PIX_FMT_Y10P
+#define V4L2_PIX_FMT_Y10P           v4l2_fourcc('Y', '1', '0', 'P')
+#endif
+
 #define V4L2_MODE_PREVIEW           0x0001  /**  For video preview */
 #define V4L2_MODE_VIDEO             0x0002  /**  For video record */
 #define V4L2_MODE_IMAGE             0x0003  /**  For image capture */
 
+#define CAMSS_MAX_CONSUMERS         8
+
+#define CAMSS_ADAPT_STEP            2       /** buffers added/kept as headroom */
+#define CAMSS_ADAPT_WINDOW          256     /** frames observed before a shrink */
+
 
 typedef enum _CamssErrorType {
     VIDEO_ERROR_NONE      =  0,
@@ -46,6 +74,7 @@ struct camss_param {
     uint32_t           width;       /** preview width */
     uint32_t           height;      /** preview height */
     uint32_t           frate;       /** preview framerate */
+    uint32_t           fourcc;      /** preferred pixelformat, 0 for default order */
 
     uint32_t           mode;        /** preview/shutter/record mode */
 };
@@ -59,6 +88,11 @@ struct camss_buffer {
     int             fd;
 };
 
+struct camss_consumer {
+    camss_frame_cb          callback;
+    void                    *opaque;
+};
+
 struct camss_context {
     int                     fd;
     struct v4l2_capability  cap;        /** camera caps */
@@ -69,13 +103,65 @@ struct camss_context {
     struct v4l2_pix_format  pixfmt;     /** actual pixel format used, w/h/pixelformat/bytesperline*/
 
     int                     nbufs;
+    int                     minbufs;
+    int                     maxbufs;    /** capacity of buffers/frames */
     struct camss_buffer     *buffers;
+    struct camss_frame      *frames;    /** one per buffer, shared with consumers */
+    void                    *i420pool;  /** aligned conversion targets */
 
-    struct i420_buffer      *i420;
-
-    pthread_t               thread;
-    int                     quit;
+    void                    *reactor;   /** epoll reactor dispatching DQBUF */
+    int                     reactor_id;     /** -1 once capture failed, see streaming */
+    int                     own_reactor;
+    int                     streaming;      /** camss_start to camss_stop, a failed capture included */
     camss_data_cb           datacb;
+    int                     passthrough;    /** hand I420/NV12/NV21 to consumers without conversion */
+    int                     convert_threads;
+    void                    *convpool;      /** stripe conversion threads, NULL if single threaded */
+    uint32_t                out_format;     /** requested consumer format, 0: passthrough or I420 */
+    uint32_t                conv_format;    /** conversion target, FOURCC_I420 or NV12 */
+    uint32_t                src_fourcc;     /** canonical capture fourcc, set on start */
+    i420_convert_fn         convert;        /** resolved on start, NULL: ConvertToI420 */
+    int                     decode_threads;
+    void                    *mjpeg;         /** parallel MJPEG decoder, NULL decodes inline */
+    struct mjpeg_stats      mjpeg_stats;    /** of the last stopped decoder */
+    void                    *recorder;      /** raw capture file, see camss_record */
+    struct recorder_stats   record_stats;   /** of the last closed recorder */
+    void                    *synth;         /** test pattern source instead of a v4l2 device */
+    void                    *bayer;         /** demosaic of raw sensors, created on start */
+    void                    *motion;        /** luma change detector, created on start */
+    int                     motion_threshold;   /** per mille, < 0: off. see camss_set_motion */
+    int                     motion_interval;    /** deliver one static frame in n, 0: none */
+    int                     static_run;         /** static frames since the last delivered one */
+
+    int                     queue_depth;    /** 0: process on the capture thread */
+    int                     queue_policy;   /** enum ring_policy */
+    void                    *ring;          /** capture -> worker */
+    struct ring_stats       ring_stats;     /** of the last stopped ring */
+
+    int                     adaptive;       /** grow/shrink nbufs by occupancy and loss */
+    int                     outstanding;    /** atomic, dequeued and not queued back */
+    int                     window_frames;
+    int                     window_peak;    /** max outstanding in window */
+    uint64_t                window_lost;    /** lost counter at window start */
+    int                     shrink_to;      /** pending shrink, done when nothing is outstanding */
+    uint32_t                frame_format;   /** passthrough format, 0 if converted */
+
+    uint32_t                last_sequence;
+    int                     has_sequence;   /** last_sequence valid, reset on start */
+    uint64_t                captured;       /** atomic counters, see camss_stats */
+    uint64_t                lost;
+    uint64_t                gaps;
+    uint64_t                errors;
+    uint64_t                motion_skipped;
+    uint64_t                convert_errors;
+    int                     failed;         /** atomic, enum camss_error that stopped capture */
+    camss_error_cb          error_cb;
+    void                    *error_opaque;
+    pthread_t               worker;
+    int                     worker_quit;
+
+    pthread_mutex_t         lock;       /** guards consumers */
+    struct camss_consumer   consumers[CAMSS_MAX_CONSUMERS];
 };
 
 /** g_parm --> s_parm --> g_parm */
@@ -181,32 +267,53 @@ static int camss_setup_focus(void *handle, int diopt)
 
 
 
+// Supported video formats in preferred order.
+/**
+ * V4L2_PIX_FMT_NV21:   csi/dvp camera
+ * V4L2_PIX_FMT_YUYV:   usb camera
+ * V4L2_PIX_FMT_NV12;
+ * V4L2_PIX_FMT_MJPEG:  usb camera above usb2 yuyv bandwidth, see mjpeg.c
+ * V4L2_PIX_FMT_JPEG
+ * V4L2_PIX_FMT_SGRBG10: raw bayer, and the other 8/10/12 bit bayer layouts
+ * V4L2_PIX_FMT_P010:   10 bit hdr cameras, after the 8 bit formats so
+ *                      they are only picked by choice (camss_config.fourcc)
+ ***/
+static const uint32_t camss_capture_fmts[] = {
+    V4L2_PIX_FMT_YUYV,
+    V4L2_PIX_FMT_NV21,
+    V4L2_PIX_FMT_NV12,
+    V4L2_PIX_FMT_YUV420,  // YU12
+    V4L2_PIX_FMT_UYVY,
+    V4L2_PIX_FMT_MJPEG,
+    V4L2_PIX_FMT_JPEG,
+    V4L2_PIX_FMT_P010,
+    V4L2_PIX_FMT_Y210,
+    V4L2_PIX_FMT_Y10P,
+};
+
+#define CAMSS_NUM_CAPTURE_FMTS  (sizeof(camss_capture_fmts) / sizeof(camss_capture_fmts[0]))
+#define CAMSS_MAX_TRY_FMTS      (CAMSS_NUM_CAPTURE_FMTS + 1 + 24)
+
 static int camss_try_format(void *handle, struct camss_param *param, uint32_t *fourcc, int *width, int *height)
 {
-    unsigned int fmts[7];
+    uint32_t fmts[CAMSS_MAX_TRY_FMTS];
+    int nfmts = 0;
     struct camss_context *camss = (struct camss_context *)handle;
 
-    // Supported video formats in preferred order.
-    /**
-     * V4L2_PIX_FMT_NV21:   csi/dvp camera
-     * V4L2_PIX_FMT_YUYV:   usb camera
-     * V4L2_PIX_FMT_NV12;
-     * V4L2_PIX_FMT_MJPEG
-     * V4L2_PIX_FMT_JPEG
-     * V4L2_PIX_FMT_SGRBG10: raw bayer ??
-     ***/
-
-    fmts[0] = V4L2_PIX_FMT_YUYV;
-    fmts[1] = V4L2_PIX_FMT_NV21;
-    fmts[2] = V4L2_PIX_FMT_NV12;
-    fmts[3] = V4L2_PIX_FMT_YUV420;  // YU12
-    fmts[4] = V4L2_PIX_FMT_UYVY;
-    fmts[5] = V4L2_PIX_FMT_MJPEG;   // FIXME: add jpeg handler for MJPEG
-    fmts[6] = V4L2_PIX_FMT_JPEG;
+    // caller's choice first, eg. MJPEG for 1080p on usb 2.0
+    if (param->fourcc)
+        fmts[nfmts++] = param->fourcc;
+
+    for (unsigned int i = 0; i < CAMSS_NUM_CAPTURE_FMTS; ++i)
+        fmts[nfmts++] = camss_capture_fmts[i];
+
+    // raw bayer last, for sensors without an isp (see bayer.c)
+    for (int i = 0; nfmts < (int)CAMSS_MAX_TRY_FMTS && bayer_format(i); ++i)
+        fmts[nfmts++] = bayer_format(i);
 
     // emum supported fourcc list from kernel driver
     *fourcc = 0;
-    for (int i = 0; i < 7; ++i) {
+    for (int i = 0; i < nfmts; ++i) {
 
         if (v4l2_enum_fmt(camss->fd, camss->buftype, fmts[i])) {
             *fourcc = fmts[i];
@@ -334,7 +441,28 @@ static int camss_request_buffer(void *handle, uint32_t *memtype, int num)
 }
 
 
-static int mmap_alloc_buffers(void *handle, int num)
+/** VIDIOC_EXPBUF, return dmabuf fd of an MMAP buffer or -1 */
+static int camss_export_buffer(struct camss_context *cam, int index)
+{
+    struct v4l2_exportbuffer expbuf;
+
+    memset(&expbuf, 0, sizeof(struct v4l2_exportbuffer));
+    expbuf.type = cam->buftype;
+    expbuf.index = index;
+    expbuf.plane = 0;
+    expbuf.flags = O_CLOEXEC | O_RDWR;
+
+    if (v4l2_expbuf(cam->fd, &expbuf) != 0) {
+        ALOGW("%s: buffer %d not exportable (%d)", __func__, index, errno);
+        return -1;
+    }
+
+    ALOGD("%s: buffer %d dmabuf fd %d", __func__, index, expbuf.fd);
+    return expbuf.fd;
+}
+
+
+static int mmap_alloc_buffers(void *handle, int first, int num)
 {
     struct v4l2_buffer buf;
     struct camss_buffer *buffer;
@@ -347,7 +475,7 @@ static int mmap_alloc_buffers(void *handle, int num)
     buf.memory = cam->memtype;
 
 
-    for (int i = 0; i < num; i++) {
+    for (int i = first; i < first + num; i++) {
 
         buf.index = i;
         //把VIDIOC_REQBUFS中分配的数据缓存转换成物理地址
@@ -373,6 +501,9 @@ static int mmap_alloc_buffers(void *handle, int num)
 
         ALOGD("Buffer mapped at address %p.", buffer->start);
 
+        // share by fd, a driver without VIDIOC_EXPBUF still works by pointer
+        buffer->fd = camss_export_buffer(cam, i);
+
         // enqueue this buffer
         if (v4l2_qbuf(cam->fd, &buf) != 0) {
             ALOGE("Unable to queue buffer (%d).", errno);
@@ -386,14 +517,20 @@ static int mmap_alloc_buffers(void *handle, int num)
 
 bail:
 
-    for (int i = 0; i < cam->nbufs; i++) {
+    for (int i = first; i < first + num; i++) {
         buffer = &cam->buffers[i];
-        if (buffer->start == MAP_FAILED) {
+        if (buffer->fd >= 0) {
+            close(buffer->fd);
+            buffer->fd = -1;
+        }
+
+        if (buffer->start == MAP_FAILED || buffer->start == NULL) {
             buffer->start = NULL;
             break;
         }
 
         munmap(buffer->start, buffer->length);
+        buffer->start = NULL;
     }
 
     return ret;
@@ -454,51 +591,17 @@ bail:
 }
 
 
+/*
+ * V4L2_MEMORY_DMABUF imports fds allocated elsewhere (drm/ion heap), which
+ * camss has no allocator for. MMAP is always tried first and exports its
+ * buffers as dmabuf, see camss_export_buffer().
+ */
 static int dmabuf_alloc_buffers(void *handle, int num)
 {
-#if 0
-    int i;
-    struct camss_buffer *buffer;
-    struct v4l2_exportbuffer expbuf;
-    CamssErrorType   ret  = VIDEO_ERROR_NONE;
-    struct camss_context *cam = (struct camss_context *)handle;
-
-    /* export the buffers */
-    memset(&expbuf, 0, sizeof(struct v4l2_exportbuffer));
-    expbuf.type = cam->buftype;
-    expbuf.flags = O_CLOEXEC;
-
-    for (i = 0; i < num; i++) {
-        expbuf.index = i;
-
-        if (v4l2_export_buffer (cam->fd, &expbuf) < 0) {
-            ALOGE("get dma buf(%d) failed", i);
-            ret = VIDEO_ERROR_MAPFAIL;
-            goto bail;
-        }
-
-        buffer = &cam->buffers[i];
-
-        buffer->fd = expbuf.fd;
-        //buffer->length = format.fmt.pix.sizeimage;
-
-        // enqueue this buffer
-        buf.m.fd = buffer->fd;
-        if (v4l2_qbuf(cam->fd, &buf) != 0) {
-            ALOGE("Unable to queue buffer (%d).", errno);
-            ret = VIDEO_ERROR_APIFAIL;
-            goto bail;
-        }
-
-    }
-
-bail:
-    return ret;
-#else
     (void)&num;
     (void)&handle;
-    return VIDEO_ERROR_NONE;
-#endif
+    ALOGE("%s: dmabuf import not supported", __func__);
+    return VIDEO_ERROR_NOBUFFERS;
 }
 
 /*
@@ -520,18 +623,24 @@ static int camss_alloc_buffers(void *handle, int count)
 
     camss->memtype = memtype;
     camss->nbufs = count;
+    if (camss->maxbufs < count)
+        camss->maxbufs = count;
 
-    /** alloc buffers */
-    camss->buffers = calloc(count, sizeof(struct camss_buffer));
+    /** alloc buffers, room for growing up to maxbufs */
+    camss->buffers = calloc(camss->maxbufs, sizeof(struct camss_buffer));
     if (camss->buffers == NULL) {
         ALOGE("%s: Failed to allocate cam_buffer", __func__);
         ret = VIDEO_ERROR_NOMEM;
         goto bail;
     }
 
+    for (int i = 0; i < camss->maxbufs; i++) {
+        camss->buffers[i].fd = -1;
+    }
+
     /** map/export and enqueue buffers */
     if (memtype == V4L2_MEMORY_MMAP) {
-        ret = mmap_alloc_buffers(camss, camss->nbufs);
+        ret = mmap_alloc_buffers(camss, 0, camss->nbufs);
     } else if (memtype == V4L2_MEMORY_USERPTR) {
         ret = userptr_alloc_buffers(camss, camss->nbufs);
     } else if (memtype == V4L2_MEMORY_DMABUF) {
@@ -543,35 +652,51 @@ static int camss_alloc_buffers(void *handle, int count)
 bail:
     if (camss->buffers != NULL) {
         free(camss->buffers);
+        camss->buffers = NULL;
     }
+    camss->nbufs = 0;
     return VIDEO_ERROR_NOMEM;
 }
 
 
+static void camss_unmap_buffer(struct camss_context *camss, int i)
+{
+    struct camss_buffer *buffer = &camss->buffers[i];
+
+    if (camss->memtype == V4L2_MEMORY_MMAP) {
+        if (buffer->fd >= 0)
+            close(buffer->fd);   /** importers keep their own reference */
+        if (buffer->start)
+            munmap(buffer->start, buffer->length);
+    } else if (camss->memtype == V4L2_MEMORY_USERPTR) {
+        free(buffer->start);
+    }
+    buffer->fd = -1;
+    buffer->start = NULL;
+}
+
+static void camss_unmap_buffers(struct camss_context *camss)
+{
+    for (int i = 0; i < camss->nbufs && camss->buffers != NULL; ++i) {
+        camss_unmap_buffer(camss, i);
+    }
+}
+
 static int camss_free_buffers(void *handle)
 {
-    int i;
     struct v4l2_requestbuffers reqb;
     struct camss_context *camss = (struct camss_context *)handle;
     struct camss_buffer *buffers = camss->buffers;
 
     // TODO: need dequeue first ?
-    for (i = 0; i < camss->nbufs; ++i) {
-        if (camss->memtype == V4L2_MEMORY_MMAP) {
-            munmap(buffers[i].start, buffers[i].length);
-        } else if (camss->memtype == V4L2_MEMORY_USERPTR) {
-            free(buffers[i].start);
-        } else if (camss->memtype == V4L2_MEMORY_DMABUF) {
-            ;/** TODO */
-        }
-    }
+    camss_unmap_buffers(camss);
 
     // release buffers:  request count = 0 for clean-up
     memset(&reqb, 0, sizeof(struct v4l2_requestbuffers));
     reqb.count = 0;
     reqb.type = camss->buftype;
     reqb.memory = camss->memtype;
-    if (v4l2_reqbufs(camss->fd, &reqb) != 0) {
+    if (camss->synth == NULL && v4l2_reqbufs(camss->fd, &reqb) != 0) {
         ALOGE("Unable to request buffers: %d.", errno);
     }
 
@@ -582,36 +707,6 @@ static int camss_free_buffers(void *handle)
     return 0;
 }
 
-static int camss_frame_avail(void *handle)
-{
-    int ret;
-    fd_set rdset;
-    struct timeval timeout;
-
-    struct camss_context *cam = (struct camss_context *)handle;
-
-    FD_ZERO(&rdset);
-    FD_SET(cam->fd, &rdset);
-
-    timeout.tv_sec = 1; /* 1 sec timeout*/
-    timeout.tv_usec = 0;
-
-    /* select - wait for data or timeout*/
-    ret = select(cam->fd + 1, &rdset, NULL, NULL, &timeout);
-    if (ret <= 0) {
-        ALOGE("Could not grab image (select error/timeout),try again...");
-        return ret;
-    }
-
-
-    if ((ret > 0) && (FD_ISSET(cam->fd, &rdset)))
-        return 1;
-
-    return -1;
-}
-
-
-
 static int camss_dump_raw(const char *fname, struct camss_buffer *cambuf)
 {
     uint64_t start;
@@ -632,240 +727,1344 @@ static int camss_dump_raw(const char *fname, struct camss_buffer *cambuf)
 }
 
 
-// push or pull ??
-static void camss_thread(void *data)
+static int camss_queue_buffer(struct camss_context *camss, int index)
 {
-    int ret = 0;
+    struct v4l2_buffer buf;
 
-    static int64_t lastMs = 0;
-    int target_w, target_h, stride_y, stride_uv;
-    struct camss_context *camss = (struct camss_context *)data;
+    if (camss->synth) {
+        return synth_qbuf(camss->synth, index, camss->buffers[index].start) == 0 ?
+               VIDEO_ERROR_NONE : VIDEO_ERROR_APIFAIL;
+    }
 
-    const int32_t width = camss->pixfmt.width;
-    const int32_t height = camss->pixfmt.height;
-    uint32_t src_type = camss->pixfmt.pixelformat;
+    memset (&buf, 0, sizeof(buf));
+    buf.type = camss->buftype;
+    buf.memory = camss->memtype;
+    buf.index = index;
 
+    if (camss->memtype == V4L2_MEMORY_USERPTR) {
+        buf.m.userptr = (unsigned long)camss->buffers[index].start;
+        buf.length = camss->buffers[index].length;
+    }
 
-    if (src_type == V4L2_PIX_FMT_YUYV) {
-        target_w = width;
-        target_h = height;
-        stride_y = width;
-        stride_uv = (width + 1) / 2;
-        camss->i420 = i420_buffer_create(target_w, target_h, stride_y, stride_uv, stride_uv);
-        if (camss->i420 == NULL) {
-            goto bail;
-        }
+    if (v4l2_qbuf(camss->fd, &buf) != 0) {
+        ALOGE("v4l2_qbuf error");
+        return VIDEO_ERROR_APIFAIL;
     }
+    return VIDEO_ERROR_NONE;
+}
 
+// last reference dropped, give the buffer back to the driver. outstanding
+// only drops once the QBUF is done: at 0 no thread is inside one, which is
+// what lets camss_adapt_queue reallocate the buffers
+static void camss_frame_release(struct camss_frame *frame)
+{
+    struct camss_context *camss = (struct camss_context *)frame->priv;
 
-    while(!camss->quit) {
+    camss_queue_buffer(camss, frame->index);
+    __atomic_sub_fetch(&camss->outstanding, 1, __ATOMIC_RELEASE);
+}
 
-        if (camss_frame_avail(camss) > 0) {
-            struct v4l2_buffer buf;
+static void camss_count(uint64_t *counter, uint64_t n)
+{
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
 
-            memset (&buf, 0, sizeof(buf));
-            buf.type = camss->buftype;
-            buf.memory = camss->memtype;
+// luma of the captured bytes for motion_detect, 0 if it is not directly readable
+static int camss_raw_luma(struct camss_context *camss, struct camss_frame *frame,
+                          const uint8_t **luma, int *step)
+{
+    const uint8_t *data = (const uint8_t *)frame->data;
+
+    switch (camss->pixfmt.pixelformat) {
+        case V4L2_PIX_FMT_YUV420:
+        case V4L2_PIX_FMT_NV12:
+        case V4L2_PIX_FMT_NV21:
+            *luma = data;
+            *step = 1;
+            return 1;
+        case V4L2_PIX_FMT_YUYV:
+            *luma = data;
+            *step = 2;
+            return 1;
+        case V4L2_PIX_FMT_UYVY:
+        case V4L2_PIX_FMT_P010:
+            // luma byte of the pair, msb byte of a little endian P010 sample
+            *luma = data + 1;
+            *step = 2;
+            return 1;
+        case V4L2_PIX_FMT_Y210:
+            *luma = data + 1;
+            *step = 4;
+            return 1;
+        case V4L2_PIX_FMT_Y10P:
+            *luma = data;
+            *step = MOTION_STEP_Y10P;
+            return 1;
+        default:
+            return 0;
+    }
+}
 
-            if (v4l2_dqbuf(camss->fd, &buf) != 0) {
-                ALOGE("v4l2_qbuf error");
-            }
+// luma of the image handed to consumers, for what camss_raw_luma can't read
+static int camss_image_luma(struct camss_frame *frame, const uint8_t **luma, int *step)
+{
+    switch (frame->format) {
+        case FOURCC_I420:
+        case FOURCC_NV12:
+        case FOURCC_NV21:
+            *luma = frame->plane[0];
+            *step = 1;
+            return 1;
+        case FOURCC_P010:
+            *luma = frame->plane[0] + 1;
+            *step = 2;
+            return 1;
+        case FOURCC_I010:
+            *luma = frame->plane[0];
+            *step = MOTION_STEP_I010;
+            return 1;
+        default:
+            return 0;
+    }
+}
 
-            //ALOGD("index=%02d, seq=%d, timestamp=%d%06d", buf.index, buf.sequence, (int)buf.timestamp.tv_sec, (int)buf.timestamp.tv_usec);
-            // add watermark
-            // 通知 preview线程 显示预览
-            // 如果需要拍照  则通知picture线程 进行拍照
-            // 如果需要录像 则通知record线程? 编码？
+/**
+ * score frame against the last delivered one. returns 1 if it is static
+ * and dropped, otherwise it becomes the new reference
+ */
+static int camss_motion_skip(struct camss_context *camss, struct camss_frame *frame,
+                             const uint8_t *luma, int stride, int step)
+{
+    frame->motion.score = motion_detect(camss->motion, luma, stride, step, frame->motion.map);
 
-            struct camss_buffer *cambuf = &camss->buffers[buf.index];
-            cambuf->bytesused = buf.bytesused;
+    if (frame->motion.score >= camss->motion_threshold ||
+        (camss->motion_interval > 0 && ++camss->static_run >= camss->motion_interval)) {
+        camss->static_run = 0;
+        motion_update(camss->motion);
+        return 0;
+    }
 
-            if (src_type == V4L2_PIX_FMT_YUYV) {
+    camss_count(&camss->motion_skipped, 1);
+    return 1;
+}
 
+static void camss_frame_deliver(struct camss_context *camss, struct camss_frame *frame)
+{
+    int n = 0;
+    int step;
+    const uint8_t *luma;
+    struct camss_consumer consumers[CAMSS_MAX_CONSUMERS];
+
+    // decoded/demosaiced frames are only measured now
+    if (camss->motion && frame->motion.score < 0 && camss_image_luma(frame, &luma, &step) &&
+        camss_motion_skip(camss, frame, luma, frame->stride[0], step))
+        return;
+
+    if (camss->datacb) {
+        camss->datacb(camss, frame->i420);
+    }
 
-            #if 0
-                ALOGD("kernel fourcc '%.4s' stride %d-%d-%d bytesused=%d", (char*)&src_type, stride_y,stride_uv,stride_uv, cambuf->bytesused);
-                //vlc -vvv --demux rawvideo --rawvid-fps 30 --rawvid-width 640 --rawvid-height 480 --rawvid-chroma YUYV 640x480.yuyv
-                char filename[64] = {0};
-                sprintf(filename, "./%dx%d.yuyv", width, height);
-                camss_dump_raw(filename, cambuf);
-            #endif
+    // snapshot, so a consumer can add/remove consumers from its callback
+    pthread_mutex_lock(&camss->lock);
+    for (int i = 0; i < CAMSS_MAX_CONSUMERS; i++) {
+        if (camss->consumers[i].callback)
+            consumers[n++] = camss->consumers[i];
+    }
+    pthread_mutex_unlock(&camss->lock);
 
-                ret = ToI420(cambuf->start, CanonicalFourCC(src_type), cambuf->bytesused, 0, 0, width, height, 0, camss->i420);
+    for (int i = 0; i < n; i++) {
+        consumers[i].callback(consumers[i].opaque, frame);
+    }
+}
 
-            }
+// convert if needed and hand the frame to every consumer, drops the caller's reference
+static void camss_frame_process(struct camss_context *camss, struct camss_frame *frame)
+{
+    int ret = 0;
+    int step;
+    const uint8_t *luma;
+    const int32_t width = camss->pixfmt.width;
+    const int32_t height = camss->pixfmt.height;
 
-            if (camss->datacb) {
-                ret = camss->datacb(camss, camss->i420);
-            }
+    // queued for the writer thread, a failed recording stops and only shows in stats
+    if (camss->recorder) {
+        recorder_write(camss->recorder, frame);
+    }
 
-            if (v4l2_qbuf(camss->fd, &buf) != 0) {
-                ALOGE("v4l2_qbuf error");
-            }
-        }
+    // a static frame is dropped before it costs a conversion
+    frame->motion.score = -1;
+    if (camss->motion && camss_raw_luma(camss, frame, &luma, &step) &&
+        camss_motion_skip(camss, frame, luma, camss->pixfmt.bytesperline, step)) {
+        camss_frame_unref(frame);
+        return;
     }
 
-bail:
-    return;
-}
+    // decoded and delivered in order by camss_mjpeg_output
+    if (camss->mjpeg) {
+        mjpeg_decoder_submit(camss->mjpeg, frame);
+        return;
+    }
 
-static int camss_setup(void *handle, int width, int height, int frate)
-{
-    int ret;
-    struct camss_param param;
-    struct camss_context *camss = (struct camss_context *)handle;
+    if (frame->i420) {
 
-    param.width  = width;
-    param.height = height;
-    param.frate = frate;
 
-    // setup format to kernel driver
-    ret = camss_setup_param(camss, &param);
+    #if 0
+        ALOGD("kernel fourcc '%.4s' bytesused=%d", (char*)&camss->pixfmt.pixelformat, frame->meta.bytesused);
+        //vlc -vvv --demux rawvideo --rawvid-fps 30 --rawvid-width 640 --rawvid-height 480 --rawvid-chroma YUYV 640x480.yuyv
+        char filename[64] = {0};
+        sprintf(filename, "./%dx%d.yuyv", width, height);
+        camss_dump_raw(filename, &camss->buffers[frame->index]);
+    #endif
 
-    // alloc buffer
-    ret = camss_alloc_buffers(camss, 8);
+        if (camss->bayer) {
+            ret = bayer_convert(camss->bayer, frame->data, frame->i420);
+        } else if (camss->convert) {
+            ret = ConvertI420_mt(camss->convpool, camss->convert, frame->data, 0, 0, width, height, frame->i420);
+        } else {
+            ret = ToI420_mt(camss->convpool, frame->data, camss->src_fourcc, frame->meta.bytesused, 0, 0, width, height, 0, frame->i420);
+        }
 
-    // start thread
-    if(pthread_create(&camss->thread, NULL, camss_thread, camss)) {
-        ALOGE("callVoid: failed to create a cam thread");
-        goto bail;
+        // whatever the converter left in the buffer is not a picture
+        if (ret < 0) {
+            camss_count(&camss->convert_errors, 1);
+            camss_frame_unref(frame);
+            return;
+        }
     }
 
-    return 0;
+    camss_frame_deliver(camss, frame);
 
-bail:
-    camss_free_buffers(camss);
-    return -1;
+    // consumers that kept the frame hold their own reference
+    camss_frame_unref(frame);
 }
 
-/**************************************************************/
-/*******  Camera Sensor low-level API                         */
-/**************************************************************/
+static void camss_mjpeg_output(void *opaque, struct camss_frame *frame)
+{
+    camss_frame_deliver((struct camss_context *)opaque, frame);
+    camss_frame_unref(frame);
+}
 
-void *camss_open(const char *devname, int width, int height, int frate)
+static void camss_frame_drop(void *item)
 {
-    int ret;
-    struct camss_context *camss;
-    int needCaps = (V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING);
+    camss_frame_unref((struct camss_frame *)item);
+}
 
-    camss = (struct camss_context*)calloc(1, sizeof(struct camss_context));
-    if (camss == NULL) {
-        ALOGE("%s: Failed to allocate camera context buffer", __func__);
-        goto bail;
-    }
+// processing side of the ring, capture only does DQBUF and push
+static void *camss_worker(void *data)
+{
+    struct camss_frame *frame;
+    struct camss_context *camss = (struct camss_context *)data;
 
-    camss->fd = v4l2_open_devname(devname, O_RDWR | O_NONBLOCK, 0);
-    if (camss->fd  < 0) {
-        ALOGE("%s: Failed to open camera device", __func__);
-        goto bail;
-    }
+    while (!__atomic_load_n(&camss->worker_quit, __ATOMIC_ACQUIRE)) {
+        ring_wait(camss->ring);
 
-    if (!v4l2_querycap(camss->fd, &camss->cap, needCaps)) {
-        ALOGE("%s: Failed to querycap", __func__);
-        goto bail;
+        while ((frame = ring_pop(camss->ring)) != NULL) {
+            camss_frame_process(camss, frame);
+        }
     }
 
-    uint32_t caps = camss->cap.capabilities;
+    return NULL;
+}
 
-    // assign buftype
-    if (caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE) {
-        camss->buftype = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-    } else if (caps & V4L2_CAP_VIDEO_CAPTURE) {
-        camss->buftype = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    } else if (caps & V4L2_CAP_VIDEO_OUTPUT_MPLANE) {
-        camss->buftype = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
-    } else if (caps & V4L2_CAP_VIDEO_OUTPUT) {
-        camss->buftype = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-    } else {
-        ALOGI("neither video capture nor video output supported.");
-    }
+// fill frame metadata and account sequence gaps
+static void camss_frame_set_meta(struct camss_context *camss, struct camss_frame *frame,
+                                struct v4l2_buffer *buf)
+{
+    struct camss_frame_meta *meta = &frame->meta;
 
+    meta->timestamp = buf->timestamp.tv_sec * UINT64_C(1000000) + buf->timestamp.tv_usec;
+    meta->recv_time = nowUs();
+    meta->sequence = buf->sequence;
+    meta->bytesused = buf->bytesused;
+    meta->field = buf->field;
+    meta->flags = buf->flags;
 
-    // enum all v4l2_input and set input index ??
-#if 0 // taken kernel hexium_gemini.c
-        static struct v4l2_input hexium_inputs[HEXIUM_INPUTS] = {
-            { 0, "CVBS 1",	V4L2_INPUT_TYPE_CAMERA,	0, 0, V4L2_STD_ALL, 0, V4L2_IN_CAP_STD },
-            { 1, "CVBS 2",	V4L2_INPUT_TYPE_CAMERA,	0, 0, V4L2_STD_ALL, 0, V4L2_IN_CAP_STD },
-            { 2, "CVBS 3",	V4L2_INPUT_TYPE_CAMERA,	0, 0, V4L2_STD_ALL, 0, V4L2_IN_CAP_STD },
-            { 3, "CVBS 4",	V4L2_INPUT_TYPE_CAMERA,	0, 0, V4L2_STD_ALL, 0, V4L2_IN_CAP_STD },
-            { 4, "CVBS 5",	V4L2_INPUT_TYPE_CAMERA,	0, 0, V4L2_STD_ALL, 0, V4L2_IN_CAP_STD },
-            { 5, "CVBS 6",	V4L2_INPUT_TYPE_CAMERA,	0, 0, V4L2_STD_ALL, 0, V4L2_IN_CAP_STD },
-            { 6, "Y/C 1",	V4L2_INPUT_TYPE_CAMERA,	0, 0, V4L2_STD_ALL, 0, V4L2_IN_CAP_STD },
-            { 7, "Y/C 2",	V4L2_INPUT_TYPE_CAMERA,	0, 0, V4L2_STD_ALL, 0, V4L2_IN_CAP_STD },
-            { 8, "Y/C 3",	V4L2_INPUT_TYPE_CAMERA,	0, 0, V4L2_STD_ALL, 0, V4L2_IN_CAP_STD },
-        };
-#endif
+    //ALOGD("index=%02d, seq=%d, timestamp=%" PRIu64, buf->index, buf->sequence, meta->timestamp);
 
-    // multi channel cvbs or hdmi need  select input, 0 for default;
-    {
-        int index = 0;
-        if (v4l2_s_input(camss->fd, index) != 0) {
-            ALOGE("%s: v4l2_s_input error!",__func__);
-            goto bail;
-        }
-    }
+    camss_count(&camss->captured, 1);
 
-    if (camss_setup(camss, width, height, frate) != 0) {
-        ALOGE("%s: v4l2_s_input error!",__func__);
-        goto bail;
+    if (buf->flags & V4L2_BUF_FLAG_ERROR) {
+        camss_count(&camss->errors, 1);
     }
 
-    return camss;
-
-bail:
-    close(camss->fd);
-    free(camss);
-    return NULL;
+    // the driver counts every frame it captured, also those it had no buffer for
+    if (camss->has_sequence && buf->sequence != camss->last_sequence + 1) {
+        uint32_t lost = buf->sequence - camss->last_sequence - 1;
+        if (lost < UINT32_MAX / 2) {
+            camss_count(&camss->lost, lost);
+            camss_count(&camss->gaps, 1);
+            ALOGW("sequence gap %u -> %u, %u frames lost", camss->last_sequence, buf->sequence, lost);
+        }
+    }
+    camss->last_sequence = buf->sequence;
+    camss->has_sequence = 1;
 }
 
-int camss_install_cb(void *handle, camss_data_cb callback)
-{
-    struct camss_context *camss = (struct camss_context *)handle;
-
-    camss->datacb = callback;
-    return 0;
-}
+static void camss_adapt_queue(struct camss_context *camss);
 
-int camss_start(void *handle)
+// synth_dqbuf dressed up as VIDIOC_DQBUF
+static int camss_synth_dqbuf(struct camss_context *camss, struct v4l2_buffer *buf)
 {
-    enum v4l2_buf_type type;
-    struct camss_context *camss = (struct camss_context *)handle;
+    struct synth_buffer sb;
 
-    /** stream_on */
-    type = camss->buftype;
-    if (v4l2_streamon(camss->fd, type) != 0) {
-        ALOGE("%s: Failed to stream on", __func__);
+    if (synth_dqbuf(camss->synth, &sb) != 0)
         return -1;
-    }
+
+    buf->index = sb.index;
+    buf->bytesused = sb.bytesused;
+    buf->sequence = sb.sequence;
+    buf->field = V4L2_FIELD_NONE;
+    buf->flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+    buf->timestamp.tv_sec = sb.timestamp / 1000000;
+    buf->timestamp.tv_usec = sb.timestamp % 1000000;
     return 0;
 }
 
-int camss_stop(void *handle)
+// stop watching the device for good and tell the owner, on the capture thread
+static void camss_fail(struct camss_context *camss, int error)
 {
-    enum v4l2_buf_type type;
-    struct camss_context *camss = (struct camss_context *)handle;
+    int id;
 
-    camss->quit = 1;
-    pthread_join(camss->thread, 0);
+    // the first error only, camss_stop may be racing for the source too
+    id = __atomic_exchange_n(&camss->reactor_id, -1, __ATOMIC_ACQ_REL);
+    if (id < 0)
+        return;
 
-    /** stream off */
-    type = camss->buftype;
-    if (v4l2_streamoff(camss->fd, type) != 0) {
-        ALOGE("%s: Failed to stream off", __func__);
-        return -1;
+    reactor_del(camss->reactor, id);
+    __atomic_store_n(&camss->failed, error, __ATOMIC_RELEASE);
+    camss_count(&camss->errors, 1);
+
+    if (camss->error_cb) {
+        camss->error_cb(camss->error_opaque, error);
     }
-    return 0;
 }
 
-int camss_close(void *handle)
+// called by the reactor when the v4l2 fd is readable
+static void camss_dispatch(void *opaque, uint32_t events)
 {
-    int ret;
-    struct camss_context *camss = (struct camss_context *)handle;
+    struct v4l2_buffer buf;
+    struct camss_frame *frame;
+    struct camss_context *camss = (struct camss_context *)opaque;
+
+    // not re-armed: a gone device would report this again on every wait
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        ALOGE("%s: device error, events 0x%x, capture stopped", __func__, events);
+        camss_fail(camss, CAMSS_ERROR_DEVICE);
+        return;
+    }
+
+    memset (&buf, 0, sizeof(buf));
+    buf.type = camss->buftype;
+    buf.memory = camss->memtype;
+
+    // one buffer per wakeup, epoll reports the fd again if more are ready
+    if (camss->synth) {
+        // nothing due, or the tick found every buffer taken (counted as a gap)
+        if (camss_synth_dqbuf(camss, &buf) != 0)
+            return;
+    } else if (v4l2_dqbuf(camss->fd, &buf) != 0) {
+        ALOGE("v4l2_dqbuf error");
+        return;
+    }
+
+    // added by a grow that found no frame for it, kept off the queue for good
+    if ((int)buf.index >= camss->nbufs) {
+        ALOGW("%s: buffer %u has no frame, dropped", __func__, buf.index);
+        camss_unmap_buffer(camss, buf.index);
+        return;
+    }
+
+    // add watermark
+    // 通知 preview线程 显示预览
+    // 如果需要拍照  则通知picture线程 进行拍照
+    // 如果需要录像 则通知record线程? 编码？
+
+    struct camss_buffer *cambuf = &camss->buffers[buf.index];
+    cambuf->bytesused = buf.bytesused;
+
+    frame = &camss->frames[buf.index];
+    frame->refcnt = 1;
+    __atomic_add_fetch(&camss->outstanding, 1, __ATOMIC_RELAXED);
+    camss_frame_set_meta(camss, frame, &buf);
+
+    if (camss->ring) {
+        // the ring owns the reference now, a dropped frame is re-queued at once
+        ring_push(camss->ring, frame);
+    } else {
+        camss_frame_process(camss, frame);
+    }
+
+    if (camss->adaptive) {
+        camss_adapt_queue(camss);
+    }
+}
+
+static void camss_free_frames(struct camss_context *camss)
+{
+    if (camss->frames == NULL)
+        return;
+
+    for (int i = 0; i < camss->maxbufs; i++) {
+        if (camss->frames[i].i420)
+            i420_buffer_destory(camss->frames[i].i420);
+        free(camss->frames[i].motion.map);
+    }
+
+    free(camss->frames);
+    camss->frames = NULL;
+
+    i420_pool_destroy(camss->i420pool);
+    camss->i420pool = NULL;
+}
+
+// formats consumers can take as they are
+static uint32_t camss_passthrough_format(uint32_t pixelformat)
+{
+    switch (pixelformat) {
+        case V4L2_PIX_FMT_YUV420:
+            return FOURCC_I420;
+        case V4L2_PIX_FMT_NV12:
+            return FOURCC_NV12;
+        case V4L2_PIX_FMT_NV21:
+            return FOURCC_NV21;
+        case V4L2_PIX_FMT_P010:
+            return FOURCC_P010;
+        default:
+            return 0;
+    }
+}
+
+// formats ToI420 can convert
+static int camss_convertible_format(uint32_t pixelformat)
+{
+    switch (pixelformat) {
+        case V4L2_PIX_FMT_YUYV:
+        case V4L2_PIX_FMT_UYVY:
+        case V4L2_PIX_FMT_YUV420:
+        case V4L2_PIX_FMT_NV12:
+        case V4L2_PIX_FMT_NV21:
+        case V4L2_PIX_FMT_MJPEG:
+        case V4L2_PIX_FMT_JPEG:
+        case V4L2_PIX_FMT_P010:
+        case V4L2_PIX_FMT_Y210:
+        case V4L2_PIX_FMT_Y10P:
+            return 1;
+        default:
+            return bayer_supported(pixelformat);
+    }
+}
+
+// view over the mapped buffer, strides follow the driver's bytesperline
+static void camss_frame_map_planes(struct camss_frame *frame, uint32_t format, int bytesperline)
+{
+    uint8_t *base = (uint8_t *)frame->data;
+    const int height = frame->height;
+
+    frame->format = format;
+    frame->stride[0] = bytesperline;
+    frame->plane[0] = base;
+
+    if (format == FOURCC_I420) {
+        frame->nplanes = 3;
+        frame->stride[1] = bytesperline / 2;
+        frame->stride[2] = bytesperline / 2;
+        frame->plane[1] = base + bytesperline * height;
+        frame->plane[2] = frame->plane[1] + frame->stride[1] * ((height + 1) / 2);
+    } else {
+        /** NV12/NV21: interleaved chroma, same stride as luma */
+        frame->nplanes = 2;
+        frame->stride[1] = bytesperline;
+        frame->plane[1] = base + bytesperline * height;
+    }
+}
+
+static void camss_frame_map_i420(struct camss_frame *frame)
+{
+    struct i420_buffer *i420 = frame->i420;
+
+    frame->format = i420->format;
+    frame->nplanes = i420->nplanes;
+    for (int i = 0; i < 3; i++) {
+        frame->plane[i] = i420_buffer_plane(i420, i);
+        frame->stride[i] = i420->stride[i];
+    }
+}
+
+// (re)bind frame i to buffer i, data moves when buffers are reallocated
+static int camss_init_frame(struct camss_context *camss, int i)
+{
+    struct camss_frame *frame = &camss->frames[i];
+    const uint32_t pixelformat = camss->pixfmt.pixelformat;
+
+    frame->release = camss_frame_release;
+    frame->priv = camss;
+    frame->index = i;
+    frame->data = camss->buffers[i].start;
+    frame->dmabuf_fd = camss->buffers[i].fd;
+    frame->fourcc = pixelformat;
+    frame->width = camss->pixfmt.width;
+    frame->height = camss->pixfmt.height;
+
+    if (camss->motion_threshold >= 0 && frame->motion.map == NULL) {
+        frame->motion.cols = frame->width / MOTION_BLOCK;
+        frame->motion.rows = frame->height / MOTION_BLOCK;
+        frame->motion.map = malloc((size_t)frame->motion.cols * frame->motion.rows);
+        if (frame->motion.map == NULL)
+            return VIDEO_ERROR_NOMEM;
+    }
+
+    if (camss->frame_format) {
+        camss_frame_map_planes(frame, camss->frame_format, camss->pixfmt.bytesperline);
+    } else if (camss_convertible_format(pixelformat)) {
+        if (frame->i420 == NULL)
+            frame->i420 = i420_pool_acquire(camss->i420pool, camss->conv_format, frame->width, frame->height);
+        if (frame->i420 == NULL)
+            return VIDEO_ERROR_NOMEM;
+        camss_frame_map_i420(frame);
+    }
+
+    return VIDEO_ERROR_NONE;
+}
+
+/*
+ * every buffer gets its own frame (and conversion target), so a frame
+ * held by a consumer is never overwritten by the next capture.
+ */
+static int camss_alloc_frames(struct camss_context *camss)
+{
+    const uint32_t pixelformat = camss->pixfmt.pixelformat;
+    const int width = camss->pixfmt.width;
+    const int height = camss->pixfmt.height;
+
+    camss->frame_format = camss->passthrough ? camss_passthrough_format(pixelformat) : 0;
+
+    // a requested output format only passes through when the sensor already has it
+    if (camss->out_format && camss->frame_format != camss->out_format)
+        camss->frame_format = 0;
+
+    // NV12 (or P010/I010 from 10 bit cameras) where there is a direct
+    // converter (not MJPEG), I420 otherwise
+    camss->conv_format = FOURCC_I420;
+    if ((camss->out_format == FOURCC_NV12 && bayer_supported(pixelformat)) ||
+        (camss->out_format && i420_find_converter(pixelformat, camss->out_format)))
+        camss->conv_format = camss->out_format;
+
+    camss->frames = calloc(camss->maxbufs, sizeof(struct camss_frame));
+    if (camss->frames == NULL) {
+        ALOGE("%s: Failed to allocate frames", __func__);
+        return VIDEO_ERROR_NOMEM;
+    }
+
+    if (!camss->frame_format && camss_convertible_format(pixelformat)) {
+        camss->i420pool = i420_pool_create();
+        if (camss->i420pool == NULL ||
+            i420_pool_reserve(camss->i420pool, camss->conv_format, width, height, camss->nbufs) != 0) {
+            camss_free_frames(camss);
+            return VIDEO_ERROR_NOMEM;
+        }
+    }
+
+    for (int i = 0; i < camss->nbufs; i++) {
+        if (camss_init_frame(camss, i) != VIDEO_ERROR_NONE) {
+            camss_free_frames(camss);
+            return VIDEO_ERROR_NOMEM;
+        }
+    }
+
+    ALOGD("%s: '%.4s' %s '%.4s'", __func__, (char*)&pixelformat,
+          camss->frame_format ? "passthrough" : "convert to",
+          camss->frame_format ? (char*)&camss->frame_format : (char*)&camss->conv_format);
+    return VIDEO_ERROR_NONE;
+}
+
+
+// add buffers while streaming (VIDIOC_CREATE_BUFS), runs on the capture thread
+static int camss_grow_buffers(struct camss_context *camss, int count)
+{
+    struct v4l2_create_buffers create;
+
+    memset(&create, 0, sizeof(create));
+    create.count = count;
+    create.memory = camss->memtype;
+    create.format.type = camss->buftype;
+
+    if (v4l2_g_fmt(camss->fd, &create.format) != 0 ||
+        v4l2_create_bufs(camss->fd, &create) != 0) {
+        ALOGW("%s: driver can't add buffers, adaptive grow off", __func__);
+        camss->maxbufs = camss->nbufs;
+        return VIDEO_ERROR_APIFAIL;
+    }
+
+    if ((int)create.index != camss->nbufs || create.count == 0 ||
+        (int)(create.index + create.count) > camss->maxbufs) {
+        ALOGE("%s: unexpected buffers %u+%u", __func__, create.index, create.count);
+        camss->maxbufs = camss->nbufs;
+        return VIDEO_ERROR_NOBUFFERS;
+    }
+
+    if (mmap_alloc_buffers(camss, create.index, create.count) != VIDEO_ERROR_NONE) {
+        camss->maxbufs = camss->nbufs;
+        return VIDEO_ERROR_MAPFAIL;
+    }
+
+    // the new buffers are queued already, dispatch drops them as they come back
+    for (int i = camss->nbufs; i < camss->nbufs + (int)create.count; i++) {
+        if (camss_init_frame(camss, i) != VIDEO_ERROR_NONE) {
+            ALOGE("%s: no frame for buffer %d, staying at %d", __func__, i, camss->nbufs);
+            camss->maxbufs = camss->nbufs;
+            return VIDEO_ERROR_NOMEM;
+        }
+    }
+    camss->nbufs += create.count;
+
+    ALOGI("%s: queue depth %d", __func__, camss->nbufs);
+    return VIDEO_ERROR_NONE;
+}
+
+// reallocate all buffers with a new count, only with nothing outstanding
+static int camss_resize_buffers(struct camss_context *camss, int count)
+{
+    struct v4l2_requestbuffers reqb;
+    enum v4l2_buf_type type = camss->buftype;
+
+    v4l2_streamoff(camss->fd, type);
+    camss_unmap_buffers(camss);
+
+    memset(&reqb, 0, sizeof(struct v4l2_requestbuffers));
+    reqb.count = count;
+    reqb.type = camss->buftype;
+    reqb.memory = camss->memtype;
+
+    // busy while an importer still holds an exported dmabuf, keep the old set
+    if (v4l2_reqbufs(camss->fd, &reqb) != 0 || reqb.count == 0) {
+        ALOGW("%s: can't reallocate buffers, adaptive shrink off", __func__);
+        camss->minbufs = camss->nbufs;
+    } else {
+        count = reqb.count < (unsigned)camss->maxbufs ? (int)reqb.count : camss->maxbufs;
+        for (int i = count; i < camss->nbufs; i++) {
+            if (camss->frames[i].i420) {
+                i420_buffer_destory(camss->frames[i].i420);
+                camss->frames[i].i420 = NULL;
+            }
+        }
+        camss->nbufs = count;
+    }
+
+    if (mmap_alloc_buffers(camss, 0, camss->nbufs) != VIDEO_ERROR_NONE) {
+        ALOGE("%s: Failed to map %d buffers", __func__, camss->nbufs);
+        return VIDEO_ERROR_MAPFAIL;
+    }
+
+    for (int i = 0; i < camss->nbufs; i++) {
+        if (camss_init_frame(camss, i) != VIDEO_ERROR_NONE) {
+            ALOGE("%s: no frame for buffer %d", __func__, i);
+            return VIDEO_ERROR_NOMEM;
+        }
+    }
+
+    camss->has_sequence = 0;
+    if (v4l2_streamon(camss->fd, type) != 0) {
+        ALOGE("%s: Failed to stream on", __func__);
+        return VIDEO_ERROR_APIFAIL;
+    }
+
+    ALOGI("%s: queue depth %d", __func__, camss->nbufs);
+    return VIDEO_ERROR_NONE;
+}
+
+static void camss_adapt_reset(struct camss_context *camss)
+{
+    camss->window_frames = 0;
+    camss->window_peak = 0;
+    camss->window_lost = __atomic_load_n(&camss->lost, __ATOMIC_RELAXED);
+}
+
+/*
+ * grow at once when the driver is down to its last buffer or frames got
+ * lost. shrink when a whole window used far fewer buffers than allocated,
+ * that needs a stream off/REQBUFS cycle so it waits for all frames back.
+ */
+static void camss_adapt_queue(struct camss_context *camss)
+{
+    int target;
+    int outstanding = __atomic_load_n(&camss->outstanding, __ATOMIC_ACQUIRE);
+    uint64_t lost = __atomic_load_n(&camss->lost, __ATOMIC_RELAXED);
+
+    if (outstanding > camss->window_peak)
+        camss->window_peak = outstanding;
+
+    if ((camss->nbufs - outstanding <= 1 || lost != camss->window_lost) &&
+        camss->nbufs < camss->maxbufs) {
+        target = camss->maxbufs - camss->nbufs;
+        camss_grow_buffers(camss, target < CAMSS_ADAPT_STEP ? target : CAMSS_ADAPT_STEP);
+        camss->shrink_to = 0;
+        camss_adapt_reset(camss);
+        return;
+    }
+
+    if (++camss->window_frames >= CAMSS_ADAPT_WINDOW) {
+        target = camss->window_peak + CAMSS_ADAPT_STEP;
+        if (target < camss->minbufs)
+            target = camss->minbufs;
+        if (lost == camss->window_lost && target + CAMSS_ADAPT_STEP <= camss->nbufs)
+            camss->shrink_to = target;
+        camss_adapt_reset(camss);
+    }
+
+    if (camss->shrink_to && outstanding == 0) {
+        // a refused REQBUFS already fell back to the old count, this is a
+        // map, frame or stream on failure with nothing left to capture into
+        if (camss_resize_buffers(camss, camss->shrink_to) != VIDEO_ERROR_NONE) {
+            camss->adaptive = 0;
+            camss_fail(camss, CAMSS_ERROR_BUFFERS);
+            return;
+        }
+        camss->shrink_to = 0;
+        camss_adapt_reset(camss);
+    }
+}
+
+static int camss_setup(void *handle, const struct camss_config *config)
+{
+    int ret;
+    int nbufs;
+    struct camss_param param;
+    struct camss_context *camss = (struct camss_context *)handle;
+
+    param.width  = config->width;
+    param.height = config->height;
+    param.frate = config->frate;
+    param.fourcc = config->fourcc;
+
+    // setup format to kernel driver
+    ret = camss_setup_param(camss, &param);
+
+    nbufs = config->nbufs > 0 ? config->nbufs : CAMSS_DEFAULT_BUFFERS;
+    camss->minbufs = nbufs;
+    camss->maxbufs = nbufs;
+    if (config->adaptive) {
+        camss->minbufs = config->min_bufs > 0 && config->min_bufs < nbufs ? config->min_bufs : 2;
+        camss->maxbufs = config->max_bufs > nbufs ? config->max_bufs : nbufs;
+    }
+
+    // alloc buffer
+    ret = camss_alloc_buffers(camss, nbufs);
+    if (ret != VIDEO_ERROR_NONE) {
+        goto bail;
+    }
+
+    // buffers are only added/reallocated for MMAP
+    camss->adaptive = config->adaptive && camss->memtype == V4L2_MEMORY_MMAP;
+
+    camss->decode_threads = config->decode_threads;
+
+    return 0;
+
+bail:
+    camss_free_buffers(camss);
+    return -1;
+}
+
+/**************************************************************/
+/*******  Camera Sensor low-level API                         */
+/**************************************************************/
+
+void *camss_open(const char *devname, int width, int height, int frate)
+{
+    struct camss_config config;
+
+    memset(&config, 0, sizeof(config));
+    config.width = width;
+    config.height = height;
+    config.frate = frate;
+
+    return camss_open_config(devname, &config);
+}
+
+/*
+ * "synth:<pattern>" devices: same buffers/frames/queue path as a USERPTR
+ * camera, synth.c plays the driver.
+ */
+static int camss_open_synth(struct camss_context *camss, const char *pattern,
+                            const struct camss_config *config)
+{
+    uint32_t fourcc = config->fourcc ? config->fourcc : V4L2_PIX_FMT_YUYV;
+    int nbufs = config->nbufs > 0 ? config->nbufs : CAMSS_DEFAULT_BUFFERS;
+
+    if (nbufs > SYNTH_MAX_BUFFERS)
+        nbufs = SYNTH_MAX_BUFFERS;
+
+    camss->synth = synth_create(*pattern ? pattern : NULL, fourcc,
+                                config->width, config->height, config->frate);
+    if (camss->synth == NULL) {
+        return -1;
+    }
+
+    camss->fd = synth_fd(camss->synth);
+    camss->buftype = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    camss->memtype = V4L2_MEMORY_USERPTR;
+
+    camss->pixfmt.width = config->width;
+    camss->pixfmt.height = config->height;
+    camss->pixfmt.pixelformat = fourcc;
+    camss->pixfmt.field = V4L2_FIELD_NONE;
+    camss->pixfmt.bytesperline = synth_bytesperline(camss->synth);
+    camss->pixfmt.sizeimage = synth_sizeimage(camss->synth);
+
+    camss->nbufs = nbufs;
+    camss->minbufs = nbufs;
+    camss->maxbufs = nbufs;
+    camss->decode_threads = config->decode_threads;
+
+    camss->buffers = calloc(camss->maxbufs, sizeof(struct camss_buffer));
+    if (camss->buffers == NULL) {
+        ALOGE("%s: Failed to allocate cam_buffer", __func__);
+        goto bail;
+    }
+
+    for (int i = 0; i < nbufs; i++) {
+        struct camss_buffer *buffer = &camss->buffers[i];
+
+        buffer->fd = -1;
+        buffer->length = camss->pixfmt.sizeimage;
+        if (posix_memalign(&buffer->start, 64, buffer->length) != 0) {
+            buffer->start = NULL;
+            ALOGE("%s: Failed to allocate buffer %d", __func__, i);
+            goto bail;
+        }
+        camss_queue_buffer(camss, i);
+    }
+
+    return 0;
+
+bail:
+    camss_unmap_buffers(camss);
+    free(camss->buffers);
+    camss->buffers = NULL;
+    synth_destroy(camss->synth);
+    camss->synth = NULL;
+    camss->fd = -1;
+    return -1;
+}
+
+void *camss_open_config(const char *devname, const struct camss_config *config)
+{
+    int ret;
+    struct camss_context *camss;
+    int needCaps = (V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING);
+
+    camss = (struct camss_context*)calloc(1, sizeof(struct camss_context));
+    if (camss == NULL) {
+        ALOGE("%s: Failed to allocate camera context buffer", __func__);
+        goto bail;
+    }
+
+    camss->reactor_id = -1;
+    camss->passthrough = 1;
+    camss->motion_threshold = -1;
+    pthread_mutex_init(&camss->lock, NULL);
+
+    if (strncmp(devname, CAMSS_SYNTH_PREFIX, strlen(CAMSS_SYNTH_PREFIX)) == 0) {
+        if (camss_open_synth(camss, devname + strlen(CAMSS_SYNTH_PREFIX), config) != 0)
+            goto bail;
+        return camss;
+    }
+
+    camss->fd = v4l2_open_devname(devname, O_RDWR | O_NONBLOCK, 0);
+    if (camss->fd  < 0) {
+        ALOGE("%s: Failed to open camera device", __func__);
+        goto bail;
+    }
+
+    if (!v4l2_querycap(camss->fd, &camss->cap, needCaps)) {
+        ALOGE("%s: Failed to querycap", __func__);
+        goto bail;
+    }
+
+    uint32_t caps = camss->cap.capabilities;
+
+    // assign buftype
+    if (caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE) {
+        camss->buftype = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    } else if (caps & V4L2_CAP_VIDEO_CAPTURE) {
+        camss->buftype = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    } else if (caps & V4L2_CAP_VIDEO_OUTPUT_MPLANE) {
+        camss->buftype = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    } else if (caps & V4L2_CAP_VIDEO_OUTPUT) {
+        camss->buftype = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    } else {
+        ALOGI("neither video capture nor video output supported.");
+    }
+
+
+    // enum all v4l2_input and set input index ??
+#if 0 // taken kernel hexium_gemini.c
+        static struct v4l2_input hexium_inputs[HEXIUM_INPUTS] = {
+            { 0, "CVBS 1",	V4L2_INPUT_TYPE_CAMERA,	0, 0, V4L2_STD_ALL, 0, V4L2_IN_CAP_STD },
+            { 1, "CVBS 2",	V4L2_INPUT_TYPE_CAMERA,	0, 0, V4L2_STD_ALL, 0, V4L2_IN_CAP_STD },
+            { 2, "CVBS 3",	V4L2_INPUT_TYPE_CAMERA,	0, 0, V4L2_STD_ALL, 0, V4L2_IN_CAP_STD },
+            { 3, "CVBS 4",	V4L2_INPUT_TYPE_CAMERA,	0, 0, V4L2_STD_ALL, 0, V4L2_IN_CAP_STD },
+            { 4, "CVBS 5",	V4L2_INPUT_TYPE_CAMERA,	0, 0, V4L2_STD_ALL, 0, V4L2_IN_CAP_STD },
+            { 5, "CVBS 6",	V4L2_INPUT_TYPE_CAMERA,	0, 0, V4L2_STD_ALL, 0, V4L2_IN_CAP_STD },
+            { 6, "Y/C 1",	V4L2_INPUT_TYPE_CAMERA,	0, 0, V4L2_STD_ALL, 0, V4L2_IN_CAP_STD },
+            { 7, "Y/C 2",	V4L2_INPUT_TYPE_CAMERA,	0, 0, V4L2_STD_ALL, 0, V4L2_IN_CAP_STD },
+            { 8, "Y/C 3",	V4L2_INPUT_TYPE_CAMERA,	0, 0, V4L2_STD_ALL, 0, V4L2_IN_CAP_STD },
+        };
+#endif
+
+    // multi channel cvbs or hdmi need  select input, 0 for default;
+    {
+        int index = 0;
+        if (v4l2_s_input(camss->fd, index) != 0) {
+            ALOGE("%s: v4l2_s_input error!",__func__);
+            goto bail;
+        }
+    }
+
+    if (camss_setup(camss, config) != 0) {
+        ALOGE("%s: v4l2_s_input error!",__func__);
+        goto bail;
+    }
+
+    return camss;
+
+bail:
+    close(camss->fd);
+    free(camss);
+    return NULL;
+}
+
+int camss_set_reactor(void *handle, void *reactor)
+{
+    struct camss_context *camss = (struct camss_context *)handle;
+
+    if (camss->reactor != NULL) {
+        ALOGE("%s: reactor already set", __func__);
+        return -1;
+    }
+
+    camss->reactor = reactor;
+    return 0;
+}
+
+int camss_set_passthrough(void *handle, int enable)
+{
+    struct camss_context *camss = (struct camss_context *)handle;
+
+    if (camss->frames != NULL) {
+        ALOGE("%s: must be called before camss_start", __func__);
+        return -1;
+    }
+
+    camss->passthrough = enable;
+    return 0;
+}
+
+int camss_set_output_format(void *handle, uint32_t fourcc)
+{
+    struct camss_context *camss = (struct camss_context *)handle;
+
+    if (camss->frames != NULL) {
+        ALOGE("%s: must be called before camss_start", __func__);
+        return -1;
+    }
+
+    if (fourcc != 0 && fourcc != FOURCC_I420 && fourcc != FOURCC_NV12 &&
+        fourcc != FOURCC_P010 && fourcc != FOURCC_I010) {
+        ALOGE("%s: unsupported output '%.4s'", __func__, (char*)&fourcc);
+        return -1;
+    }
+
+    camss->out_format = fourcc;
+    return 0;
+}
+
+int camss_set_queue(void *handle, int depth, int policy)
+{
+    struct camss_context *camss = (struct camss_context *)handle;
+
+    if (camss->ring != NULL) {
+        ALOGE("%s: must be called before camss_start", __func__);
+        return -1;
+    }
+
+    if (policy < RING_DROP_OLDEST || policy > RING_BLOCK) {
+        ALOGE("%s: bad policy %d", __func__, policy);
+        return -1;
+    }
+
+    camss->queue_depth = depth;
+    camss->queue_policy = policy;
+    return 0;
+}
+
+int camss_set_convert_threads(void *handle, int nthreads)
+{
+    struct camss_context *camss = (struct camss_context *)handle;
+
+    if (camss->frames != NULL) {
+        ALOGE("%s: must be called before camss_start", __func__);
+        return -1;
+    }
+
+    camss->convert_threads = nthreads;
+    return 0;
+}
+
+int camss_set_motion(void *handle, int threshold, int interval)
+{
+    struct camss_context *camss = (struct camss_context *)handle;
+
+    if (camss->frames != NULL) {
+        ALOGE("%s: must be called before camss_start", __func__);
+        return -1;
+    }
+
+    if (threshold > 1000 || interval < 0) {
+        ALOGE("%s: bad threshold %d / interval %d", __func__, threshold, interval);
+        return -1;
+    }
+
+    camss->motion_threshold = threshold;
+    camss->motion_interval = interval;
+    return 0;
+}
+
+int camss_record(void *handle, const char *path)
+{
+    struct camss_context *camss = (struct camss_context *)handle;
+
+    // not reactor_id: a failed capture drops it while the worker may still write
+    if (camss->streaming) {
+        ALOGE("%s: not while streaming", __func__);
+        return -1;
+    }
+
+    if (camss->recorder) {
+        recorder_get_stats(camss->recorder, &camss->record_stats);
+        recorder_close(camss->recorder);
+        camss->recorder = NULL;
+    }
+
+    if (path == NULL)
+        return 0;
+
+    memset(&camss->record_stats, 0, sizeof(camss->record_stats));
+
+    camss->recorder = recorder_open(path, camss->pixfmt.pixelformat,
+                                    camss->pixfmt.width, camss->pixfmt.height);
+    return camss->recorder ? 0 : -1;
+}
+
+int camss_get_stats(void *handle, struct camss_stats *stats)
+{
+    struct ring_stats rs;
+    struct camss_context *camss = (struct camss_context *)handle;
+
+    memset(stats, 0, sizeof(*stats));
+
+    if (camss->ring) {
+        ring_get_stats(camss->ring, &rs);
+    } else {
+        rs = camss->ring_stats;
+    }
+
+    stats->queued = rs.pushed;
+    stats->processed = rs.popped;
+    stats->dropped_oldest = rs.dropped_oldest;
+    stats->dropped_newest = rs.dropped_newest;
+    stats->blocked = rs.blocked;
+
+    stats->captured = __atomic_load_n(&camss->captured, __ATOMIC_RELAXED);
+    stats->lost = __atomic_load_n(&camss->lost, __ATOMIC_RELAXED);
+    stats->gaps = __atomic_load_n(&camss->gaps, __ATOMIC_RELAXED);
+    stats->errors = __atomic_load_n(&camss->errors, __ATOMIC_RELAXED);
+    stats->motion_skipped = __atomic_load_n(&camss->motion_skipped, __ATOMIC_RELAXED);
+    stats->convert_errors = __atomic_load_n(&camss->convert_errors, __ATOMIC_RELAXED);
+    stats->failed = __atomic_load_n(&camss->failed, __ATOMIC_ACQUIRE);
+
+    // camss_stop destroys the decoder, it clears the pointer under the lock first
+    pthread_mutex_lock(&camss->lock);
+    if (camss->mjpeg) {
+        mjpeg_decoder_get_stats(camss->mjpeg, &camss->mjpeg_stats);
+    }
+    stats->decode_errors = camss->mjpeg_stats.errors;
+    stats->decode_overruns = camss->mjpeg_stats.overruns;
+    pthread_mutex_unlock(&camss->lock);
+
+    if (camss->recorder) {
+        recorder_get_stats(camss->recorder, &camss->record_stats);
+    }
+    stats->recorded = camss->record_stats.frames;
+    stats->record_dropped = camss->record_stats.dropped;
+    stats->record_error = camss->record_stats.error;
+
+    stats->nbufs = camss->nbufs;
+    stats->outstanding = __atomic_load_n(&camss->outstanding, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int camss_set_error_cb(void *handle, camss_error_cb callback, void *opaque)
+{
+    struct camss_context *camss = (struct camss_context *)handle;
+
+    camss->error_cb = callback;
+    camss->error_opaque = opaque;
+    return 0;
+}
+
+int camss_install_cb(void *handle, camss_data_cb callback)
+{
+    struct camss_context *camss = (struct camss_context *)handle;
+
+    camss->datacb = callback;
+    return 0;
+}
+
+int camss_add_consumer(void *handle, camss_frame_cb callback, void *opaque)
+{
+    int id = -1;
+    struct camss_context *camss = (struct camss_context *)handle;
+
+    pthread_mutex_lock(&camss->lock);
+    for (int i = 0; i < CAMSS_MAX_CONSUMERS; i++) {
+        if (camss->consumers[i].callback == NULL) {
+            camss->consumers[i].callback = callback;
+            camss->consumers[i].opaque = opaque;
+            id = i;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&camss->lock);
+
+    if (id < 0) {
+        ALOGE("%s: too many consumers", __func__);
+    }
+    return id;
+}
+
+int camss_remove_consumer(void *handle, int id)
+{
+    struct camss_context *camss = (struct camss_context *)handle;
+
+    if (id < 0 || id >= CAMSS_MAX_CONSUMERS)
+        return -1;
+
+    pthread_mutex_lock(&camss->lock);
+    camss->consumers[id].callback = NULL;
+    camss->consumers[id].opaque = NULL;
+    pthread_mutex_unlock(&camss->lock);
+    return 0;
+}
+
+static int camss_start_worker(struct camss_context *camss)
+{
+    camss->ring = ring_create(camss->queue_depth, camss->queue_policy, camss_frame_drop);
+    if (camss->ring == NULL) {
+        return -1;
+    }
+
+    camss->worker_quit = 0;
+    if (pthread_create(&camss->worker, NULL, camss_worker, camss)) {
+        ALOGE("%s: failed to create worker thread", __func__);
+        ring_destroy(camss->ring);
+        camss->ring = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static void camss_stop_worker(struct camss_context *camss)
+{
+    struct camss_frame *frame;
+
+    if (camss->ring == NULL)
+        return;
+
+    __atomic_store_n(&camss->worker_quit, 1, __ATOMIC_RELEASE);
+    ring_wakeup(camss->ring);
+    pthread_join(camss->worker, NULL);
+
+    while ((frame = ring_pop(camss->ring)) != NULL) {
+        camss_frame_unref(frame);
+    }
+
+    ring_get_stats(camss->ring, &camss->ring_stats);
+    ring_destroy(camss->ring);
+    camss->ring = NULL;
+}
+
+int camss_start(void *handle)
+{
+    enum v4l2_buf_type type;
+    struct camss_context *camss = (struct camss_context *)handle;
+
+    // frames depend on the options set after open, build them on first start
+    if (camss->frames == NULL && camss_alloc_frames(camss) != VIDEO_ERROR_NONE) {
+        return -1;
+    }
+
+    // the caller thread takes a stripe too
+    if (camss->convert_threads > 1 && camss->convpool == NULL) {
+        camss->convpool = threadpool_create(camss->convert_threads - 1);
+    }
+
+    // per stream, not per frame: fourcc table lookup and converter choice
+    camss->src_fourcc = CanonicalFourCC(camss->pixfmt.pixelformat);
+    camss->convert = i420_find_converter(camss->src_fourcc, camss->conv_format);
+
+    // the 10 bit converters would fail every frame, say so once instead
+    if (camss->convert && camss->convert == yuv10_find_converter(camss->src_fourcc, camss->conv_format) &&
+        camss->pixfmt.width > YUV10_MAX_WIDTH) {
+        ALOGE("%s: 10 bit conversion of %d wide frames, over %d", __func__,
+              camss->pixfmt.width, YUV10_MAX_WIDTH);
+        return -1;
+    }
+
+    if (camss->bayer == NULL && bayer_supported(camss->pixfmt.pixelformat)) {
+        camss->bayer = bayer_create(camss->pixfmt.pixelformat, camss->pixfmt.width,
+                                    camss->pixfmt.height, camss->pixfmt.bytesperline,
+                                    camss->convpool);
+        if (camss->bayer == NULL)
+            return -1;
+    }
+
+    if (camss->motion_threshold >= 0 && camss->motion == NULL) {
+        camss->motion = motion_create(camss->pixfmt.width, camss->pixfmt.height, MOTION_NOISE_DEFAULT);
+        if (camss->motion == NULL)
+            return -1;
+    }
+
+    if (camss->decode_threads > 0 && camss->mjpeg == NULL &&
+        camss->src_fourcc == FOURCC_MJPG) {
+        void *mjpeg = mjpeg_decoder_create(camss->decode_threads, camss_mjpeg_output, camss);
+
+        pthread_mutex_lock(&camss->lock);
+        camss->mjpeg = mjpeg;
+        pthread_mutex_unlock(&camss->lock);
+    }
+
+    if (camss->queue_depth > 0 && camss_start_worker(camss) != 0) {
+        return -1;
+    }
+
+    // sequence restarts at 0 with every stream on
+    camss->has_sequence = 0;
+    camss->failed = CAMSS_ERROR_NONE;
+    camss->shrink_to = 0;
+    camss_adapt_reset(camss);
+
+    /** stream_on */
+    type = camss->buftype;
+    if (camss->synth) {
+        if (synth_start(camss->synth) != 0)
+            goto bail;
+    } else if (v4l2_streamon(camss->fd, type) != 0) {
+        ALOGE("%s: Failed to stream on", __func__);
+        goto bail;
+    }
+
+    // no shared reactor given, serve this camera from a private one
+    if (camss->reactor == NULL) {
+        camss->reactor = reactor_create(1, 0);
+        if (camss->reactor == NULL) {
+            goto bail;
+        }
+        camss->own_reactor = 1;
+    }
+
+    camss->reactor_id = reactor_add(camss->reactor, camss->fd, camss_dispatch, camss);
+    if (camss->reactor_id < 0) {
+        ALOGE("%s: Failed to watch camera fd", __func__);
+        goto bail;
+    }
+    camss->streaming = 1;
+    return 0;
+
+bail:
+    if (camss->synth)
+        synth_stop(camss->synth);
+    else
+        v4l2_streamoff(camss->fd, type);
+    camss_stop_worker(camss);
+    return -1;
+}
+
+int camss_stop(void *handle)
+{
+    int id;
+    void *mjpeg;
+    enum v4l2_buf_type type;
+    struct camss_context *camss = (struct camss_context *)handle;
+
+    // returns once an in-flight dispatch is done, no timeout to wait out.
+    // already gone if capture failed
+    id = __atomic_exchange_n(&camss->reactor_id, -1, __ATOMIC_ACQ_REL);
+    if (id >= 0) {
+        reactor_del(camss->reactor, id);
+    }
+
+    // capture is quiet now, let the worker finish and re-queue what is left
+    camss_stop_worker(camss);
+    camss->streaming = 0;
+
+    // out of camss_get_stats' way, destroyed unlocked: its workers deliver under the lock
+    pthread_mutex_lock(&camss->lock);
+    mjpeg = camss->mjpeg;
+    camss->mjpeg = NULL;
+    if (mjpeg) {
+        mjpeg_decoder_get_stats(mjpeg, &camss->mjpeg_stats);
+    }
+    pthread_mutex_unlock(&camss->lock);
+
+    if (mjpeg) {
+        mjpeg_decoder_destroy(mjpeg);
+    }
+
+    /** stream off */
+    type = camss->buftype;
+    if (camss->synth) {
+        return synth_stop(camss->synth);
+    }
+
+    if (v4l2_streamoff(camss->fd, type) != 0) {
+        ALOGE("%s: Failed to stream off", __func__);
+        return -1;
+    }
+    return 0;
+}
+
+int camss_close(void *handle)
+{
+    int ret;
+    struct camss_context *camss = (struct camss_context *)handle;
+
+    // the writer still holds frames over the mapped buffers
+    if (camss->recorder) {
+        recorder_close(camss->recorder);
+    }
 
     ret = camss_free_buffers(camss);
 
-    v4l2_close(camss->fd);
+    if (camss->own_reactor) {
+        reactor_destroy(camss->reactor);
+    }
+
+    camss_free_frames(camss);
+
+    bayer_destroy(camss->bayer);
+
+    motion_destroy(camss->motion);
+
+    threadpool_destroy(camss->convpool);
+
+    // a synth fd belongs to the generator
+    if (camss->synth)
+        synth_destroy(camss->synth);
+    else
+        v4l2_close(camss->fd);
 
+    pthread_mutex_destroy(&camss->lock);
     free(camss);
 
     return 0;
@@ -3,12 +3,105 @@
 #define __CAMSS_H__
 
 
+#include <stdint.h>
 
 typedef int (*camss_data_cb)(void *handle, void *data);
 
+struct camss_frame;
+
+/**
+ * frame consumer, called on the capture thread (or the queue worker, see
+ * camss_set_queue).
+ * the frame is only valid during the call unless the consumer takes a
+ * reference with camss_frame_ref() (see frame.h), which it must drop with
+ * camss_frame_unref() before camss_close().
+ */
+typedef void (*camss_frame_cb)(void *opaque, struct camss_frame *frame);
+
+/** why capture stopped on its own, see camss_set_error_cb */
+enum camss_error {
+    CAMSS_ERROR_NONE = 0,
+    CAMSS_ERROR_DEVICE,         /** EPOLLERR/EPOLLHUP on the device: unplugged, streaming stopped */
+    CAMSS_ERROR_BUFFERS,        /** adaptive queue could not reallocate its buffers */
+};
+
+/**
+ * capture stopped on error (enum camss_error), called once on the capture
+ * thread. no more frames come, camss_stop/camss_close still have to be called
+ */
+typedef void (*camss_error_cb)(void *opaque, int error);
+
+
+struct camss_stats {
+    uint64_t    captured;       /** frames dequeued */
+    uint64_t    lost;           /** frames missing from the driver sequence */
+    uint64_t    gaps;           /** sequence discontinuities */
+    uint64_t    errors;         /** buffers flagged V4L2_BUF_FLAG_ERROR, device errors */
+    int         failed;         /** enum camss_error that stopped capture, 0 if running */
+
+    /** capture -> worker queue, see camss_set_queue */
+    uint64_t    queued;
+    uint64_t    processed;
+    uint64_t    dropped_oldest;
+    uint64_t    dropped_newest;
+    uint64_t    blocked;
+
+    /** parallel MJPEG decoder, see camss_config.decode_threads */
+    uint64_t    decode_errors;
+    uint64_t    decode_overruns;
+
+    uint64_t    motion_skipped; /** static frames not delivered, see camss_set_motion */
+    uint64_t    convert_errors; /** frames dropped because their conversion failed */
+
+    /** camss_record */
+    uint64_t    recorded;
+    uint64_t    record_dropped; /** writer thread behind */
+    int         record_error;   /** errno that stopped the recording, 0 if none */
+
+    int         nbufs;          /** current v4l2 queue depth */
+    int         outstanding;    /** buffers held by camss/consumers */
+};
+
+
+/**
+ * devname of a virtual camera: "synth:bars", "synth:gradient" or
+ * "synth:noise" generate moving test patterns (synth.h) at the configured
+ * size, fourcc (YUYV default, NV12, YUV420) and frate, frate 0 runs as fast
+ * as consumers return buffers. for benchmarks and CI without a device.
+ */
+#define CAMSS_SYNTH_PREFIX      "synth:"
+
+#define CAMSS_DEFAULT_BUFFERS   8
+
+struct camss_config {
+    int         width;
+    int         height;
+    int         frate;
+    uint32_t    fourcc;     /** preferred v4l2 pixelformat, 0: built-in order */
+
+    int         nbufs;      /** v4l2 queue depth, 0: CAMSS_DEFAULT_BUFFERS */
+
+    /**
+     * adaptive: grow the queue (VIDIOC_CREATE_BUFS) up to max_bufs when the
+     * driver runs out of buffers or frames get lost, shrink towards min_bufs
+     * when occupancy stays low. MMAP drivers only.
+     */
+    int         adaptive;
+    int         min_bufs;
+    int         max_bufs;
+
+    /**
+     * MJPEG/JPEG cameras: decode on this many threads, output stays in
+     * capture order. 0 decodes on the capture (or queue worker) thread.
+     */
+    int         decode_threads;
+};
+
 
 void *camss_open(const char *devname, int width, int height, int frate);
 
+void *camss_open_config(const char *devname, const struct camss_config *config);
+
 int camss_close(void *handle);
 
 // stream on
@@ -18,8 +111,57 @@ int camss_start(void *handle);
 int camss_stop(void *handle);
 
 
+// serve this camera from a shared reactor (see reactor.h), call before camss_start.
+// without one, camss_start creates a private single thread reactor
+int camss_set_reactor(void *handle, void *reactor);
+
+// I420/NV12/NV21 cameras hand the mapped buffer to consumers without
+// conversion (default on). disable to get an i420 copy, call before camss_start
+int camss_set_passthrough(void *handle, int enable);
+
+// consumer image format: FOURCC_I420 or FOURCC_NV12 (fourcc.h), 0 (default)
+// passes I420/NV12/NV21/P010 through and converts the rest to I420. NV12 keeps
+// an NV12 sensor zero-copy and converts YUYV & co straight to NV12 for encoders
+// that take it. FOURCC_P010 or FOURCC_I010 keep the 10 bits of P010/Y210/Y10P
+// cameras (yuv10.h), 8 bit cameras still give I420. MJPEG still decodes to
+// I420. call before camss_start
+int camss_set_output_format(void *handle, uint32_t fourcc);
+
+// decouple capture from conversion/consumers with a depth-entry queue and a
+// worker thread. policy (enum ring_policy, ring.h) applies when the queue is
+// full. depth 0 (default) processes on the capture thread. call before camss_start
+int camss_set_queue(void *handle, int depth, int policy);
+
+// split the I420 conversion of each frame into stripes over nthreads
+// (capture/worker thread included). for 4K/high fps, call before camss_start
+int camss_set_convert_threads(void *handle, int nthreads);
+
+// score every frame's luma change against the last delivered frame (motion.h),
+// into frame->motion. frames with fewer changed blocks than threshold (per
+// mille) are static: one in interval of them is still converted and delivered,
+// 0 drops them all, 1 only measures. threshold < 0 (default) is off. static
+// frames are still recorded. call before camss_start
+int camss_set_motion(void *handle, int threshold, int interval);
+
+// record every captured frame, raw and with its metadata, to path
+// (recorder.h, replay with replay_open). written on a thread of its own,
+// frames it can't keep up with are dropped from the file, a write error
+// stops it (camss_stats.record_error). NULL stops and finishes the file,
+// camss_close does too. not while streaming
+int camss_record(void *handle, const char *path);
+
+int camss_get_stats(void *handle, struct camss_stats *stats);
+
+// tell the owner when capture stops on its own (camss_error_cb)
+int camss_set_error_cb(void *handle, camss_error_cb callback, void *opaque);
+
 // install camera data callback
 int camss_install_cb(void *handle, camss_data_cb callback);
 
+// add a frame consumer, returns consumer id or < 0
+int camss_add_consumer(void *handle, camss_frame_cb callback, void *opaque);
+
+int camss_remove_consumer(void *handle, int id);
+
 
 #endif
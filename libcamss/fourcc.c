@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 
 #include "fourcc.h"
@@ -10,43 +11,142 @@
 
 #define arraysize(array) ((int)(sizeof(array) / sizeof((array)[0])))
 
-struct FourCCAliasEntry {
-  uint32_t alias;
-  uint32_t canonical;
-};
+/**
+ * one row per fourcc, aliases included so a v4l2 code (YUYV, YU12, JPEG)
+ * resolves without a second step.
+ *          fourcc       canonical    planes sx sy bpp align depth
+ */
+#define YUV(f, c, p, sx, sy, bpp)   {f, c, p, sx, sy, bpp, 1 << (sx), 8}
+#define YUV16(f, c, p, sx, sy, bpp) {f, c, p, sx, sy, bpp, 1 << (sx), 10}
+#define RGB(f, c, bpp)              {f, c, 1, 0, 0, bpp, 1, 8}
+#define CODED(f, c)                 {f, c, 0, 0, 0, 0, 1, 8}
+
+static const struct fourcc_desc kFourCCTable[] = {
+  YUV(FOURCC_I420, FOURCC_I420, 3, 1, 1, 12),
+  YUV(FOURCC_I422, FOURCC_I422, 3, 1, 0, 16),
+  YUV(FOURCC_I444, FOURCC_I444, 3, 0, 0, 24),
+  YUV(FOURCC_I411, FOURCC_I411, 3, 2, 0, 12),
+  YUV(FOURCC_I400, FOURCC_I400, 1, 0, 0, 8),
+  YUV(FOURCC_NV21, FOURCC_NV21, 2, 1, 1, 12),
+  YUV(FOURCC_NV12, FOURCC_NV12, 2, 1, 1, 12),
+  YUV(FOURCC_YUY2, FOURCC_YUY2, 1, 1, 0, 16),
+  YUV(FOURCC_UYVY, FOURCC_UYVY, 1, 1, 0, 16),
+  YUV(FOURCC_M420, FOURCC_M420, 1, 1, 1, 12),
+  YUV(FOURCC_Q420, FOURCC_Q420, 1, 1, 1, 12),  // deprecated.
+  YUV(FOURCC_YV12, FOURCC_YV12, 3, 1, 1, 12),
+  YUV(FOURCC_YV16, FOURCC_YV16, 3, 1, 0, 16),
+  YUV(FOURCC_YV24, FOURCC_YV24, 3, 0, 0, 24),
+  YUV(FOURCC_J420, FOURCC_J420, 3, 1, 1, 12),
+  YUV(FOURCC_J400, FOURCC_J400, 1, 0, 0, 8),
+  YUV(FOURCC_H420, FOURCC_H420, 3, 1, 1, 12),
+  YUV16(FOURCC_P010, FOURCC_P010, 2, 1, 1, 24),
+  YUV16(FOURCC_I010, FOURCC_I010, 3, 1, 1, 24),
+  YUV16(FOURCC_Y210, FOURCC_Y210, 1, 1, 0, 32),
+  {FOURCC_Y10P, FOURCC_Y10P, 1, 0, 0, 10, 4, 10},  // 5 byte groups
+
+  RGB(FOURCC_ARGB, FOURCC_ARGB, 32),
+  RGB(FOURCC_BGRA, FOURCC_BGRA, 32),
+  RGB(FOURCC_ABGR, FOURCC_ABGR, 32),
+  RGB(FOURCC_RGBA, FOURCC_RGBA, 32),
+  RGB(FOURCC_24BG, FOURCC_24BG, 24),
+  RGB(FOURCC_RAW,  FOURCC_RAW,  24),
+  RGB(FOURCC_RGBP, FOURCC_RGBP, 16),
+  RGB(FOURCC_RGBO, FOURCC_RGBO, 16),
+  RGB(FOURCC_R444, FOURCC_R444, 16),
+  RGB(FOURCC_RGGB, FOURCC_RGGB, 8),
+  RGB(FOURCC_BGGR, FOURCC_BGGR, 8),
+  RGB(FOURCC_GRBG, FOURCC_GRBG, 8),
+  RGB(FOURCC_GBRG, FOURCC_GBRG, 8),
+
+  CODED(FOURCC_MJPG, FOURCC_MJPG),
+  CODED(FOURCC_H264, FOURCC_H264),
 
-static const struct FourCCAliasEntry kFourCCAliases[] = {
-  {FOURCC_IYUV, FOURCC_I420},
-  {FOURCC_YU12, FOURCC_I420},
-  {FOURCC_YU16, FOURCC_I422},
-  {FOURCC_YU24, FOURCC_I444},
-  {FOURCC_YUYV, FOURCC_YUY2},
-  {FOURCC_YUVS, FOURCC_YUY2},  // kCMPixelFormat_422YpCbCr8_yuvs
-  {FOURCC_HDYC, FOURCC_UYVY},
-  {FOURCC_2VUY, FOURCC_UYVY},  // kCMPixelFormat_422YpCbCr8
-  {FOURCC_JPEG, FOURCC_MJPG},  // Note: JPEG has DHT while MJPG does not.
-  {FOURCC_DMB1, FOURCC_MJPG},
-  {FOURCC_BA81, FOURCC_BGGR},  // deprecated.
-  {FOURCC_RGB3, FOURCC_RAW },
-  {FOURCC_BGR3, FOURCC_24BG},
-  {FOURCC_CM32, FOURCC_BGRA},  // kCMPixelFormat_32ARGB
-  {FOURCC_CM24, FOURCC_RAW },  // kCMPixelFormat_24RGB
-  {FOURCC_L555, FOURCC_RGBO},  // kCMPixelFormat_16LE555
-  {FOURCC_L565, FOURCC_RGBP},  // kCMPixelFormat_16LE565
-  {FOURCC_5551, FOURCC_RGBO},  // kCMPixelFormat_16LE5551
+  // aliases
+  YUV(FOURCC_IYUV, FOURCC_I420, 3, 1, 1, 12),
+  YUV(FOURCC_YU12, FOURCC_I420, 3, 1, 1, 12),
+  YUV(FOURCC_YU16, FOURCC_I422, 3, 1, 0, 16),
+  YUV(FOURCC_YU24, FOURCC_I444, 3, 0, 0, 24),
+  YUV(FOURCC_YUYV, FOURCC_YUY2, 1, 1, 0, 16),
+  YUV(FOURCC_YUVS, FOURCC_YUY2, 1, 1, 0, 16),  // kCMPixelFormat_422YpCbCr8_yuvs
+  YUV(FOURCC_HDYC, FOURCC_UYVY, 1, 1, 0, 16),
+  YUV(FOURCC_2VUY, FOURCC_UYVY, 1, 1, 0, 16),  // kCMPixelFormat_422YpCbCr8
+  CODED(FOURCC_JPEG, FOURCC_MJPG),  // Note: JPEG has DHT while MJPG does not.
+  CODED(FOURCC_DMB1, FOURCC_MJPG),
+  RGB(FOURCC_BA81, FOURCC_BGGR, 8),  // deprecated.
+  RGB(FOURCC_RGB3, FOURCC_RAW,  24),
+  RGB(FOURCC_BGR3, FOURCC_24BG, 24),
+  RGB(FOURCC_CM32, FOURCC_BGRA, 32),  // kCMPixelFormat_32ARGB
+  RGB(FOURCC_CM24, FOURCC_RAW,  24),  // kCMPixelFormat_24RGB
+  RGB(FOURCC_L555, FOURCC_RGBO, 16),  // kCMPixelFormat_16LE555
+  RGB(FOURCC_L565, FOURCC_RGBP, 16),  // kCMPixelFormat_16LE565
+  RGB(FOURCC_5551, FOURCC_RGBO, 16),  // kCMPixelFormat_16LE5551
 };
 // TODO(fbarchard): Consider mapping kCMPixelFormat_32BGRA to FOURCC_ARGB.
 //  {FOURCC_BGRA, FOURCC_ARGB},  // kCMPixelFormat_32BGRA
 
-uint32_t CanonicalFourCC(uint32_t fourcc)
+
+/** open addressing over table indices, 0 marks an empty slot */
+#define FOURCC_HASH_BITS    7
+#define FOURCC_HASH_SIZE    (1 << FOURCC_HASH_BITS)
+
+static uint8_t kFourCCHash[FOURCC_HASH_SIZE];
+static pthread_once_t kFourCCHashOnce = PTHREAD_ONCE_INIT;
+
+static uint32_t fourcc_hash(uint32_t fourcc)
 {
-  for (uint32_t i = 0; i < arraysize(kFourCCAliases); ++i) {
-    if (kFourCCAliases[i].alias == fourcc) {
-      return kFourCCAliases[i].canonical;
-    }
+  return (fourcc * 2654435761u) >> (32 - FOURCC_HASH_BITS);
+}
+
+static void fourcc_hash_init(void)
+{
+  assert(arraysize(kFourCCTable) < FOURCC_HASH_SIZE / 2);
+
+  for (int i = 0; i < arraysize(kFourCCTable); ++i) {
+    uint32_t h = fourcc_hash(kFourCCTable[i].fourcc);
+    while (kFourCCHash[h])
+      h = (h + 1) & (FOURCC_HASH_SIZE - 1);
+    kFourCCHash[h] = i + 1;
+  }
+}
+
+const struct fourcc_desc *fourcc_lookup(uint32_t fourcc)
+{
+  pthread_once(&kFourCCHashOnce, fourcc_hash_init);
+
+  for (uint32_t h = fourcc_hash(fourcc); kFourCCHash[h];
+       h = (h + 1) & (FOURCC_HASH_SIZE - 1)) {
+    const struct fourcc_desc *desc = &kFourCCTable[kFourCCHash[h] - 1];
+    if (desc->fourcc == fourcc)
+      return desc;
   }
-  // Not an alias, so return it as-is.
-  return fourcc;
+  return NULL;
+}
+
+size_t fourcc_frame_size(const struct fourcc_desc *desc, int width, int height)
+{
+  assert(width >= 0);
+  assert(height >= 0);
+
+  if (desc == NULL || desc->bpp == 0)
+    return 0;
+
+  // planar: full luma plus two subsampled chroma planes (or one interleaved)
+  if (desc->planes > 1) {
+    size_t sample = desc->depth > 8 ? 2 : 1;
+    size_t chroma_width = (width + (1 << desc->shift_x) - 1) >> desc->shift_x;
+    size_t chroma_height = (height + (1 << desc->shift_y) - 1) >> desc->shift_y;
+    return ((size_t)width * height + chroma_width * chroma_height * 2) * sample;
+  }
+
+  return (size_t)width * height * desc->bpp / 8;
+}
+
+uint32_t CanonicalFourCC(uint32_t fourcc)
+{
+  const struct fourcc_desc *desc = fourcc_lookup(fourcc);
+
+  // Not a known alias, so return it as-is.
+  return desc ? desc->canonical : fourcc;
 }
 
 
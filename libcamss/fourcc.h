@@ -3,6 +3,7 @@
 
 
 #include "stdint.h"
+#include "fourcc_desc.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -73,6 +74,14 @@ enum FourCC {
   FOURCC_J400 = FOURCC('J', '4', '0', '0'),  // unofficial fourcc
   FOURCC_H420 = FOURCC('H', '4', '2', '0'),  // unofficial fourcc
 
+  // 1 Biplanar 10 bit YUV format, 16 bit samples with data in the msbs.
+  FOURCC_P010 = FOURCC('P', '0', '1', '0'),
+
+  // 3 more 10 bit formats, see yuv10.c.
+  FOURCC_I010 = FOURCC('I', '0', '1', '0'),  // planar 4:2:0, data in the lsbs.
+  FOURCC_Y210 = FOURCC('Y', '2', '1', '0'),  // packed 4:2:2 Y0 U Y1 V, data in the msbs.
+  FOURCC_Y10P = FOURCC('Y', '1', '0', 'P'),  // greyscale, 4 samples in 5 bytes (mipi).
+
   // 14 Auxiliary aliases.  CanonicalFourCC() maps these to canonical fourcc.
   FOURCC_IYUV = FOURCC('I', 'Y', 'U', 'V'),  // Alias for I420.
   FOURCC_YU16 = FOURCC('Y', 'U', '1', '6'),  // Alias for I422.
@@ -138,6 +147,10 @@ enum FourCCBpp {
   FOURCC_BPP_J420 = 12,
   FOURCC_BPP_J400 = 8,
   FOURCC_BPP_H420 = 12,
+  FOURCC_BPP_P010 = 24,
+  FOURCC_BPP_I010 = 24,
+  FOURCC_BPP_Y210 = 32,
+  FOURCC_BPP_Y10P = 10,
   FOURCC_BPP_MJPG = 0,  // 0 means unknown.
   FOURCC_BPP_H264 = 0,
   FOURCC_BPP_IYUV = 12,
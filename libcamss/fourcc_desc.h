@@ -0,0 +1,38 @@
+#ifndef __FOURCC_DESC_H__
+#define __FOURCC_DESC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * layout of one fourcc, aliases carry the same layout as their canonical
+ * code. kept apart from fourcc.h so files built against libyuv (which has
+ * its own FOURCC_ enum) can use it too.
+ */
+struct fourcc_desc {
+    uint32_t    fourcc;
+    uint32_t    canonical;      /** fourcc itself if not an alias */
+    uint8_t     planes;         /** memory planes, 0 for compressed */
+    uint8_t     shift_x;        /** chroma subsampling, log2 */
+    uint8_t     shift_y;
+    uint8_t     bpp;            /** bits per pixel over all planes, 0 if variable */
+    uint8_t     align;          /** width alignment in pixels */
+    uint8_t     depth;          /** bits per sample, > 8 is stored in 16 bits unless bpp says packed */
+};
+
+// O(1) lookup, NULL for an unknown fourcc
+const struct fourcc_desc *fourcc_lookup(uint32_t fourcc);
+
+// bytes of a tightly packed frame, 0 for compressed or unknown formats
+size_t fourcc_frame_size(const struct fourcc_desc *desc, int width, int height);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __FOURCC_DESC_H__ */
@@ -0,0 +1,90 @@
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_TAG "frame"
+#include "liblog.h"
+
+#include "fourcc.h"
+#include "frame.h"
+
+
+struct camss_frame *camss_frame_ref(struct camss_frame *frame)
+{
+    __atomic_add_fetch(&frame->refcnt, 1, __ATOMIC_RELAXED);
+    return frame;
+}
+
+
+void camss_frame_unref(struct camss_frame *frame)
+{
+    // acq_rel: consumers' reads of the frame happen before the release
+    if (__atomic_sub_fetch(&frame->refcnt, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (frame->release)
+            frame->release(frame);
+    }
+}
+
+
+static void camss_frame_view_release(struct camss_frame *view)
+{
+    camss_frame_unref((struct camss_frame *)view->priv);
+    free(view);
+}
+
+
+struct camss_frame *camss_frame_crop(struct camss_frame *parent, int x, int y, int width, int height)
+{
+    int sample;
+    struct camss_frame *view;
+
+    if (parent->format == 0) {
+        ALOGE("%s: frame has no image to crop", __func__);
+        return NULL;
+    }
+
+    x &= ~1;
+    y &= ~1;
+    if (x < 0 || y < 0 || width <= 0 || height <= 0 ||
+        x + width > parent->width || y + height > parent->height) {
+        ALOGE("%s: %dx%d at %d,%d outside %dx%d", __func__,
+              width, height, x, y, parent->width, parent->height);
+        return NULL;
+    }
+
+    view = (struct camss_frame *)calloc(1, sizeof(*view));
+    if (view == NULL) {
+        ALOGE("%s: Failed to allocate view", __func__);
+        return NULL;
+    }
+
+    view->refcnt = 1;
+    view->release = camss_frame_view_release;
+    view->priv = camss_frame_ref(parent);
+    view->index = -1;
+    view->dmabuf_fd = -1;
+    view->fourcc = parent->fourcc;
+    view->width = width;
+    view->height = height;
+    view->meta = parent->meta;
+    // the parent's map covers the whole frame and is rewritten with its buffer
+    view->motion.score = -1;
+
+    view->format = parent->format;
+    view->nplanes = parent->nplanes;
+    memcpy(view->stride, parent->stride, sizeof(view->stride));
+
+    sample = parent->format == FOURCC_P010 || parent->format == FOURCC_I010 ? 2 : 1;
+    view->plane[0] = parent->plane[0] + y * parent->stride[0] + x * sample;
+    if (parent->nplanes == 3) {
+        view->plane[1] = parent->plane[1] + (y / 2) * parent->stride[1] + x / 2 * sample;
+        view->plane[2] = parent->plane[2] + (y / 2) * parent->stride[2] + x / 2 * sample;
+    } else {
+        // interleaved chroma: x / 2 pairs of two samples
+        view->plane[1] = parent->plane[1] + (y / 2) * parent->stride[1] + x * sample;
+    }
+
+    return view;
+}
@@ -0,0 +1,88 @@
+#ifndef __FRAME_H__
+#define __FRAME_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "i420.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** per-frame capture metadata */
+struct camss_frame_meta {
+    uint64_t            timestamp;  /** driver capture time, us (v4l2_buffer.timestamp) */
+    uint64_t            recv_time;  /** CLOCK_MONOTONIC at dequeue, us */
+    uint32_t            sequence;   /** driver frame counter, gaps mean lost frames */
+    uint32_t            bytesused;
+    uint32_t            field;      /** enum v4l2_field */
+    uint32_t            flags;      /** V4L2_BUF_FLAG_* */
+};
+
+/** luma change against the previously delivered frame, see camss_set_motion */
+struct camss_frame_motion {
+    int                 score;      /** changed blocks per mille, -1 if not measured */
+    int                 cols;       /** map size, MOTION_BLOCK (motion.h) pixels per cell */
+    int                 rows;
+    uint8_t             *map;       /** mean abs luma difference per cell, row major */
+};
+
+/**
+ * a captured frame shared by several consumers.
+ *
+ * the frame (and the driver buffer behind it) stays valid while a reference
+ * is held; release() runs when the last one drops, for camss frames this
+ * gives the buffer back to the driver (VIDIOC_QBUF).
+ */
+struct camss_frame {
+    int                 refcnt;     /** atomic, use camss_frame_ref/unref */
+    void                (*release)(struct camss_frame *frame);
+    void                *priv;      /** owner of the backing buffer */
+    int                 index;      /** owner's buffer index */
+
+    void                *data;      /** raw captured bytes, meta.bytesused long */
+    int                 dmabuf_fd;  /** exported buffer, -1 if none. owned by camss, dup() to keep */
+    uint32_t            fourcc;     /** v4l2 fourcc of data */
+    int                 width;
+    int                 height;
+
+    struct camss_frame_meta meta;
+    struct camss_frame_motion motion;
+
+    struct i420_buffer  *i420;      /** converted image, NULL if not converted */
+
+    /**
+     * planes of the image handed to consumers: over i420 when converted,
+     * straight over data (no copy) for passthrough formats.
+     */
+    uint32_t            format;     /** FOURCC_I420/NV12/NV21/P010/I010 (fourcc.h), 0 if no image */
+    int                 nplanes;
+    uint8_t             *plane[3];
+    int                 stride[3];
+};
+
+
+// take a reference, returns frame
+struct camss_frame *camss_frame_ref(struct camss_frame *frame);
+
+// drop a reference, the last one releases the frame
+void camss_frame_unref(struct camss_frame *frame);
+
+/**
+ * zero-copy view of the width x height rectangle at x, y of parent's image
+ * (digital zoom, roi encoding, tiles). only the planes are offset, nothing
+ * is copied: the view keeps a parent reference until its own last unref.
+ * x and y are rounded down to even for the 4:2:0 chroma. data, i420 and
+ * dmabuf_fd are not set on a view, use the planes. motion is not measured
+ * (score -1, no map) on a view, read it from the parent.
+ */
+struct camss_frame *camss_frame_crop(struct camss_frame *parent, int x, int y, int width, int height);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __FRAME_H__ */
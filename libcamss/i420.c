@@ -16,7 +16,14 @@
 #define LOG_TAG "i420"
 #include "liblog.h"
 
+#include "fourcc_desc.h"
 #include "i420.h"
+#include "i420_pool.h"
+#include "threadpool.h"
+#include "yuv10.h"
+
+/** rows per stripe are kept even so chroma rows pair up inside a stripe */
+#define I420_STRIPE_MIN_ROWS    16
 
 int i420_data_size(int height, int stride_y, int stride_u, int stride_v)
 {
@@ -40,6 +47,8 @@ struct i420_buffer *i420_buffer_create(int width, int height,
         return NULL;
     }
 
+    handle->format = FOURCC_I420;
+    handle->nplanes = 3;
     handle->width = width;
     handle->height = height;
     handle->stride[0] = stride_y;
@@ -47,20 +56,78 @@ struct i420_buffer *i420_buffer_create(int width, int height,
     handle->stride[2] = stride_v;
 
     int size = i420_data_size(height, stride_y, stride_u, stride_v);
-    //TODO: use memalign malloc
-    handle->data = (uint8_t*)malloc(size);
+    if (posix_memalign((void **)&handle->data, I420_ALIGN, size) != 0) {
+        ALOGE("%s: Failed to allocate %d bytes", __func__, size);
+        free(handle);
+        return NULL;
+    }
     memset(handle->data, 0 , size);
 
     return handle;
 }
 
 
+// bytes per sample, 10 bit formats sit in 16 bit containers
+static int i420_sample_size(uint32_t format)
+{
+    return format == FOURCC_P010 || format == FOURCC_I010 ? 2 : 1;
+}
+
 struct i420_buffer *i420_buffer_create2(int width, int height)
 {
     return i420_buffer_create(width, height, width, (width + 1) / 2, (width + 1) / 2);
 }
 
 
+int i420_buffer_layout(uint32_t format, int width, int height, int align, int stride[3])
+{
+    const int chroma_width = (width + 1) / 2;
+    const int sample = i420_sample_size(format);
+
+#define ALIGN_TO(x) (((x) + align - 1) / align * align)
+    stride[0] = ALIGN_TO(width * sample);
+
+    switch (format) {
+        case FOURCC_I420:
+        case FOURCC_I010:
+            stride[1] = ALIGN_TO(chroma_width * sample);
+            stride[2] = stride[1];
+            return 3;
+        case FOURCC_NV12:
+        case FOURCC_NV21:
+        case FOURCC_P010:
+            // interleaved chroma plane, no third plane
+            stride[1] = ALIGN_TO(chroma_width * 2 * sample);
+            stride[2] = 0;
+            return 2;
+        default:
+            return -1;
+    }
+#undef ALIGN_TO
+}
+
+
+struct i420_buffer *i420_buffer_create_format(uint32_t format, int width, int height)
+{
+    int stride[3];
+    int nplanes;
+    struct i420_buffer *handle;
+
+    nplanes = i420_buffer_layout(format, width, height, 1, stride);
+    if (nplanes < 0) {
+        ALOGE("%s: unsupported format '%.4s'", __func__, (char*)&format);
+        return NULL;
+    }
+
+    handle = i420_buffer_create(width, height, stride[0], stride[1], stride[2]);
+    if (handle) {
+        handle->format = format;
+        handle->nplanes = nplanes;
+    }
+    return handle;
+}
+
+
 
 uint8_t* i420_buffer_dataY(struct i420_buffer *handle)
 {
@@ -79,10 +146,30 @@ uint8_t* i420_buffer_dataV(struct i420_buffer *handle)
          handle->stride[1] * ((handle->height + 1) / 2);
 }
 
+uint8_t* i420_buffer_plane(struct i420_buffer *handle, int plane)
+{
+    if (plane >= handle->nplanes)
+        return NULL;
+
+    switch (plane) {
+        case 0:
+            return i420_buffer_dataY(handle);
+        case 1:
+            return i420_buffer_dataU(handle);
+        default:
+            return i420_buffer_dataV(handle);
+    }
+}
+
 
 
 void i420_buffer_destory(struct i420_buffer *handle)
 {
+    if (handle->pool) {
+        i420_pool_release(handle);
+        return;
+    }
+
     if (handle->data)
         free(handle->data);
 
@@ -110,9 +197,10 @@ int i420_buffer_print(struct i420_buffer *i420, const char *fname)
     if(!file)
         return -1;
 
-    int width = i420->width;
+    int sample = i420_sample_size(i420->format);
+    int width = i420->width * sample;
     int height = i420->height;
-    int chroma_width = (width + 1) / 2;
+    int chroma_width = (i420->width + 1) / 2 * sample;
     int chroma_height = (height + 1) / 2;
 
     int stride_y = i420->stride[0];
@@ -123,11 +211,17 @@ int i420_buffer_print(struct i420_buffer *i420, const char *fname)
         return -1;
     }
 
+    // biplanar: one interleaved chroma plane
+    if (i420->nplanes == 2) {
+        chroma_width *= 2;
+    }
+
     if (i420_plane_print(i420_buffer_dataU(i420), chroma_width, chroma_height, stride_u, file) < 0) {
         return -1;
     }
 
-    if (i420_plane_print(i420_buffer_dataV(i420), chroma_width, chroma_height, stride_v, file) < 0) {
+    if (i420->nplanes == 3 &&
+        i420_plane_print(i420_buffer_dataV(i420), chroma_width, chroma_height, stride_v, file) < 0) {
         return -1;
     }
 
@@ -138,38 +232,232 @@ int i420_buffer_print(struct i420_buffer *i420, const char *fname)
 
 size_t calc_buffer_size(uint32_t fourcc, int width, int height)
 {
-    assert(width >= 0);
-    assert(height >= 0);
-    size_t buffer_size = 0;
+    return fourcc_frame_size(fourcc_lookup(fourcc), width, height);
+}
+
+
+
+/** destination rows [y, y + rows) of an i420 buffer, as libyuv dst args */
+#define I420_DST_ROWS(dst, y) \
+    i420_buffer_dataY(dst) + (y) * (dst)->stride[0], (dst)->stride[0], \
+    i420_buffer_dataU(dst) + ((y) / 2) * (dst)->stride[1], (dst)->stride[1], \
+    i420_buffer_dataV(dst) + ((y) / 2) * (dst)->stride[2], (dst)->stride[2]
+
+static int i420_from_yuy2(const uint8_t *src, int src_width, int src_height,
+            int crop_x, int crop_y, struct i420_buffer *dst, int dst_y, int rows)
+{
+    int stride = src_width * 2;
+    const uint8_t *s = src + (crop_y + dst_y) * stride + crop_x * 2;
+
+    return YUY2ToI420(s, stride, I420_DST_ROWS(dst, dst_y), dst->width, rows);
+}
+
+static int i420_from_uyvy(const uint8_t *src, int src_width, int src_height,
+            int crop_x, int crop_y, struct i420_buffer *dst, int dst_y, int rows)
+{
+    int stride = src_width * 2;
+    const uint8_t *s = src + (crop_y + dst_y) * stride + crop_x * 2;
+
+    return UYVYToI420(s, stride, I420_DST_ROWS(dst, dst_y), dst->width, rows);
+}
+
+static int i420_from_planar(const uint8_t *src, int src_width, int src_height,
+            int crop_x, int crop_y, struct i420_buffer *dst, int dst_y, int rows, int swap_uv)
+{
+    int row = crop_y + dst_y;
+    int half_width = (src_width + 1) / 2;
+    const uint8_t *y = src + row * src_width + crop_x;
+    const uint8_t *u = src + src_width * src_height + (row / 2) * half_width + crop_x / 2;
+    const uint8_t *v = u + half_width * ((src_height + 1) / 2);
+
+    if (swap_uv) {
+        const uint8_t *t = u;
+        u = v;
+        v = t;
+    }
+
+    return I420Copy(y, src_width, u, half_width, v, half_width,
+                    I420_DST_ROWS(dst, dst_y), dst->width, rows);
+}
+
+static int i420_from_i420(const uint8_t *src, int src_width, int src_height,
+            int crop_x, int crop_y, struct i420_buffer *dst, int dst_y, int rows)
+{
+    return i420_from_planar(src, src_width, src_height, crop_x, crop_y, dst, dst_y, rows, 0);
+}
+
+static int i420_from_yv12(const uint8_t *src, int src_width, int src_height,
+            int crop_x, int crop_y, struct i420_buffer *dst, int dst_y, int rows)
+{
+    return i420_from_planar(src, src_width, src_height, crop_x, crop_y, dst, dst_y, rows, 1);
+}
+
+static int i420_from_nv12(const uint8_t *src, int src_width, int src_height,
+            int crop_x, int crop_y, struct i420_buffer *dst, int dst_y, int rows)
+{
+    int row = crop_y + dst_y;
+    int uv_stride = (src_width + 1) & ~1;
+    const uint8_t *y = src + row * src_width + crop_x;
+    const uint8_t *uv = src + src_width * src_height + (row / 2) * uv_stride + (crop_x & ~1);
+
+    return NV12ToI420(y, src_width, uv, uv_stride, I420_DST_ROWS(dst, dst_y), dst->width, rows);
+}
+
+static int i420_from_nv21(const uint8_t *src, int src_width, int src_height,
+            int crop_x, int crop_y, struct i420_buffer *dst, int dst_y, int rows)
+{
+    int row = crop_y + dst_y;
+    int vu_stride = (src_width + 1) & ~1;
+    const uint8_t *y = src + row * src_width + crop_x;
+    const uint8_t *vu = src + src_width * src_height + (row / 2) * vu_stride + (crop_x & ~1);
+
+    return NV21ToI420(y, src_width, vu, vu_stride, I420_DST_ROWS(dst, dst_y), dst->width, rows);
+}
+
+
+/** NV12 destination, same row range rules as I420_DST_ROWS */
+#define NV12_DST_ROWS(dst, y) \
+    i420_buffer_dataY(dst) + (y) * (dst)->stride[0], (dst)->stride[0], \
+    i420_buffer_dataU(dst) + ((y) / 2) * (dst)->stride[1], (dst)->stride[1]
+
+static int nv12_from_yuy2(const uint8_t *src, int src_width, int src_height,
+            int crop_x, int crop_y, struct i420_buffer *dst, int dst_y, int rows)
+{
+    int stride = src_width * 2;
+    const uint8_t *s = src + (crop_y + dst_y) * stride + crop_x * 2;
+
+    return YUY2ToNV12(s, stride, NV12_DST_ROWS(dst, dst_y), dst->width, rows);
+}
+
+static int nv12_from_uyvy(const uint8_t *src, int src_width, int src_height,
+            int crop_x, int crop_y, struct i420_buffer *dst, int dst_y, int rows)
+{
+    int stride = src_width * 2;
+    const uint8_t *s = src + (crop_y + dst_y) * stride + crop_x * 2;
+
+    return UYVYToNV12(s, stride, NV12_DST_ROWS(dst, dst_y), dst->width, rows);
+}
+
+static int nv12_from_planar(const uint8_t *src, int src_width, int src_height,
+            int crop_x, int crop_y, struct i420_buffer *dst, int dst_y, int rows, int swap_uv)
+{
+    int row = crop_y + dst_y;
+    int half_width = (src_width + 1) / 2;
+    const uint8_t *y = src + row * src_width + crop_x;
+    const uint8_t *u = src + src_width * src_height + (row / 2) * half_width + crop_x / 2;
+    const uint8_t *v = u + half_width * ((src_height + 1) / 2);
+
+    if (swap_uv) {
+        const uint8_t *t = u;
+        u = v;
+        v = t;
+    }
+
+    return I420ToNV12(y, src_width, u, half_width, v, half_width,
+                      NV12_DST_ROWS(dst, dst_y), dst->width, rows);
+}
+
+static int nv12_from_i420(const uint8_t *src, int src_width, int src_height,
+            int crop_x, int crop_y, struct i420_buffer *dst, int dst_y, int rows)
+{
+    return nv12_from_planar(src, src_width, src_height, crop_x, crop_y, dst, dst_y, rows, 0);
+}
+
+static int nv12_from_yv12(const uint8_t *src, int src_width, int src_height,
+            int crop_x, int crop_y, struct i420_buffer *dst, int dst_y, int rows)
+{
+    return nv12_from_planar(src, src_width, src_height, crop_x, crop_y, dst, dst_y, rows, 1);
+}
+
+// NV12 is a copy (into aligned strides), NV21 swaps the chroma pairs
+static int nv12_from_biplanar(const uint8_t *src, int src_width, int src_height,
+            int crop_x, int crop_y, struct i420_buffer *dst, int dst_y, int rows, int swap_uv)
+{
+    int row = crop_y + dst_y;
+    int uv_stride = (src_width + 1) & ~1;
+    int uv_width = (dst->width + 1) / 2;
+    const uint8_t *y = src + row * src_width + crop_x;
+    const uint8_t *uv = src + src_width * src_height + (row / 2) * uv_stride + (crop_x & ~1);
+    uint8_t *dst_uv = i420_buffer_dataU(dst) + (dst_y / 2) * dst->stride[1];
+
+    CopyPlane(y, src_width, i420_buffer_dataY(dst) + dst_y * dst->stride[0], dst->stride[0],
+              dst->width, rows);
+
+    if (swap_uv) {
+        SwapUVPlane(uv, uv_stride, dst_uv, dst->stride[1], uv_width, (rows + 1) / 2);
+    } else {
+        CopyPlane(uv, uv_stride, dst_uv, dst->stride[1], uv_width * 2, (rows + 1) / 2);
+    }
+    return 0;
+}
 
-    switch (fourcc) {
+static int nv12_from_nv12(const uint8_t *src, int src_width, int src_height,
+            int crop_x, int crop_y, struct i420_buffer *dst, int dst_y, int rows)
+{
+    return nv12_from_biplanar(src, src_width, src_height, crop_x, crop_y, dst, dst_y, rows, 0);
+}
+
+static int nv12_from_nv21(const uint8_t *src, int src_width, int src_height,
+            int crop_x, int crop_y, struct i420_buffer *dst, int dst_y, int rows)
+{
+    return nv12_from_biplanar(src, src_width, src_height, crop_x, crop_y, dst, dst_y, rows, 1);
+}
+
+
+static i420_convert_fn nv12_find_converter(uint32_t canonical)
+{
+    switch (canonical) {
+        case FOURCC_YUY2:
+            return nv12_from_yuy2;
+        case FOURCC_UYVY:
+            return nv12_from_uyvy;
         case FOURCC_I420:
+            return nv12_from_i420;
+        case FOURCC_YV12:
+            return nv12_from_yv12;
         case FOURCC_NV12:
+            return nv12_from_nv12;
         case FOURCC_NV21:
-        case FOURCC_YV12: {
-          int half_width = (width + 1) >> 1;
-          int half_height = (height + 1) >> 1;
-          buffer_size = width * height + half_width * half_height * 2;
-          break;
-        }
-        case FOURCC_R444:
-        case FOURCC_RGBP:
-        case FOURCC_RGBO:
+            return nv12_from_nv21;
+        default:
+            return NULL;
+    }
+}
+
+
+i420_convert_fn i420_find_converter(uint32_t fourcc, uint32_t dst_format)
+{
+    const struct fourcc_desc *desc = fourcc_lookup(fourcc);
+
+    if (desc == NULL)
+        return NULL;
+
+    // 10 bit on either side, see yuv10.c
+    if (desc->depth > 8 || dst_format == FOURCC_P010 || dst_format == FOURCC_I010)
+        return yuv10_find_converter(desc->canonical, dst_format);
+
+    if (dst_format == FOURCC_NV12)
+        return nv12_find_converter(desc->canonical);
+
+    if (dst_format != FOURCC_I420)
+        return NULL;
+
+    switch (desc->canonical) {
         case FOURCC_YUY2:
+            return i420_from_yuy2;
         case FOURCC_UYVY:
-          buffer_size = width * height * 2;
-          break;
-        case FOURCC_24BG:
-          buffer_size = width * height * 3;
-          break;
-        case FOURCC_BGRA:
-        case FOURCC_ARGB:
-          buffer_size = width * height * 4;
-          break;
+            return i420_from_uyvy;
+        case FOURCC_I420:
+            return i420_from_i420;
+        case FOURCC_YV12:
+            return i420_from_yv12;
+        case FOURCC_NV12:
+            return i420_from_nv12;
+        case FOURCC_NV21:
+            return i420_from_nv21;
         default:
-          break;
+            return NULL;
     }
-    return buffer_size;
 }
 
 
@@ -207,3 +495,121 @@ int ToI420(const uint8_t* src_frame, uint32_t src_type, size_t src_size,
                   rotation,
                   src_type);
 }
+
+
+
+struct i420_stripe_job {
+    const uint8_t       *src_frame;
+    uint32_t            src_type;
+    size_t              src_size;
+    int                 crop_x;
+    int                 crop_y;
+    int                 src_width;
+    int                 src_height;
+    int                 rows;       /** per stripe, even */
+    struct i420_buffer  *dst_frame;
+    i420_convert_fn     convert;    /** NULL: libyuv ConvertToI420 */
+    int                 error;      /** atomic, set by a stripe that failed */
+};
+
+static void i420_stripe_convert(void *arg, int job)
+{
+    struct i420_stripe_job *s = (struct i420_stripe_job *)arg;
+    int ret;
+    struct i420_buffer *dst = s->dst_frame;
+    int y = job * s->rows;
+    int h = s->rows;
+
+    if (y + h > dst->height)
+        h = dst->height - y;
+
+    if (s->convert) {
+        ret = s->convert(s->src_frame, s->src_width, s->src_height,
+                         s->crop_x, s->crop_y, dst, y, h);
+    } else {
+        ret = ConvertToI420(s->src_frame, s->src_size,
+                            i420_buffer_dataY(dst) + y * dst->stride[0],
+                            dst->stride[0],
+                            i420_buffer_dataU(dst) + (y / 2) * dst->stride[1],
+                            dst->stride[1],
+                            i420_buffer_dataV(dst) + (y / 2) * dst->stride[2],
+                            dst->stride[2],
+                            s->crop_x, s->crop_y + y,
+                            s->src_width, s->src_height,
+                            dst->width, h,
+                            0,
+                            s->src_type);
+    }
+
+    // the job returns no value, the caller checks this once all stripes ran
+    if (ret != 0)
+        __atomic_store_n(&s->error, 1, __ATOMIC_RELAXED);
+}
+
+
+static int i420_run_stripes(void *pool, struct i420_stripe_job *job)
+{
+    int nstripes = threadpool_size(pool);
+
+    job->rows = (job->dst_frame->height + nstripes - 1) / nstripes;
+    job->rows = (job->rows + 1) & ~1;
+    if (job->rows < I420_STRIPE_MIN_ROWS)
+        job->rows = I420_STRIPE_MIN_ROWS;
+    nstripes = (job->dst_frame->height + job->rows - 1) / job->rows;
+
+    job->error = 0;
+    if (threadpool_run(pool, nstripes, i420_stripe_convert, job) != 0)
+        return -1;
+    return __atomic_load_n(&job->error, __ATOMIC_RELAXED) ? -1 : 0;
+}
+
+
+int ToI420_mt(void *pool, const uint8_t* src_frame, uint32_t src_type, size_t src_size,
+            int crop_x, int crop_y, int src_width, int src_height,
+            int rotation, struct i420_buffer *dst_frame)
+{
+    struct i420_stripe_job job;
+
+    // rotation, vertical flip and jpeg decode work on the whole frame
+    if (pool == NULL || rotation != 0 || src_height < 0 || src_type == FOURCC_MJPG ||
+        (crop_y & 1) || dst_frame->height < 2 * I420_STRIPE_MIN_ROWS) {
+        return ToI420(src_frame, src_type, src_size, crop_x, crop_y,
+                      src_width, src_height, rotation, dst_frame);
+    }
+
+    job.convert = NULL;
+    job.src_frame = src_frame;
+    job.src_type = src_type;
+    job.src_size = src_size;
+    job.crop_x = crop_x;
+    job.crop_y = crop_y;
+    job.src_width = src_width;
+    job.src_height = src_height;
+    job.dst_frame = dst_frame;
+
+    return i420_run_stripes(pool, &job);
+}
+
+
+int ConvertI420_mt(void *pool, i420_convert_fn convert, const uint8_t* src_frame,
+            int crop_x, int crop_y, int src_width, int src_height,
+            struct i420_buffer *dst_frame)
+{
+    struct i420_stripe_job job;
+
+    if (pool == NULL || (crop_y & 1) || dst_frame->height < 2 * I420_STRIPE_MIN_ROWS) {
+        return convert(src_frame, src_width, src_height, crop_x, crop_y,
+                       dst_frame, 0, dst_frame->height);
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.convert = convert;
+    job.src_frame = src_frame;
+    job.crop_x = crop_x;
+    job.crop_y = crop_y;
+    job.src_width = src_width;
+    job.src_height = src_height;
+    job.dst_frame = dst_frame;
+
+    return i420_run_stripes(pool, &job);
+}
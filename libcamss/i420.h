@@ -7,11 +7,24 @@ extern "C" {
 
 
 
+#define I420_ALIGN      64      /** plane base and pooled stride alignment */
+
+/**
+ * 4:2:0 image in one allocation: planar I420/I010, or biplanar
+ * NV12/NV21/P010 (interleaved chroma in plane 1, no plane 2) so NV12
+ * sensors and encoders skip a deinterleave. 10 bit samples take 16 bits,
+ * P010/I010 strides are in bytes.
+ */
 struct i420_buffer {
+    uint32_t format;    /** FOURCC_I420, NV12, NV21, P010 or I010 */
+    int     nplanes;
     int     width;
     int     height;
-    int     stride[3];  /** y-u-v: 0-1-2 */
+    int     stride[3];  /** y-u-v: 0-1-2, y-uv-0 when biplanar */
     uint8_t *data;
+
+    void    *pool;      /** owning i420_pool bucket, NULL if malloc'd */
+    void    *next;      /** pool free list */
 };
 
 
@@ -19,6 +32,13 @@ struct i420_buffer {
 struct i420_buffer *i420_buffer_create(int width, int height,
                             int stride_y, int stride_u, int stride_v);
 
+// tightly packed buffer of any i420_buffer format
+struct i420_buffer *i420_buffer_create_format(uint32_t format, int width, int height);
+
+// strides of format padded to align bytes, returns planes or < 0 if unsupported
+int i420_buffer_layout(uint32_t format, int width, int height, int align, int stride[3]);
+
+// frees, or returns a pooled buffer to its pool
 void i420_buffer_destory(struct i420_buffer *handle);
 
 
@@ -28,6 +48,9 @@ uint8_t* i420_buffer_dataU(struct i420_buffer *handle);
 
 uint8_t* i420_buffer_dataV(struct i420_buffer *handle);
 
+// plane 0..nplanes-1, NULL past the last one
+uint8_t* i420_buffer_plane(struct i420_buffer *handle, int plane);
+
 int i420_data_size(int height, int stride_y, int stride_u, int stride_v);
 
 
@@ -41,8 +64,34 @@ int ToI420(const uint8_t* src_frame, uint32_t src_type, size_t src_size,
             int crop_x, int crop_y, int src_width, int src_height,
             int rotation, struct i420_buffer *dst_frame);
 
+// ToI420 split into horizontal stripes across a threadpool (threadpool.h).
+// falls back to ToI420 for rotation, flips and mjpeg
+int ToI420_mt(void *pool, const uint8_t* src_frame, uint32_t src_type, size_t src_size,
+            int crop_x, int crop_y, int src_width, int src_height,
+            int rotation, struct i420_buffer *dst_frame);
+
+
+/**
+ * direct libyuv converter for one source layout, writes destination rows
+ * [dst_y, dst_y + rows) from source rows starting at crop_y + dst_y.
+ * resolved once per stream with i420_find_converter, so the frame path
+ * skips ConvertToI420's fourcc switch. source rows are tightly packed.
+ */
+typedef int (*i420_convert_fn)(const uint8_t *src, int src_width, int src_height,
+            int crop_x, int crop_y, struct i420_buffer *dst, int dst_y, int rows);
 
+// converter into a FOURCC_I420 or FOURCC_NV12 buffer, or for 10 bit sources
+// also P010/I010 (yuv10.h). NULL for formats that need ConvertToI420 (mjpeg,
+// rgb, ...), always NULL for them into NV12
+i420_convert_fn i420_find_converter(uint32_t fourcc, uint32_t dst_format);
+
+// ToI420_mt with a resolved converter, no rotation
+int ConvertI420_mt(void *pool, i420_convert_fn convert, const uint8_t* src_frame,
+            int crop_x, int crop_y, int src_width, int src_height,
+            struct i420_buffer *dst_frame);
 
+// tightly packed frame size, 0 for compressed formats
+size_t calc_buffer_size(uint32_t fourcc, int width, int height);
 
 
 #ifdef __cplusplus
@@ -0,0 +1,276 @@
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#define LOG_TAG "i420_pool"
+#include "liblog.h"
+
+#include "i420.h"
+#include "i420_pool.h"
+
+#define I420_POOL_SLAB_BUFFERS  4       /** growth step of an empty bucket */
+
+#define ALIGN_UP(x, a)          (((x) + (a) - 1) & ~((a) - 1))
+
+
+struct i420_slab {
+    struct i420_slab    *next;
+    uint8_t             *data;
+    struct i420_buffer  *buffers;
+};
+
+struct i420_bucket {
+    struct i420_bucket  *next;
+    struct i420_pool    *pool;
+    uint32_t            format;
+    int                 nplanes;
+    int                 width;
+    int                 height;
+    int                 stride[3];
+    size_t              size;       /** bytes per buffer, multiple of I420_ALIGN */
+
+    struct i420_buffer  *free;
+    struct i420_slab    *slabs;
+    struct i420_pool_stats stats;
+};
+
+struct i420_pool {
+    pthread_mutex_t     lock;
+    struct i420_bucket  *buckets;
+};
+
+
+static struct i420_bucket *i420_pool_find(struct i420_pool *pool, uint32_t format, int width, int height)
+{
+    struct i420_bucket *b;
+
+    for (b = pool->buckets; b != NULL; b = b->next) {
+        if (b->format == format && b->width == width && b->height == height)
+            return b;
+    }
+    return NULL;
+}
+
+static struct i420_bucket *i420_pool_bucket(struct i420_pool *pool, uint32_t format, int width, int height)
+{
+    int stride[3];
+    int nplanes;
+    struct i420_bucket *b;
+
+    b = i420_pool_find(pool, format, width, height);
+    if (b != NULL)
+        return b;
+
+    nplanes = i420_buffer_layout(format, width, height, I420_ALIGN, stride);
+    if (nplanes < 0) {
+        ALOGE("%s: unsupported format '%.4s'", __func__, (char*)&format);
+        return NULL;
+    }
+
+    b = (struct i420_bucket *)calloc(1, sizeof(*b));
+    if (b == NULL) {
+        ALOGE("%s: Failed to allocate bucket", __func__);
+        return NULL;
+    }
+
+    b->pool = pool;
+    b->format = format;
+    b->nplanes = nplanes;
+    b->width = width;
+    b->height = height;
+    memcpy(b->stride, stride, sizeof(stride));
+    b->size = ALIGN_UP((size_t)i420_data_size(height, stride[0], stride[1], stride[2]), I420_ALIGN);
+
+    b->next = pool->buckets;
+    pool->buckets = b;
+    return b;
+}
+
+
+static int i420_bucket_grow(struct i420_bucket *b, int count)
+{
+    struct i420_slab *slab;
+    struct i420_buffer *buf;
+
+    slab = (struct i420_slab *)calloc(1, sizeof(*slab));
+    if (slab == NULL)
+        goto bail;
+
+    slab->buffers = (struct i420_buffer *)calloc(count, sizeof(struct i420_buffer));
+    if (slab->buffers == NULL)
+        goto bail;
+
+    if (posix_memalign((void **)&slab->data, I420_ALIGN, b->size * count) != 0) {
+        slab->data = NULL;
+        goto bail;
+    }
+
+    // fault the pages in now rather than on the first frames
+    memset(slab->data, 0, b->size * count);
+
+    for (int i = 0; i < count; i++) {
+        buf = &slab->buffers[i];
+        buf->format = b->format;
+        buf->nplanes = b->nplanes;
+        buf->width = b->width;
+        buf->height = b->height;
+        buf->stride[0] = b->stride[0];
+        buf->stride[1] = b->stride[1];
+        buf->stride[2] = b->stride[2];
+        buf->data = slab->data + b->size * i;
+        buf->pool = b;
+        buf->next = b->free;
+        b->free = buf;
+    }
+
+    slab->next = b->slabs;
+    b->slabs = slab;
+    b->stats.allocated += count;
+    b->stats.slabs++;
+
+    ALOGD("%s: '%.4s' %dx%d +%d buffers (%zu bytes each)", __func__,
+          (char*)&b->format, b->width, b->height, count, b->size);
+    return 0;
+
+bail:
+    ALOGE("%s: Failed to allocate slab of %d %dx%d", __func__, count, b->width, b->height);
+    if (slab) {
+        free(slab->buffers);
+        free(slab);
+    }
+    return -1;
+}
+
+
+void *i420_pool_create(void)
+{
+    struct i420_pool *pool;
+
+    pool = (struct i420_pool *)calloc(1, sizeof(*pool));
+    if (pool == NULL) {
+        ALOGE("%s: Failed to allocate pool", __func__);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    return pool;
+}
+
+
+void i420_pool_destroy(void *handle)
+{
+    struct i420_bucket *b, *nb;
+    struct i420_slab *slab, *ns;
+    struct i420_pool *pool = (struct i420_pool *)handle;
+
+    if (pool == NULL)
+        return;
+
+    for (b = pool->buckets; b != NULL; b = b->next) {
+        if (b->stats.in_use > 0) {
+            ALOGE("%s: %d %dx%d buffers still in use, leaking pool", __func__,
+                  b->stats.in_use, b->width, b->height);
+            return;
+        }
+    }
+
+    for (b = pool->buckets; b != NULL; b = nb) {
+        nb = b->next;
+        for (slab = b->slabs; slab != NULL; slab = ns) {
+            ns = slab->next;
+            free(slab->data);
+            free(slab->buffers);
+            free(slab);
+        }
+        free(b);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+
+int i420_pool_reserve(void *handle, uint32_t format, int width, int height, int count)
+{
+    int ret = -1;
+    struct i420_bucket *b;
+    struct i420_pool *pool = (struct i420_pool *)handle;
+
+    pthread_mutex_lock(&pool->lock);
+    b = i420_pool_bucket(pool, format, width, height);
+    if (b != NULL && count > b->stats.allocated - b->stats.in_use) {
+        ret = i420_bucket_grow(b, count - (b->stats.allocated - b->stats.in_use));
+    } else if (b != NULL) {
+        ret = 0;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return ret;
+}
+
+
+struct i420_buffer *i420_pool_acquire(void *handle, uint32_t format, int width, int height)
+{
+    struct i420_bucket *b;
+    struct i420_buffer *buf = NULL;
+    struct i420_pool *pool = (struct i420_pool *)handle;
+
+    pthread_mutex_lock(&pool->lock);
+
+    b = i420_pool_bucket(pool, format, width, height);
+    if (b == NULL)
+        goto exit;
+
+    if (b->free == NULL && i420_bucket_grow(b, I420_POOL_SLAB_BUFFERS) != 0)
+        goto exit;
+
+    buf = b->free;
+    b->free = buf->next;
+    buf->next = NULL;
+
+    b->stats.in_use++;
+    if (b->stats.in_use > b->stats.high_water)
+        b->stats.high_water = b->stats.in_use;
+
+exit:
+    pthread_mutex_unlock(&pool->lock);
+    return buf;
+}
+
+
+void i420_pool_release(struct i420_buffer *buffer)
+{
+    struct i420_bucket *b = (struct i420_bucket *)buffer->pool;
+    struct i420_pool *pool = b->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    buffer->next = b->free;
+    b->free = buffer;
+    b->stats.in_use--;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+int i420_pool_get_stats(void *handle, uint32_t format, int width, int height, struct i420_pool_stats *stats)
+{
+    int ret = -1;
+    struct i420_bucket *b;
+    struct i420_pool *pool = (struct i420_pool *)handle;
+
+    memset(stats, 0, sizeof(*stats));
+
+    pthread_mutex_lock(&pool->lock);
+    b = i420_pool_find(pool, format, width, height);
+    if (b != NULL) {
+        *stats = b->stats;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return ret;
+}
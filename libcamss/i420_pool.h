@@ -0,0 +1,48 @@
+#ifndef __I420_POOL_H__
+#define __I420_POOL_H__
+
+#include <stdint.h>
+
+#include "i420.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+struct i420_pool_stats {
+    int     allocated;      /** buffers in slabs */
+    int     in_use;
+    int     high_water;     /** max in_use seen */
+    int     slabs;
+};
+
+
+/**
+ * recycling allocator of i420 buffers (any i420_buffer format), one bucket
+ * per format x width x height.
+ * planes start 64-byte aligned and strides are padded to 64 bytes, slabs
+ * are touched once at allocation so recycled buffers never page fault.
+ */
+void *i420_pool_create(void);
+
+// buffers still in use at destroy are leaked, not freed under their users
+void i420_pool_destroy(void *handle);
+
+// preallocate count buffers of this geometry in one slab
+int i420_pool_reserve(void *handle, uint32_t format, int width, int height, int count);
+
+// get a buffer, grows the bucket by a slab when empty
+struct i420_buffer *i420_pool_acquire(void *handle, uint32_t format, int width, int height);
+
+// give a buffer back, same as i420_buffer_destory
+void i420_pool_release(struct i420_buffer *buffer);
+
+int i420_pool_get_stats(void *handle, uint32_t format, int width, int height, struct i420_pool_stats *stats);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __I420_POOL_H__ */
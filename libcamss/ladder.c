@@ -0,0 +1,252 @@
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libyuv.h"
+
+#define LOG_TAG "ladder"
+#include "liblog.h"
+
+#include "i420.h"
+#include "i420_pool.h"
+#include "frame.h"
+#include "yuv10.h"
+#include "ladder.h"
+
+
+struct ladder_context {
+    int                 nrungs;
+    struct ladder_rung  rungs[LADDER_MAX_RUNGS];
+    int                 rotation;
+
+    void                *convpool;  /** not owned */
+    void                *pool;      /** rung and scratch buffers */
+};
+
+/** read-only planes of the image a rung is scaled from */
+struct ladder_src {
+    const uint8_t       *plane[3];
+    int                 stride[3];
+    int                 width;
+    int                 height;
+};
+
+
+static void ladder_src_from_i420(struct ladder_src *src, struct i420_buffer *i420)
+{
+    for (int i = 0; i < 3; i++) {
+        src->plane[i] = i420_buffer_plane(i420, i);
+        src->stride[i] = i420->stride[i];
+    }
+    src->width = i420->width;
+    src->height = i420->height;
+}
+
+static void ladder_src_from_frame(struct ladder_src *src, struct camss_frame *frame)
+{
+    for (int i = 0; i < 3; i++) {
+        src->plane[i] = frame->plane[i];
+        src->stride[i] = frame->stride[i];
+    }
+    src->width = frame->width;
+    src->height = frame->height;
+}
+
+
+// one full read of the source: convert (or copy) and rotate into top
+static int ladder_convert(struct ladder_context *ladder, struct camss_frame *frame,
+                          struct i420_buffer *top)
+{
+    // already I420 (or a crop view of it), only the rotation is left
+    if (frame->format == FOURCC_I420) {
+        return I420Rotate(frame->plane[0], frame->stride[0],
+                          frame->plane[1], frame->stride[1],
+                          frame->plane[2], frame->stride[2],
+                          i420_buffer_dataY(top), top->stride[0],
+                          i420_buffer_dataU(top), top->stride[1],
+                          i420_buffer_dataV(top), top->stride[2],
+                          frame->width, frame->height,
+                          (enum RotationMode)ladder->rotation);
+    }
+
+    // NV21 is NV12 with the chroma planes swapped on output
+    if (frame->format == FOURCC_NV12 || frame->format == FOURCC_NV21) {
+        int nv21 = frame->format == FOURCC_NV21;
+        return NV12ToI420Rotate(frame->plane[0], frame->stride[0],
+                                frame->plane[1], frame->stride[1],
+                                i420_buffer_dataY(top), top->stride[0],
+                                nv21 ? i420_buffer_dataV(top) : i420_buffer_dataU(top),
+                                nv21 ? top->stride[2] : top->stride[1],
+                                nv21 ? i420_buffer_dataU(top) : i420_buffer_dataV(top),
+                                nv21 ? top->stride[1] : top->stride[2],
+                                frame->width, frame->height,
+                                (enum RotationMode)ladder->rotation);
+    }
+
+    // 10 bit: rounded down to 8 in one pass, rotated from a scratch copy
+    if (frame->format == FOURCC_P010 || frame->format == FOURCC_I010) {
+        struct i420_buffer *scratch;
+        int ret;
+
+        if (ladder->rotation == 0)
+            return yuv10_convert_planes(frame->format, frame->plane, frame->stride,
+                                        frame->width, frame->height, top);
+
+        scratch = i420_pool_acquire(ladder->pool, FOURCC_I420, frame->width, frame->height);
+        if (scratch == NULL)
+            return -1;
+
+        ret = yuv10_convert_planes(frame->format, frame->plane, frame->stride,
+                                   frame->width, frame->height, scratch);
+        if (ret == 0) {
+            ret = I420Rotate(i420_buffer_dataY(scratch), scratch->stride[0],
+                             i420_buffer_dataU(scratch), scratch->stride[1],
+                             i420_buffer_dataV(scratch), scratch->stride[2],
+                             i420_buffer_dataY(top), top->stride[0],
+                             i420_buffer_dataU(top), top->stride[1],
+                             i420_buffer_dataV(top), top->stride[2],
+                             frame->width, frame->height,
+                             (enum RotationMode)ladder->rotation);
+        }
+        i420_buffer_destory(scratch);
+        return ret;
+    }
+
+    return ToI420_mt(ladder->convpool, frame->data, CanonicalFourCC(frame->fourcc),
+                     frame->meta.bytesused, 0, 0, frame->width, frame->height,
+                     ladder->rotation, top);
+}
+
+
+void *ladder_create(const struct ladder_rung *rungs, int nrungs, int rotation, void *convpool)
+{
+    struct ladder_context *ladder;
+
+    if (nrungs <= 0 || nrungs > LADDER_MAX_RUNGS) {
+        ALOGE("%s: bad rung count %d", __func__, nrungs);
+        return NULL;
+    }
+
+    if (rotation != 0 && rotation != 90 && rotation != 180 && rotation != 270) {
+        ALOGE("%s: bad rotation %d", __func__, rotation);
+        return NULL;
+    }
+
+    for (int i = 0; i < nrungs; i++) {
+        if (rungs[i].width <= 0 || rungs[i].height <= 0 ||
+            (i > 0 && (rungs[i].width > rungs[i - 1].width ||
+                       rungs[i].height > rungs[i - 1].height))) {
+            ALOGE("%s: rung %d (%dx%d) must be smaller than the one above", __func__,
+                  i, rungs[i].width, rungs[i].height);
+            return NULL;
+        }
+    }
+
+    ladder = (struct ladder_context *)calloc(1, sizeof(*ladder));
+    if (ladder == NULL) {
+        ALOGE("%s: Failed to allocate ladder", __func__);
+        return NULL;
+    }
+
+    ladder->pool = i420_pool_create();
+    if (ladder->pool == NULL) {
+        free(ladder);
+        return NULL;
+    }
+
+    ladder->nrungs = nrungs;
+    memcpy(ladder->rungs, rungs, nrungs * sizeof(rungs[0]));
+    ladder->rotation = rotation;
+    ladder->convpool = convpool;
+
+    return ladder;
+}
+
+
+void ladder_destroy(void *handle)
+{
+    struct ladder_context *ladder = (struct ladder_context *)handle;
+
+    if (ladder == NULL)
+        return;
+
+    i420_pool_destroy(ladder->pool);
+    free(ladder);
+}
+
+
+int ladder_process(void *handle, struct camss_frame *frame, struct i420_buffer *out[])
+{
+    int i;
+    int top_width = frame->width;
+    int top_height = frame->height;
+    struct i420_buffer *scratch = NULL;
+    struct ladder_src src;
+    struct ladder_context *ladder = (struct ladder_context *)handle;
+
+    memset(out, 0, ladder->nrungs * sizeof(out[0]));
+
+    if (ladder->rotation == 90 || ladder->rotation == 270) {
+        top_width = frame->height;
+        top_height = frame->width;
+    }
+
+    if (ladder->rungs[0].width == top_width && ladder->rungs[0].height == top_height) {
+        // full size rung: convert straight into it
+        out[0] = i420_pool_acquire(ladder->pool, FOURCC_I420, top_width, top_height);
+        if (out[0] == NULL || ladder_convert(ladder, frame, out[0]) != 0)
+            goto bail;
+        ladder_src_from_i420(&src, out[0]);
+    } else if (frame->format == FOURCC_I420 && ladder->rotation == 0) {
+        // scale the first rung from the frame itself, no intermediate copy
+        ladder_src_from_frame(&src, frame);
+    } else {
+        scratch = i420_pool_acquire(ladder->pool, FOURCC_I420, top_width, top_height);
+        if (scratch == NULL || ladder_convert(ladder, frame, scratch) != 0)
+            goto bail;
+        ladder_src_from_i420(&src, scratch);
+    }
+
+    // cascade: each rung reads the (smaller) rung above, not the source
+    for (i = 0; i < ladder->nrungs; i++) {
+        if (out[i] != NULL)
+            continue;
+
+        out[i] = i420_pool_acquire(ladder->pool, FOURCC_I420,
+                                   ladder->rungs[i].width, ladder->rungs[i].height);
+        if (out[i] == NULL)
+            goto bail;
+
+        if (I420Scale(src.plane[0], src.stride[0],
+                      src.plane[1], src.stride[1],
+                      src.plane[2], src.stride[2],
+                      src.width, src.height,
+                      i420_buffer_dataY(out[i]), out[i]->stride[0],
+                      i420_buffer_dataU(out[i]), out[i]->stride[1],
+                      i420_buffer_dataV(out[i]), out[i]->stride[2],
+                      out[i]->width, out[i]->height,
+                      kFilterBox) != 0) {
+            goto bail;
+        }
+
+        ladder_src_from_i420(&src, out[i]);
+    }
+
+    if (scratch)
+        i420_buffer_destory(scratch);
+    return 0;
+
+bail:
+    ALOGE("%s: Failed to build ladder for '%.4s' %dx%d", __func__,
+          (char*)&frame->fourcc, frame->width, frame->height);
+    if (scratch)
+        i420_buffer_destory(scratch);
+    for (i = 0; i < ladder->nrungs; i++) {
+        if (out[i])
+            i420_buffer_destory(out[i]);
+        out[i] = NULL;
+    }
+    return -1;
+}
@@ -0,0 +1,45 @@
+#ifndef __LADDER_H__
+#define __LADDER_H__
+
+#include <stdint.h>
+
+#include "i420.h"
+#include "frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define LADDER_MAX_RUNGS    4
+
+/** output size after rotation, rungs are listed largest first */
+struct ladder_rung {
+    int     width;
+    int     height;
+};
+
+
+/**
+ * one captured frame in, several I420 resolutions out (simulcast,
+ * thumbnails). the source is converted and rotated once, each rung is then
+ * scaled from the rung above it rather than from the source again.
+ *
+ * rotation is 0/90/180/270. convpool (threadpool.h, may be NULL) splits the
+ * conversion into stripes and is not owned by the ladder.
+ */
+void *ladder_create(const struct ladder_rung *rungs, int nrungs, int rotation, void *convpool);
+
+// buffers handed out by ladder_process must be released first
+void ladder_destroy(void *handle);
+
+// fill out[0..nrungs-1] with pooled buffers, release them with i420_buffer_destory.
+// frame may be a camss_frame_crop view (digital zoom ladder)
+int ladder_process(void *handle, struct camss_frame *frame, struct i420_buffer *out[]);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LADDER_H__ */
@@ -0,0 +1,250 @@
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include "libyuv.h"
+
+#define LOG_TAG "mjpeg"
+#include "liblog.h"
+
+#include "i420.h"
+#include "frame.h"
+#include "mjpeg.h"
+
+#define MJPEG_MAX_WORKERS   16
+#define MJPEG_MAX_INFLIGHT  64      /** >= any camera queue depth */
+
+
+enum mjpeg_slot_state {
+    MJPEG_SLOT_FREE = 0,
+    MJPEG_SLOT_QUEUED,
+    MJPEG_SLOT_DECODING,
+    MJPEG_SLOT_DONE,
+};
+
+struct mjpeg_slot {
+    int                 state;
+    int                 status;     /** decode result, < 0 drops the frame */
+    struct camss_frame  *frame;
+};
+
+/*
+ * tickets are handed out in submission order, slot = ticket % MJPEG_MAX_INFLIGHT.
+ * [next_out, next_job) are decoding or done, [next_job, next_ticket) queued.
+ * whichever worker finishes the frame at next_out delivers the done run.
+ */
+struct mjpeg_decoder {
+    int                 nworkers;
+    pthread_t           workers[MJPEG_MAX_WORKERS];
+
+    mjpeg_output_cb     callback;
+    void                *opaque;
+
+    pthread_mutex_t     lock;
+    pthread_cond_t      work;       /** a job was queued or quit */
+    pthread_cond_t      drained;    /** everything submitted was delivered */
+    int                 quit;
+    int                 delivering;
+
+    uint64_t            next_ticket;
+    uint64_t            next_job;
+    uint64_t            next_out;
+    struct mjpeg_slot   slots[MJPEG_MAX_INFLIGHT];
+
+    struct mjpeg_stats  stats;
+};
+
+
+static int mjpeg_decode(struct camss_frame *frame)
+{
+    struct i420_buffer *i420 = frame->i420;
+
+    if (i420 == NULL || frame->meta.bytesused == 0)
+        return -1;
+
+    return ConvertToI420(frame->data, frame->meta.bytesused,
+                         i420_buffer_dataY(i420), i420->stride[0],
+                         i420_buffer_dataU(i420), i420->stride[1],
+                         i420_buffer_dataV(i420), i420->stride[2],
+                         0, 0,
+                         frame->width, frame->height,
+                         i420->width, i420->height,
+                         0, FOURCC_MJPG);
+}
+
+
+// called with lock held, returns with lock held
+static void mjpeg_deliver(struct mjpeg_decoder *dec)
+{
+    struct mjpeg_slot *slot;
+    struct camss_frame *frame;
+    int status;
+
+    if (dec->delivering)
+        return;
+
+    dec->delivering = 1;
+
+    for (;;) {
+        slot = &dec->slots[dec->next_out % MJPEG_MAX_INFLIGHT];
+        if (dec->next_out == dec->next_job || slot->state != MJPEG_SLOT_DONE)
+            break;
+
+        frame = slot->frame;
+        status = slot->status;
+        slot->frame = NULL;
+        slot->state = MJPEG_SLOT_FREE;
+        dec->next_out++;
+
+        if (status < 0) {
+            dec->stats.errors++;
+        } else {
+            dec->stats.decoded++;
+        }
+
+        pthread_mutex_unlock(&dec->lock);
+        if (status < 0) {
+            camss_frame_unref(frame);
+        } else {
+            dec->callback(dec->opaque, frame);
+        }
+        pthread_mutex_lock(&dec->lock);
+    }
+
+    dec->delivering = 0;
+
+    if (dec->next_out == dec->next_ticket)
+        pthread_cond_broadcast(&dec->drained);
+}
+
+
+static void *mjpeg_worker(void *data)
+{
+    struct mjpeg_slot *slot;
+    struct mjpeg_decoder *dec = (struct mjpeg_decoder *)data;
+
+    pthread_mutex_lock(&dec->lock);
+
+    for (;;) {
+        while (dec->next_job == dec->next_ticket && !dec->quit)
+            pthread_cond_wait(&dec->work, &dec->lock);
+
+        if (dec->next_job == dec->next_ticket)
+            break;
+
+        slot = &dec->slots[dec->next_job % MJPEG_MAX_INFLIGHT];
+        slot->state = MJPEG_SLOT_DECODING;
+        dec->next_job++;
+        pthread_mutex_unlock(&dec->lock);
+
+        slot->status = mjpeg_decode(slot->frame);
+
+        pthread_mutex_lock(&dec->lock);
+        slot->state = MJPEG_SLOT_DONE;
+        mjpeg_deliver(dec);
+    }
+
+    pthread_mutex_unlock(&dec->lock);
+    return NULL;
+}
+
+
+void *mjpeg_decoder_create(int nworkers, mjpeg_output_cb callback, void *opaque)
+{
+    struct mjpeg_decoder *dec;
+
+    if (nworkers <= 0 || nworkers > MJPEG_MAX_WORKERS) {
+        ALOGE("%s: bad worker count %d", __func__, nworkers);
+        return NULL;
+    }
+
+    dec = (struct mjpeg_decoder *)calloc(1, sizeof(*dec));
+    if (dec == NULL) {
+        ALOGE("%s: Failed to allocate decoder", __func__);
+        return NULL;
+    }
+
+    dec->callback = callback;
+    dec->opaque = opaque;
+    pthread_mutex_init(&dec->lock, NULL);
+    pthread_cond_init(&dec->work, NULL);
+    pthread_cond_init(&dec->drained, NULL);
+
+    for (int i = 0; i < nworkers; i++) {
+        if (pthread_create(&dec->workers[i], NULL, mjpeg_worker, dec)) {
+            ALOGE("%s: failed to create worker %d", __func__, i);
+            mjpeg_decoder_destroy(dec);
+            return NULL;
+        }
+        dec->nworkers++;
+    }
+
+    ALOGD("%s: %d workers", __func__, nworkers);
+    return dec;
+}
+
+
+void mjpeg_decoder_destroy(void *handle)
+{
+    struct mjpeg_decoder *dec = (struct mjpeg_decoder *)handle;
+
+    if (dec == NULL)
+        return;
+
+    pthread_mutex_lock(&dec->lock);
+    while (dec->nworkers > 0 && dec->next_out != dec->next_ticket)
+        pthread_cond_wait(&dec->drained, &dec->lock);
+    dec->quit = 1;
+    pthread_cond_broadcast(&dec->work);
+    pthread_mutex_unlock(&dec->lock);
+
+    for (int i = 0; i < dec->nworkers; i++) {
+        pthread_join(dec->workers[i], NULL);
+    }
+
+    pthread_cond_destroy(&dec->drained);
+    pthread_cond_destroy(&dec->work);
+    pthread_mutex_destroy(&dec->lock);
+    free(dec);
+}
+
+
+int mjpeg_decoder_submit(void *handle, struct camss_frame *frame)
+{
+    struct mjpeg_slot *slot;
+    struct mjpeg_decoder *dec = (struct mjpeg_decoder *)handle;
+
+    pthread_mutex_lock(&dec->lock);
+
+    if (dec->next_ticket - dec->next_out >= MJPEG_MAX_INFLIGHT) {
+        dec->stats.overruns++;
+        pthread_mutex_unlock(&dec->lock);
+        camss_frame_unref(frame);
+        return -1;
+    }
+
+    slot = &dec->slots[dec->next_ticket % MJPEG_MAX_INFLIGHT];
+    slot->frame = frame;
+    slot->status = 0;
+    slot->state = MJPEG_SLOT_QUEUED;
+    dec->next_ticket++;
+
+    pthread_cond_signal(&dec->work);
+    pthread_mutex_unlock(&dec->lock);
+    return 0;
+}
+
+
+void mjpeg_decoder_get_stats(void *handle, struct mjpeg_stats *stats)
+{
+    struct mjpeg_decoder *dec = (struct mjpeg_decoder *)handle;
+
+    pthread_mutex_lock(&dec->lock);
+    *stats = dec->stats;
+    pthread_mutex_unlock(&dec->lock);
+}
@@ -0,0 +1,42 @@
+#ifndef __MJPEG_H__
+#define __MJPEG_H__
+
+#include <stdint.h>
+
+#include "frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** called in submission order with a decoded frame, the callee owns the reference */
+typedef void (*mjpeg_output_cb)(void *opaque, struct camss_frame *frame);
+
+struct mjpeg_stats {
+    uint64_t    decoded;
+    uint64_t    errors;     /** corrupt frames, dropped */
+    uint64_t    overruns;   /** submitted with every slot in flight, dropped */
+};
+
+
+/**
+ * decode MJPEG frames into frame->i420 on nworkers threads. frames are
+ * independent so they decode in parallel, output keeps submission order.
+ */
+void *mjpeg_decoder_create(int nworkers, mjpeg_output_cb callback, void *opaque);
+
+// finishes and delivers everything submitted, then stops the workers
+void mjpeg_decoder_destroy(void *handle);
+
+// hand over a frame reference, returns < 0 if it was dropped
+int mjpeg_decoder_submit(void *handle, struct camss_frame *frame);
+
+void mjpeg_decoder_get_stats(void *handle, struct mjpeg_stats *stats);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MJPEG_H__ */
@@ -0,0 +1,202 @@
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_TAG "motion"
+#include "liblog.h"
+
+#include "motion.h"
+
+#define MOTION_DECIMATE     4       /** image pixels per decimated pixel, each way */
+#define MOTION_CELL         (MOTION_BLOCK / MOTION_DECIMATE)
+
+
+struct motion_context {
+    int         cols;       /** map cells */
+    int         rows;
+    int         dw;         /** decimated size, cols/rows * MOTION_CELL */
+    int         dh;
+    int         noise;
+
+    uint8_t     *cur;       /** decimated luma of the last motion_detect */
+    uint8_t     *ref;
+    int         has_ref;
+
+    uint16_t    *acc;       /** dw row sums */
+    uint8_t     *diff;      /** dw abs differences */
+};
+
+
+void *motion_create(int width, int height, int noise)
+{
+    struct motion_context *m;
+
+    if (width < MOTION_BLOCK || height < MOTION_BLOCK) {
+        ALOGE("%s: %dx%d is smaller than one block", __func__, width, height);
+        return NULL;
+    }
+
+    m = (struct motion_context *)calloc(1, sizeof(*m));
+    if (m == NULL) {
+        ALOGE("%s: Failed to allocate context", __func__);
+        return NULL;
+    }
+
+    m->cols = width / MOTION_BLOCK;
+    m->rows = height / MOTION_BLOCK;
+    m->dw = m->cols * MOTION_CELL;
+    m->dh = m->rows * MOTION_CELL;
+    m->noise = noise;
+
+    m->cur = (uint8_t *)malloc((size_t)m->dw * m->dh);
+    m->ref = (uint8_t *)malloc((size_t)m->dw * m->dh);
+    m->acc = (uint16_t *)malloc(m->dw * sizeof(*m->acc));
+    m->diff = (uint8_t *)malloc(m->dw);
+    if (!m->cur || !m->ref || !m->acc || !m->diff) {
+        ALOGE("%s: Failed to allocate planes", __func__);
+        motion_destroy(m);
+        return NULL;
+    }
+
+    ALOGD("%s: %dx%d, %dx%d cells, noise %d", __func__, width, height, m->cols, m->rows, noise);
+    return m;
+}
+
+void motion_destroy(void *handle)
+{
+    struct motion_context *m = (struct motion_context *)handle;
+
+    if (m == NULL)
+        return;
+
+    free(m->cur);
+    free(m->ref);
+    free(m->acc);
+    free(m->diff);
+    free(m);
+}
+
+void motion_map_size(void *handle, int *cols, int *rows)
+{
+    struct motion_context *m = (struct motion_context *)handle;
+
+    *cols = m->cols;
+    *rows = m->rows;
+}
+
+
+/**
+ * one image row into the decimated row sums, pitch bytes per decimated
+ * pixel. inlined with a constant step so the common step 1 loop vectorizes
+ */
+static inline __attribute__((always_inline))
+void motion_row_sum(const uint8_t *src, int step, int pitch, int n, uint16_t *acc)
+{
+    for (int x = 0; x < n; x++) {
+        const uint8_t *p = src + x * pitch;
+        acc[x] += p[0] + p[step] + p[2 * step] + p[3 * step];
+    }
+}
+
+// I010: 8 msbs of each 16 bit word
+static void motion_row_sum16(const uint8_t *src, int n, uint16_t *acc)
+{
+    const uint16_t *s = (const uint16_t *)src;
+
+    for (int x = 0; x < n; x++) {
+        const uint16_t *p = s + x * MOTION_DECIMATE;
+        acc[x] += (p[0] >> 2) + (p[1] >> 2) + (p[2] >> 2) + (p[3] >> 2);
+    }
+}
+
+// 4x4 box average of the luma into cur
+static void motion_decimate(struct motion_context *m, const uint8_t *luma, int stride, int step)
+{
+    for (int y = 0; y < m->dh; y++) {
+        const uint8_t *src = luma + (size_t)y * MOTION_DECIMATE * stride;
+        uint8_t *dst = m->cur + (size_t)y * m->dw;
+
+        memset(m->acc, 0, m->dw * sizeof(*m->acc));
+        for (int i = 0; i < MOTION_DECIMATE; i++, src += stride) {
+            switch (step) {
+                case 1:
+                    motion_row_sum(src, 1, MOTION_DECIMATE, m->dw, m->acc);
+                    break;
+                case 2:
+                    motion_row_sum(src, 2, 2 * MOTION_DECIMATE, m->dw, m->acc);
+                    break;
+                case MOTION_STEP_Y10P:
+                    // a decimated pixel is one 5 byte group, its msbs in a row
+                    motion_row_sum(src, 1, 5, m->dw, m->acc);
+                    break;
+                case MOTION_STEP_I010:
+                    motion_row_sum16(src, m->dw, m->acc);
+                    break;
+                default:
+                    motion_row_sum(src, step, step * MOTION_DECIMATE, m->dw, m->acc);
+                    break;
+            }
+        }
+
+        for (int x = 0; x < m->dw; x++)
+            dst[x] = (m->acc[x] + 8) >> 4;
+    }
+}
+
+int motion_detect(void *handle, const uint8_t *luma, int stride, int step, uint8_t *map)
+{
+    int changed = 0;
+    struct motion_context *m = (struct motion_context *)handle;
+
+    motion_decimate(m, luma, stride, step);
+
+    if (!m->has_ref) {
+        if (map)
+            memset(map, 255, (size_t)m->cols * m->rows);
+        return 1000;
+    }
+
+    for (int cy = 0; cy < m->rows; cy++) {
+        // column sums of the cell row, then MOTION_CELL columns per cell
+        memset(m->acc, 0, m->dw * sizeof(*m->acc));
+        for (int i = 0; i < MOTION_CELL; i++) {
+            size_t offset = (size_t)(cy * MOTION_CELL + i) * m->dw;
+            const uint8_t *a = m->cur + offset;
+            const uint8_t *b = m->ref + offset;
+
+            for (int x = 0; x < m->dw; x++)
+                m->diff[x] = a[x] > b[x] ? a[x] - b[x] : b[x] - a[x];
+            for (int x = 0; x < m->dw; x++)
+                m->acc[x] += m->diff[x];
+        }
+
+        for (int cx = 0; cx < m->cols; cx++) {
+            const uint16_t *s = m->acc + cx * MOTION_CELL;
+            int sad = 0;
+
+            for (int i = 0; i < MOTION_CELL; i++)
+                sad += s[i];
+            sad /= MOTION_CELL * MOTION_CELL;
+
+            if (map)
+                map[cy * m->cols + cx] = sad;
+            if (sad > m->noise)
+                changed++;
+        }
+    }
+
+    return changed * 1000 / (m->cols * m->rows);
+}
+
+void motion_update(void *handle)
+{
+    uint8_t *t;
+    struct motion_context *m = (struct motion_context *)handle;
+
+    t = m->ref;
+    m->ref = m->cur;
+    m->cur = t;
+    m->has_ref = 1;
+}
@@ -0,0 +1,50 @@
+#ifndef __MOTION_H__
+#define __MOTION_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define MOTION_BLOCK            16      /** image pixels per map cell, each way */
+#define MOTION_NOISE_DEFAULT    8       /** cell mean abs difference still taken as static */
+
+/** motion_detect steps for 10 bit luma that has no msb byte at a fixed step */
+#define MOTION_STEP_Y10P        (-1)    /** mipi packed, 8 msbs of 4 samples then their lsbs */
+#define MOTION_STEP_I010        (-2)    /** lsb aligned in 16 bit little endian words */
+
+
+/**
+ * block SAD change detector on the luma plane. each frame is box
+ * decimated 4x4 and compared with a decimated reference, a map cell
+ * covers MOTION_BLOCK x MOTION_BLOCK image pixels (partial edge blocks
+ * are ignored). cells above noise count as changed.
+ */
+void *motion_create(int width, int height, int noise);
+
+void motion_destroy(void *handle);
+
+// map dimensions in cells
+void motion_map_size(void *handle, int *cols, int *rows);
+
+/**
+ * compare the luma plane with the reference. step is the byte distance of
+ * two luma samples: 1 for planar/biplanar, 2 for YUYV (UYVY: luma + 1)
+ * and the msb byte of P010 samples, 4 for Y210, or MOTION_STEP_Y10P /
+ * MOTION_STEP_I010. fills map (NULL: not wanted) with the mean abs
+ * difference per cell, returns the changed cells per mille, 1000 while
+ * there is no reference.
+ */
+int motion_detect(void *handle, const uint8_t *luma, int stride, int step, uint8_t *map);
+
+// the last detected frame becomes the reference
+void motion_update(void *handle);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MOTION_H__ */
@@ -0,0 +1,281 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include <pthread.h>
+
+#define LOG_TAG "reactor"
+#include "liblog.h"
+
+#include "reactor.h"
+
+#define REACTOR_MAX_THREADS     16
+#define REACTOR_MAX_EVENTS      16
+
+/** epoll data for the shutdown eventfd, never a valid source id */
+#define REACTOR_WAKEUP          UINT32_MAX
+
+
+struct reactor_source {
+    int             fd;
+    uint32_t        gen;        /** bumped on del, filters stale events */
+    int             active;
+    int             busy;       /** callback running */
+    pthread_t       owner;      /** thread running the callback */
+
+    reactor_cb      callback;
+    void            *opaque;
+};
+
+struct reactor_context {
+    int                     epfd;
+    int                     wakefd;     /** eventfd, readable on destroy */
+
+    int                     nthreads;
+    pthread_t               threads[REACTOR_MAX_THREADS];
+
+    pthread_mutex_t         lock;
+    pthread_cond_t          idle;       /** signaled when a removed source becomes idle */
+    struct reactor_source   sources[REACTOR_MAX_SOURCES];
+};
+
+
+static uint64_t reactor_key(int id, uint32_t gen)
+{
+    return ((uint64_t)gen << 32) | (uint32_t)id;
+}
+
+/** EPOLLONESHOT: the fd is disarmed once delivered, re-armed after the callback */
+static int reactor_arm(struct reactor_context *r, int id, int op)
+{
+    struct epoll_event ev;
+    struct reactor_source *src = &r->sources[id];
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.u64 = reactor_key(id, src->gen);
+
+    if (epoll_ctl(r->epfd, op, src->fd, &ev) != 0) {
+        ALOGE("%s: epoll_ctl fd %d failed (%s)", __func__, src->fd, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+
+static void reactor_dispatch(struct reactor_context *r, struct epoll_event *ev)
+{
+    int id = (int)(ev->data.u64 & 0xffffffff);
+    uint32_t gen = (uint32_t)(ev->data.u64 >> 32);
+    struct reactor_source *src = &r->sources[id];
+
+    pthread_mutex_lock(&r->lock);
+    if (!src->active || src->gen != gen) {
+        pthread_mutex_unlock(&r->lock);
+        return;
+    }
+    src->busy = 1;
+    src->owner = pthread_self();
+    pthread_mutex_unlock(&r->lock);
+
+    src->callback(src->opaque, ev->events);
+
+    pthread_mutex_lock(&r->lock);
+    src->busy = 0;
+    if (src->active && src->gen == gen) {
+        reactor_arm(r, id, EPOLL_CTL_MOD);
+    } else {
+        pthread_cond_broadcast(&r->idle);
+    }
+    pthread_mutex_unlock(&r->lock);
+}
+
+
+static void *reactor_thread(void *data)
+{
+    int n;
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+    struct reactor_context *r = (struct reactor_context *)data;
+
+    while (1) {
+        n = epoll_wait(r->epfd, events, REACTOR_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            ALOGE("%s: epoll_wait failed (%s)", __func__, strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            // wakefd is never read, so it stays readable for every thread
+            if ((uint32_t)events[i].data.u64 == REACTOR_WAKEUP)
+                return NULL;
+
+            reactor_dispatch(r, &events[i]);
+        }
+    }
+
+    return NULL;
+}
+
+
+void *reactor_create(int nthreads, int pin)
+{
+    struct epoll_event ev;
+    struct reactor_context *r;
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (nthreads <= 0 || nthreads > REACTOR_MAX_THREADS) {
+        ALOGE("%s: bad thread count %d", __func__, nthreads);
+        return NULL;
+    }
+
+    r = (struct reactor_context *)calloc(1, sizeof(*r));
+    if (r == NULL) {
+        ALOGE("%s: Failed to allocate reactor", __func__);
+        return NULL;
+    }
+
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->idle, NULL);
+
+    r->epfd = epoll_create1(EPOLL_CLOEXEC);
+    r->wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (r->epfd < 0 || r->wakefd < 0) {
+        ALOGE("%s: Failed to create epoll/eventfd (%s)", __func__, strerror(errno));
+        goto bail;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = REACTOR_WAKEUP;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->wakefd, &ev) != 0) {
+        ALOGE("%s: Failed to watch eventfd (%s)", __func__, strerror(errno));
+        goto bail;
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        if (pthread_create(&r->threads[i], NULL, reactor_thread, r)) {
+            ALOGE("%s: failed to create reactor thread %d", __func__, i);
+            goto bail;
+        }
+        r->nthreads++;
+
+        if (pin && ncpus > 0) {
+            cpu_set_t cpuset;
+            CPU_ZERO(&cpuset);
+            CPU_SET(i % ncpus, &cpuset);
+            if (pthread_setaffinity_np(r->threads[i], sizeof(cpuset), &cpuset)) {
+                ALOGW("%s: failed to pin thread %d", __func__, i);
+            }
+        }
+    }
+
+    ALOGD("%s: %d threads, pin %d", __func__, nthreads, pin);
+    return r;
+
+bail:
+    reactor_destroy(r);
+    return NULL;
+}
+
+
+void reactor_destroy(void *handle)
+{
+    uint64_t one = 1;
+    struct reactor_context *r = (struct reactor_context *)handle;
+
+    if (r == NULL)
+        return;
+
+    if (r->wakefd >= 0 && write(r->wakefd, &one, sizeof(one)) != sizeof(one)) {
+        ALOGE("%s: failed to wake reactor threads", __func__);
+    }
+
+    for (int i = 0; i < r->nthreads; i++) {
+        pthread_join(r->threads[i], NULL);
+    }
+
+    if (r->epfd >= 0)
+        close(r->epfd);
+    if (r->wakefd >= 0)
+        close(r->wakefd);
+
+    pthread_cond_destroy(&r->idle);
+    pthread_mutex_destroy(&r->lock);
+    free(r);
+}
+
+
+int reactor_add(void *handle, int fd, reactor_cb callback, void *opaque)
+{
+    int id;
+    struct reactor_source *src;
+    struct reactor_context *r = (struct reactor_context *)handle;
+
+    pthread_mutex_lock(&r->lock);
+
+    for (id = 0; id < REACTOR_MAX_SOURCES; id++) {
+        if (!r->sources[id].active && !r->sources[id].busy)
+            break;
+    }
+
+    if (id == REACTOR_MAX_SOURCES) {
+        pthread_mutex_unlock(&r->lock);
+        ALOGE("%s: too many sources", __func__);
+        return -1;
+    }
+
+    src = &r->sources[id];
+    src->fd = fd;
+    src->callback = callback;
+    src->opaque = opaque;
+    src->active = 1;
+
+    if (reactor_arm(r, id, EPOLL_CTL_ADD) != 0) {
+        src->active = 0;
+        id = -1;
+    }
+
+    pthread_mutex_unlock(&r->lock);
+    return id;
+}
+
+
+int reactor_del(void *handle, int id)
+{
+    struct reactor_source *src;
+    struct reactor_context *r = (struct reactor_context *)handle;
+
+    if (id < 0 || id >= REACTOR_MAX_SOURCES)
+        return -1;
+
+    src = &r->sources[id];
+
+    pthread_mutex_lock(&r->lock);
+
+    if (!src->active) {
+        pthread_mutex_unlock(&r->lock);
+        return -1;
+    }
+
+    src->active = 0;
+    src->gen++;
+    epoll_ctl(r->epfd, EPOLL_CTL_DEL, src->fd, NULL);
+
+    // removing itself from its own callback must not wait for itself
+    while (src->busy && !pthread_equal(src->owner, pthread_self())) {
+        pthread_cond_wait(&r->idle, &r->lock);
+    }
+
+    pthread_mutex_unlock(&r->lock);
+    return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef __REACTOR_H__
+#define __REACTOR_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define REACTOR_MAX_SOURCES     64      /** fds watched by one reactor */
+
+
+/**
+ * called from a reactor thread when the fd is readable (or in error).
+ * a source is never dispatched on two threads at the same time.
+ */
+typedef void (*reactor_cb)(void *opaque, uint32_t events);
+
+
+/**
+ * create an epoll reactor served by nthreads dispatch threads.
+ * pin != 0 binds thread i to cpu (i % ncpus).
+ */
+void *reactor_create(int nthreads, int pin);
+
+void reactor_destroy(void *handle);
+
+
+// watch fd for input, return source id (>= 0) or < 0 on error
+int reactor_add(void *handle, int fd, reactor_cb callback, void *opaque);
+
+// stop watching, wait for an in-flight dispatch of this source to finish
+int reactor_del(void *handle, int id);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __REACTOR_H__ */
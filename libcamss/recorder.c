@@ -0,0 +1,474 @@
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <pthread.h>
+
+#define LOG_TAG "recorder"
+#include "liblog.h"
+
+#include "frame.h"
+#include "ring.h"
+#include "recorder.h"
+
+#define RECORDER_CHUNK          (4 << 20)   /** write batch, frames above go straight through */
+#define RECORDER_INDEX_STEP     1024
+#define RECORDER_QUEUE          4           /** frames held for the writer thread */
+
+#define ALIGN_UP(x, a)          (((x) + (a) - 1) & ~((uint64_t)(a) - 1))
+
+
+struct recorder_context {
+    int                     fd;
+    uint64_t                offset;     /** bytes written to fd, file offset of buf[0] */
+    uint8_t                 *buf;
+    size_t                  used;
+
+    struct recorder_header  header;
+    struct recorder_index   *index;
+    int                     count;
+    int                     capacity;
+
+    void                    *ring;      /** capture -> writer thread, frame references */
+    pthread_t               thread;
+    int                     quit;       /** atomic */
+    int                     error;      /** atomic, errno that stopped recording */
+    uint64_t                frames;     /** atomic, written by the writer thread */
+};
+
+struct replay_context {
+    const uint8_t           *map;
+    size_t                  size;
+
+    const struct recorder_header *header;
+    const struct recorder_index  *index;
+    struct recorder_index   *scanned;   /** index rebuilt from the records, NULL if the file had one */
+    int                     count;
+};
+
+
+// offset follows what really reached the file, also on a short write. the
+// first error stops recording, nothing is retried
+static int recorder_write_all(struct recorder_context *r, const void *data, size_t size)
+{
+    const uint8_t *p = (const uint8_t *)data;
+
+    if (__atomic_load_n(&r->error, __ATOMIC_RELAXED))
+        return -1;
+
+    while (size > 0) {
+        ssize_t n = write(r->fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            ALOGE("%s: write failed at %" PRIu64 " (%s), recording stopped", __func__,
+                  r->offset, strerror(errno));
+            __atomic_store_n(&r->error, errno ? errno : EIO, __ATOMIC_RELEASE);
+            return -1;
+        }
+        p += n;
+        size -= n;
+        r->offset += n;
+    }
+    return 0;
+}
+
+static int recorder_flush(struct recorder_context *r)
+{
+    size_t used = r->used;
+
+    if (used == 0)
+        return 0;
+
+    r->used = 0;
+    return recorder_write_all(r, r->buf, used);
+}
+
+static int recorder_append(struct recorder_context *r, const void *data, size_t size)
+{
+    if (r->used + size > RECORDER_CHUNK && recorder_flush(r) != 0)
+        return -1;
+
+    // a frame bigger than the batch buffer is not worth copying
+    if (size >= RECORDER_CHUNK)
+        return recorder_write_all(r, data, size);
+
+    memcpy(r->buf + r->used, data, size);
+    r->used += size;
+    return 0;
+}
+
+
+static void recorder_frame_drop(void *item)
+{
+    camss_frame_unref((struct camss_frame *)item);
+}
+
+static void *recorder_thread(void *data);
+
+void *recorder_open(const char *path, uint32_t fourcc, int width, int height)
+{
+    struct recorder_context *r;
+
+    r = (struct recorder_context *)calloc(1, sizeof(*r));
+    if (r == NULL) {
+        ALOGE("%s: Failed to allocate recorder", __func__);
+        return NULL;
+    }
+
+    r->buf = (uint8_t *)malloc(RECORDER_CHUNK);
+    if (r->buf == NULL) {
+        ALOGE("%s: Failed to allocate %d bytes", __func__, RECORDER_CHUNK);
+        free(r);
+        return NULL;
+    }
+
+    r->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (r->fd < 0) {
+        ALOGE("%s: Failed to create %s (%s)", __func__, path, strerror(errno));
+        free(r->buf);
+        free(r);
+        return NULL;
+    }
+
+    r->header.magic = RECORDER_MAGIC;
+    r->header.version = RECORDER_VERSION;
+    r->header.fourcc = fourcc;
+    r->header.width = width;
+    r->header.height = height;
+
+    recorder_append(r, &r->header, sizeof(r->header));
+
+    // a slow disk drops frames from the recording, it never holds capture up
+    r->ring = ring_create(RECORDER_QUEUE, RING_DROP_NEWEST, recorder_frame_drop);
+    if (r->ring == NULL)
+        goto bail;
+
+    if (pthread_create(&r->thread, NULL, recorder_thread, r)) {
+        ALOGE("%s: failed to create writer thread", __func__);
+        goto bail;
+    }
+
+    return r;
+
+bail:
+    ring_destroy(r->ring);
+    close(r->fd);
+    unlink(path);
+    free(r->buf);
+    free(r);
+    return NULL;
+}
+
+
+// one frame record, on the writer thread
+static int recorder_append_frame(struct recorder_context *r, struct camss_frame *frame)
+{
+    static const uint8_t zero[RECORDER_ALIGN];
+    struct recorder_frame rec;
+    struct recorder_index *entry;
+    uint64_t pos = r->offset + r->used;
+    uint64_t payload = ALIGN_UP(pos + sizeof(rec), RECORDER_ALIGN);
+
+    if (r->count == r->capacity) {
+        int capacity = r->capacity + RECORDER_INDEX_STEP;
+        entry = (struct recorder_index *)realloc(r->index, capacity * sizeof(*entry));
+        if (entry == NULL) {
+            ALOGE("%s: Failed to grow index", __func__);
+            return -1;
+        }
+        r->index = entry;
+        r->capacity = capacity;
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    rec.magic = RECORDER_FRAME_MAGIC;
+    rec.size = frame->meta.bytesused;
+    rec.sequence = frame->meta.sequence;
+    rec.flags = frame->meta.flags;
+    rec.timestamp = frame->meta.timestamp;
+    rec.recv_time = frame->meta.recv_time;
+    rec.field = frame->meta.field;
+    rec.pad = (uint32_t)(payload - pos - sizeof(rec));
+
+    if (recorder_append(r, &rec, sizeof(rec)) != 0 ||
+        recorder_append(r, zero, rec.pad) != 0 ||
+        recorder_append(r, frame->data, rec.size) != 0) {
+        return -1;
+    }
+
+    entry = &r->index[r->count++];
+    entry->offset = pos;
+    entry->size = rec.size;
+    entry->sequence = rec.sequence;
+    entry->timestamp = rec.timestamp;
+    __atomic_add_fetch(&r->frames, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static void recorder_drain(struct recorder_context *r)
+{
+    struct camss_frame *frame;
+
+    while ((frame = ring_pop(r->ring)) != NULL) {
+        if (!__atomic_load_n(&r->error, __ATOMIC_RELAXED))
+            recorder_append_frame(r, frame);
+        camss_frame_unref(frame);
+    }
+}
+
+static void *recorder_thread(void *data)
+{
+    struct recorder_context *r = (struct recorder_context *)data;
+
+    while (!__atomic_load_n(&r->quit, __ATOMIC_ACQUIRE)) {
+        ring_wait(r->ring);
+        recorder_drain(r);
+    }
+
+    return NULL;
+}
+
+
+int recorder_write(void *handle, struct camss_frame *frame)
+{
+    struct recorder_context *r = (struct recorder_context *)handle;
+
+    if (__atomic_load_n(&r->error, __ATOMIC_ACQUIRE))
+        return -1;
+
+    return ring_push(r->ring, camss_frame_ref(frame));
+}
+
+
+int recorder_get_stats(void *handle, struct recorder_stats *stats)
+{
+    struct ring_stats rs;
+    struct recorder_context *r = (struct recorder_context *)handle;
+
+    ring_get_stats(r->ring, &rs);
+
+    stats->frames = __atomic_load_n(&r->frames, __ATOMIC_RELAXED);
+    stats->dropped = rs.dropped_newest;
+    stats->error = __atomic_load_n(&r->error, __ATOMIC_ACQUIRE);
+    return 0;
+}
+
+
+int recorder_close(void *handle)
+{
+    int ret = -1;
+    struct recorder_context *r = (struct recorder_context *)handle;
+
+    if (r == NULL)
+        return -1;
+
+    __atomic_store_n(&r->quit, 1, __ATOMIC_RELEASE);
+    ring_wakeup(r->ring);
+    pthread_join(r->thread, NULL);
+
+    // what the writer had not taken yet, then the tail of the batch
+    recorder_drain(r);
+    recorder_flush(r);
+
+    // after an error only the frames that fully reached the file are indexed,
+    // the index goes where the data ends
+    while (r->count > 0) {
+        const struct recorder_index *last = &r->index[r->count - 1];
+        uint64_t end = ALIGN_UP(last->offset + sizeof(struct recorder_frame), RECORDER_ALIGN) + last->size;
+        if (end <= r->offset)
+            break;
+        r->count--;
+    }
+
+    if (__atomic_load_n(&r->error, __ATOMIC_RELAXED)) {
+        ALOGW("%s: recording stopped early, %d frames kept", __func__, r->count);
+        if (ftruncate(r->fd, r->offset) != 0 || lseek(r->fd, r->offset, SEEK_SET) < 0)
+            goto bail;
+        __atomic_store_n(&r->error, 0, __ATOMIC_RELAXED);
+    }
+
+    r->header.index_offset = r->offset;
+    r->header.count = r->count;
+
+    if (recorder_append(r, r->index, r->count * sizeof(r->index[0])) != 0 ||
+        recorder_flush(r) != 0) {
+        goto bail;
+    }
+
+    // the header goes last, a crash before this leaves an unindexed but readable file
+    if (pwrite(r->fd, &r->header, sizeof(r->header), 0) != sizeof(r->header)) {
+        ALOGE("%s: Failed to write header (%s)", __func__, strerror(errno));
+        goto bail;
+    }
+    ret = 0;
+
+bail:
+    ring_destroy(r->ring);
+    close(r->fd);
+    free(r->index);
+    free(r->buf);
+    free(r);
+    return ret;
+}
+
+
+
+// walk the frame records of a recording that was never closed
+static int replay_scan(struct replay_context *p)
+{
+    int capacity = 0;
+    uint64_t pos = sizeof(struct recorder_header);
+    struct recorder_frame rec;
+    struct recorder_index *entry;
+
+    while (pos + sizeof(rec) <= p->size) {
+        memcpy(&rec, p->map + pos, sizeof(rec));
+        if (rec.magic != RECORDER_FRAME_MAGIC ||
+            pos + sizeof(rec) + rec.pad + rec.size > p->size) {
+            break;
+        }
+
+        if (p->count == capacity) {
+            capacity += RECORDER_INDEX_STEP;
+            entry = (struct recorder_index *)realloc(p->scanned, capacity * sizeof(*entry));
+            if (entry == NULL)
+                return -1;
+            p->scanned = entry;
+        }
+
+        entry = &p->scanned[p->count++];
+        entry->offset = pos;
+        entry->size = rec.size;
+        entry->sequence = rec.sequence;
+        entry->timestamp = rec.timestamp;
+
+        pos += sizeof(rec) + rec.pad + rec.size;
+    }
+
+    p->index = p->scanned;
+    ALOGW("%s: no index, recovered %d frames", __func__, p->count);
+    return 0;
+}
+
+
+void *replay_open(const char *path)
+{
+    int fd;
+    struct stat st;
+    struct replay_context *p;
+
+    p = (struct replay_context *)calloc(1, sizeof(*p));
+    if (p == NULL) {
+        ALOGE("%s: Failed to allocate replay", __func__);
+        return NULL;
+    }
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ALOGE("%s: Failed to open %s (%s)", __func__, path, strerror(errno));
+        free(p);
+        return NULL;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct recorder_header)) {
+        ALOGE("%s: %s is not a recording", __func__, path);
+        close(fd);
+        free(p);
+        return NULL;
+    }
+
+    p->size = st.st_size;
+    p->map = (const uint8_t *)mmap(NULL, p->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p->map == MAP_FAILED) {
+        ALOGE("%s: Failed to mmap %s (%s)", __func__, path, strerror(errno));
+        free(p);
+        return NULL;
+    }
+
+    p->header = (const struct recorder_header *)p->map;
+    if (p->header->magic != RECORDER_MAGIC || p->header->version != RECORDER_VERSION) {
+        ALOGE("%s: %s bad magic/version", __func__, path);
+        goto bail;
+    }
+
+    if (p->header->index_offset != 0 &&
+        p->header->index_offset + (uint64_t)p->header->count * sizeof(struct recorder_index) <= p->size) {
+        p->index = (const struct recorder_index *)(p->map + p->header->index_offset);
+        p->count = p->header->count;
+    } else if (replay_scan(p) != 0) {
+        goto bail;
+    }
+
+    return p;
+
+bail:
+    replay_close(p);
+    return NULL;
+}
+
+
+void replay_close(void *handle)
+{
+    struct replay_context *p = (struct replay_context *)handle;
+
+    if (p == NULL)
+        return;
+
+    munmap((void *)p->map, p->size);
+    free(p->scanned);
+    free(p);
+}
+
+
+int replay_info(void *handle, uint32_t *fourcc, int *width, int *height)
+{
+    struct replay_context *p = (struct replay_context *)handle;
+
+    *fourcc = p->header->fourcc;
+    *width = p->header->width;
+    *height = p->header->height;
+    return p->count;
+}
+
+
+int replay_frame(void *handle, int index, struct replay_frame *frame)
+{
+    struct recorder_frame rec;
+    const struct recorder_index *entry;
+    struct replay_context *p = (struct replay_context *)handle;
+
+    if (index < 0 || index >= p->count)
+        return -1;
+
+    entry = &p->index[index];
+    if (entry->offset + sizeof(rec) > p->size)
+        return -1;
+
+    memcpy(&rec, p->map + entry->offset, sizeof(rec));
+    if (rec.magic != RECORDER_FRAME_MAGIC ||
+        entry->offset + sizeof(rec) + rec.pad + rec.size > p->size) {
+        ALOGE("%s: frame %d is corrupt", __func__, index);
+        return -1;
+    }
+
+    frame->data = p->map + entry->offset + sizeof(rec) + rec.pad;
+    frame->size = rec.size;
+    frame->meta.timestamp = rec.timestamp;
+    frame->meta.recv_time = rec.recv_time;
+    frame->meta.sequence = rec.sequence;
+    frame->meta.bytesused = rec.size;
+    frame->meta.field = rec.field;
+    frame->meta.flags = rec.flags;
+    return 0;
+}
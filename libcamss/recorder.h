@@ -0,0 +1,106 @@
+#ifndef __RECORDER_H__
+#define __RECORDER_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * raw capture container, little endian:
+ *
+ *   header        struct recorder_header, index fields filled on close
+ *   frames        struct recorder_frame + bytes, each payload 64-byte aligned
+ *   index         struct recorder_index[count] at header.index_offset
+ *
+ * a file without index (writer crashed) is still readable by scanning the
+ * frame records, replay_open does that.
+ */
+#define RECORDER_MAGIC          0x524d4143      /** "CAMR" */
+#define RECORDER_FRAME_MAGIC    0x4d415246      /** "FRAM" */
+#define RECORDER_VERSION        1
+#define RECORDER_ALIGN          64
+
+struct recorder_header {
+    uint32_t    magic;
+    uint32_t    version;
+    uint32_t    fourcc;         /** v4l2 fourcc of the payloads */
+    uint32_t    width;
+    uint32_t    height;
+    uint32_t    count;          /** frames in the index, 0 if not closed */
+    uint64_t    index_offset;   /** 0 if not closed */
+    uint8_t     reserved[32];
+} __attribute__((packed));
+
+struct recorder_frame {
+    uint32_t    magic;
+    uint32_t    size;           /** payload bytes */
+    uint32_t    sequence;
+    uint32_t    flags;
+    uint64_t    timestamp;      /** us */
+    uint64_t    recv_time;      /** us */
+    uint32_t    field;
+    uint32_t    pad;            /** bytes between this record and the payload */
+} __attribute__((packed));
+
+struct recorder_index {
+    uint64_t    offset;         /** of the frame record */
+    uint32_t    size;
+    uint32_t    sequence;
+    uint64_t    timestamp;
+} __attribute__((packed));
+
+
+struct recorder_stats {
+    uint64_t    frames;         /** written */
+    uint64_t    dropped;        /** writer thread behind, not recorded */
+    int         error;          /** errno of the write that stopped recording, 0 if none */
+};
+
+// create path, frames are written in large chunks on a writer thread
+void *recorder_open(const char *path, uint32_t fourcc, int width, int height);
+
+/**
+ * queue frame->data (meta.bytesused bytes) and its metadata for the writer,
+ * which holds a frame reference until it is written. returns 0 if queued,
+ * 1 if dropped because the writer is behind, < 0 once a write failed: the
+ * recording stopped there, see recorder_get_stats
+ */
+int recorder_write(void *handle, struct camss_frame *frame);
+
+int recorder_get_stats(void *handle, struct recorder_stats *stats);
+
+// write what is queued, the index and the header. after a write error the
+// file is cut back to the last complete frame and indexed up to there
+int recorder_close(void *handle);
+
+
+/** one recorded frame, pointers into the mapping */
+struct replay_frame {
+    const uint8_t           *data;
+    uint32_t                size;
+    struct camss_frame_meta meta;
+};
+
+// mmap a recording for random access
+void *replay_open(const char *path);
+
+void replay_close(void *handle);
+
+// geometry of the recording, returns the number of frames
+int replay_info(void *handle, uint32_t *fourcc, int *width, int *height);
+
+// frame i, valid until replay_close
+int replay_frame(void *handle, int index, struct replay_frame *frame);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RECORDER_H__ */
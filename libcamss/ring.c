@@ -0,0 +1,205 @@
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <semaphore.h>
+
+#define LOG_TAG "ring"
+#include "liblog.h"
+
+#include "ring.h"
+
+#define RING_CACHELINE  64
+
+
+/*
+ * head is owned by the consumer and tail by the producer. the only shared
+ * write is the producer advancing head to evict (RING_DROP_OLDEST), so the
+ * consumer claims an item with a CAS on head and retries if it lost the slot.
+ */
+struct ring_context {
+    uint32_t        size;
+    uint32_t        mask;
+    int             policy;
+    void            (*drop)(void *item);
+
+    sem_t           items;      /** posted per push, may run ahead after evictions */
+    sem_t           space;      /** posted by a pop that saw waiting, RING_BLOCK only */
+    int             waiting;    /** atomic, a RING_BLOCK push is about to sleep on space */
+
+    uint32_t        head __attribute__((aligned(RING_CACHELINE)));
+    uint32_t        tail __attribute__((aligned(RING_CACHELINE)));
+
+    struct ring_stats stats __attribute__((aligned(RING_CACHELINE)));
+
+    void            *slots[];
+};
+
+
+static void ring_count(uint64_t *counter)
+{
+    __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
+
+void *ring_create(int size, int policy, void (*drop)(void *item))
+{
+    uint32_t n = 1;
+    struct ring_context *r;
+
+    if (size <= 0) {
+        ALOGE("%s: bad size %d", __func__, size);
+        return NULL;
+    }
+
+    while (n < (uint32_t)size)
+        n <<= 1;
+
+    if (posix_memalign((void **)&r, RING_CACHELINE, sizeof(*r) + n * sizeof(void *)) != 0) {
+        ALOGE("%s: Failed to allocate ring", __func__);
+        return NULL;
+    }
+
+    memset(r, 0, sizeof(*r) + n * sizeof(void *));
+    r->size = n;
+    r->mask = n - 1;
+    r->policy = policy;
+    r->drop = drop;
+    sem_init(&r->items, 0, 0);
+    sem_init(&r->space, 0, 0);
+
+    return r;
+}
+
+
+void ring_destroy(void *handle)
+{
+    struct ring_context *r = (struct ring_context *)handle;
+
+    if (r == NULL)
+        return;
+
+    sem_destroy(&r->items);
+    sem_destroy(&r->space);
+    free(r);
+}
+
+
+int ring_push(void *handle, void *item)
+{
+    uint32_t head;
+    void *oldest;
+    int blocked = 0;
+    struct ring_context *r = (struct ring_context *)handle;
+    const uint32_t tail = r->tail;
+
+    for (;;) {
+        head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        if (tail - head < r->size)
+            break;
+
+        if (r->policy == RING_DROP_NEWEST) {
+            ring_count(&r->stats.dropped_newest);
+            if (r->drop)
+                r->drop(item);
+            return 1;
+        }
+
+        if (r->policy == RING_DROP_OLDEST) {
+            oldest = __atomic_load_n(&r->slots[head & r->mask], __ATOMIC_RELAXED);
+            if (__atomic_compare_exchange_n(&r->head, &head, head + 1, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                ring_count(&r->stats.dropped_oldest);
+                if (r->drop)
+                    r->drop(oldest);
+            }
+            continue;
+        }
+
+        /** RING_BLOCK */
+        if (!blocked) {
+            ring_count(&r->stats.blocked);
+            blocked = 1;
+        }
+
+        // say so before looking again, a pop either sees the flag or we see its head
+        __atomic_store_n(&r->waiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        if (tail - head < r->size) {
+            // a pop that took the flag meanwhile leaves one post, one more turn later
+            __atomic_store_n(&r->waiting, 0, __ATOMIC_RELAXED);
+            break;
+        }
+
+        while (sem_wait(&r->space) != 0 && errno == EINTR)
+            ;
+    }
+
+    __atomic_store_n(&r->slots[tail & r->mask], item, __ATOMIC_RELAXED);
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+    ring_count(&r->stats.pushed);
+
+    sem_post(&r->items);
+    return 0;
+}
+
+
+void *ring_pop(void *handle)
+{
+    uint32_t head, tail;
+    void *item;
+    struct ring_context *r = (struct ring_context *)handle;
+
+    for (;;) {
+        head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        if (head == tail)
+            return NULL;
+
+        item = __atomic_load_n(&r->slots[head & r->mask], __ATOMIC_RELAXED);
+
+        // fails only if the producer evicted this slot meanwhile
+        if (__atomic_compare_exchange_n(&r->head, &head, head + 1, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            ring_count(&r->stats.popped);
+            if (r->policy == RING_BLOCK) {
+                __atomic_thread_fence(__ATOMIC_SEQ_CST);
+                if (__atomic_exchange_n(&r->waiting, 0, __ATOMIC_RELAXED))
+                    sem_post(&r->space);
+            }
+            return item;
+        }
+    }
+}
+
+
+void ring_wait(void *handle)
+{
+    struct ring_context *r = (struct ring_context *)handle;
+
+    while (sem_wait(&r->items) != 0 && errno == EINTR)
+        ;
+}
+
+
+void ring_wakeup(void *handle)
+{
+    struct ring_context *r = (struct ring_context *)handle;
+
+    sem_post(&r->items);
+}
+
+
+void ring_get_stats(void *handle, struct ring_stats *stats)
+{
+    struct ring_context *r = (struct ring_context *)handle;
+
+    stats->pushed = __atomic_load_n(&r->stats.pushed, __ATOMIC_RELAXED);
+    stats->popped = __atomic_load_n(&r->stats.popped, __ATOMIC_RELAXED);
+    stats->dropped_oldest = __atomic_load_n(&r->stats.dropped_oldest, __ATOMIC_RELAXED);
+    stats->dropped_newest = __atomic_load_n(&r->stats.dropped_newest, __ATOMIC_RELAXED);
+    stats->blocked = __atomic_load_n(&r->stats.blocked, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,54 @@
+#ifndef __RING_H__
+#define __RING_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** what ring_push does when the ring is full */
+enum ring_policy {
+    RING_DROP_OLDEST = 0,   /** evict the oldest queued item */
+    RING_DROP_NEWEST,       /** drop the item being pushed */
+    RING_BLOCK,             /** wait for the consumer */
+};
+
+struct ring_stats {
+    uint64_t    pushed;
+    uint64_t    popped;
+    uint64_t    dropped_oldest;
+    uint64_t    dropped_newest;
+    uint64_t    blocked;        /** pushes that had to wait */
+};
+
+
+/**
+ * lock-free single-producer/single-consumer ring of pointers.
+ * size is rounded up to a power of two. drop() is called (on the producer)
+ * for every item the policy discards.
+ */
+void *ring_create(int size, int policy, void (*drop)(void *item));
+
+void ring_destroy(void *handle);
+
+// producer: returns 0 if queued, 1 if item was dropped
+int ring_push(void *handle, void *item);
+
+// consumer: returns NULL if empty
+void *ring_pop(void *handle);
+
+// consumer: sleep until something was pushed or ring_wakeup()
+void ring_wait(void *handle);
+
+void ring_wakeup(void *handle);
+
+void ring_get_stats(void *handle, struct ring_stats *stats);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RING_H__ */
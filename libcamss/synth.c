@@ -0,0 +1,414 @@
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include <linux/videodev2.h>
+
+#include <pthread.h>
+
+#define LOG_TAG "synth"
+#include "liblog.h"
+
+#include "synth.h"
+
+#define SYNTH_SCROLL        4       /** pixels per frame, even for 4:2:x chroma */
+#define SYNTH_FONT_SCALE    4
+#define SYNTH_DIGITS        8       /** of the timestamp in ms */
+
+#define ALIGN_UP(x, a)      (((x) + (a) - 1) & ~((a) - 1))
+
+
+struct synth_context {
+    enum synth_pattern  pattern;
+    uint32_t            fourcc;
+    int                 width;
+    int                 height;
+    int                 fps;        /** <= 0: max speed */
+
+    int                 padded;     /** pixels per row, width rounded up to even for 4:2:x chroma */
+    int                 bytesperline;
+    size_t              sizeimage;
+
+    /** timerfd, or at max speed an eventfd semaphore counting queued buffers */
+    int                 fd;
+
+    /**
+     * one row of each plane, two pattern periods wide: a scrolled row is a
+     * single memcpy at an offset, which libc does with the widest vectors.
+     */
+    uint8_t             *row[3];
+
+    pthread_mutex_t     lock;
+    int                 queue[SYNTH_MAX_BUFFERS];
+    void                *data[SYNTH_MAX_BUFFERS];
+    int                 head;
+    int                 count;
+
+    uint32_t            sequence;
+    uint64_t            rng;
+};
+
+
+/** 75% bars, bt.601 limited range: white yellow cyan green magenta red blue black */
+static const uint8_t kBars[8][3] = {
+    {180, 128, 128}, {162,  44, 142}, {131, 156,  44}, {112,  72,  58},
+    { 84, 184, 198}, { 65, 100, 212}, { 35, 212, 114}, { 16, 128, 128},
+};
+
+/** 3x5 digits, row major, msb first */
+static const uint16_t kDigits[10] = {
+    0x7b6f, 0x2c97, 0x73e7, 0x73cf, 0x5bc9, 0x79cf, 0x79ef, 0x7249, 0x7bef, 0x7bcf,
+};
+
+
+static void synth_color(struct synth_context *s, int x, uint8_t yuv[3])
+{
+    x %= s->width;
+
+    if (s->pattern == SYNTH_BARS) {
+        memcpy(yuv, kBars[x * 8 / s->width], 3);
+    } else {
+        yuv[0] = 16 + x * 219 / s->width;
+        yuv[1] = 128;
+        yuv[2] = 128;
+    }
+}
+
+static int synth_build_rows(struct synth_context *s)
+{
+    uint8_t yuv[3];
+    const int period = 2 * s->padded;
+
+    for (int i = 0; i < 3; i++) {
+        s->row[i] = (uint8_t *)malloc(period * 2);
+        if (s->row[i] == NULL)
+            return -1;
+    }
+
+    for (int x = 0; x < period; x++) {
+        synth_color(s, x, yuv);
+
+        switch (s->fourcc) {
+            case V4L2_PIX_FMT_YUYV:
+                // Y0 U Y1 V, chroma from the even pixel
+                s->row[0][x * 2] = yuv[0];
+                s->row[0][x * 2 + 1] = (x & 1) ? yuv[2] : yuv[1];
+                break;
+            case V4L2_PIX_FMT_NV12:
+                s->row[0][x] = yuv[0];
+                s->row[1][x] = (x & 1) ? yuv[2] : yuv[1];
+                break;
+            default:
+                s->row[0][x] = yuv[0];
+                s->row[1][x / 2] = yuv[1];
+                s->row[2][x / 2] = yuv[2];
+                break;
+        }
+    }
+    return 0;
+}
+
+
+static void synth_noise(struct synth_context *s, uint8_t *dst, int bytes)
+{
+    uint64_t x = s->rng;
+
+    // xorshift64, 8 bytes per step, rows of any width and alignment
+    for (int i = 0; i < bytes; i += 8) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        memcpy(dst + i, &x, bytes - i < 8 ? bytes - i : 8);
+    }
+    s->rng = x;
+}
+
+static void synth_burn_in(struct synth_context *s, uint8_t *luma, int step, uint32_t value)
+{
+    const int cell = 4 * SYNTH_FONT_SCALE;     /** 3 columns + 1 space */
+
+    if (s->width < cell * SYNTH_DIGITS || s->height < 6 * SYNTH_FONT_SCALE)
+        return;
+
+    for (int d = SYNTH_DIGITS - 1; d >= 0; d--, value /= 10) {
+        uint16_t glyph = kDigits[value % 10];
+
+        for (int y = 0; y < 6 * SYNTH_FONT_SCALE; y++) {
+            uint8_t *p = luma + y * s->bytesperline + d * cell * step;
+            int gy = y / SYNTH_FONT_SCALE;
+
+            for (int x = 0; x < cell; x++) {
+                int gx = x / SYNTH_FONT_SCALE;
+                int on = gy < 5 && gx < 3 && (glyph >> (14 - gy * 3 - gx)) & 1;
+                p[x * step] = on ? 235 : 16;
+            }
+        }
+    }
+}
+
+// whole padded rows, an odd width gets its last chroma pair like any other column
+static void synth_render(struct synth_context *s, uint8_t *dst, uint32_t stamp)
+{
+    const int aw = s->padded;
+    const int h = s->height;
+    const int ch = (h + 1) / 2;
+    const int shift = (int)((uint64_t)s->sequence * SYNTH_SCROLL % s->width) & ~1;
+    uint8_t *chroma = dst + aw * h;
+
+    switch (s->fourcc) {
+        case V4L2_PIX_FMT_YUYV:
+            for (int y = 0; y < h; y++) {
+                if (s->pattern == SYNTH_NOISE)
+                    synth_noise(s, dst + y * s->bytesperline, aw * 2);
+                else
+                    memcpy(dst + y * s->bytesperline, s->row[0] + shift * 2, aw * 2);
+            }
+            synth_burn_in(s, dst, 2, stamp);
+            return;
+
+        case V4L2_PIX_FMT_NV12:
+            for (int y = 0; y < ch; y++) {
+                memcpy(chroma + y * aw, s->row[1] + shift, aw);
+            }
+            break;
+
+        default:
+            for (int y = 0; y < ch; y++) {
+                memcpy(chroma + y * (aw / 2), s->row[1] + shift / 2, aw / 2);
+                memcpy(chroma + (aw / 2) * ch + y * (aw / 2), s->row[2] + shift / 2, aw / 2);
+            }
+            break;
+    }
+
+    if (s->pattern == SYNTH_NOISE) {
+        synth_noise(s, dst, aw * h);
+    } else {
+        for (int y = 0; y < h; y++) {
+            memcpy(dst + y * aw, s->row[0] + shift, aw);
+        }
+    }
+    synth_burn_in(s, dst, 1, stamp);
+}
+
+
+void *synth_create(const char *pattern, uint32_t fourcc, int width, int height, int fps)
+{
+    struct synth_context *s;
+
+    if (width < 1 || height < 1) {
+        ALOGE("%s: bad size %dx%d", __func__, width, height);
+        return NULL;
+    }
+
+    s = (struct synth_context *)calloc(1, sizeof(*s));
+    if (s == NULL) {
+        ALOGE("%s: Failed to allocate synth", __func__);
+        return NULL;
+    }
+
+    s->fd = -1;
+    s->fourcc = fourcc;
+    s->width = width;
+    s->height = height;
+    s->padded = ALIGN_UP(width, 2);
+    s->fps = fps;
+    s->rng = 0x9e3779b97f4a7c15ull;
+    pthread_mutex_init(&s->lock, NULL);
+
+    if (pattern == NULL || strcmp(pattern, "bars") == 0) {
+        s->pattern = SYNTH_BARS;
+    } else if (strcmp(pattern, "gradient") == 0) {
+        s->pattern = SYNTH_GRADIENT;
+    } else if (strcmp(pattern, "noise") == 0) {
+        s->pattern = SYNTH_NOISE;
+    } else {
+        ALOGE("%s: unknown pattern '%s'", __func__, pattern);
+        goto bail;
+    }
+
+    // rows padded to even like a driver's bytesperline: the chroma planes
+    // are then half (YUV420) or the same (NV12) stride, as camss maps them
+    switch (fourcc) {
+        case V4L2_PIX_FMT_YUYV:
+            s->bytesperline = s->padded * 2;
+            s->sizeimage = (size_t)s->bytesperline * height;
+            break;
+        case V4L2_PIX_FMT_NV12:
+        case V4L2_PIX_FMT_YUV420:
+            s->bytesperline = s->padded;
+            s->sizeimage = (size_t)s->padded * height + (size_t)s->padded * ((height + 1) / 2);
+            break;
+        default:
+            ALOGE("%s: unsupported fourcc '%.4s'", __func__, (char*)&fourcc);
+            goto bail;
+    }
+
+    if (synth_build_rows(s) != 0) {
+        ALOGE("%s: Failed to allocate pattern rows", __func__);
+        goto bail;
+    }
+
+    if (fps > 0) {
+        s->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    } else {
+        s->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC | EFD_SEMAPHORE);
+    }
+    if (s->fd < 0) {
+        ALOGE("%s: Failed to create timer (%s)", __func__, strerror(errno));
+        goto bail;
+    }
+
+    ALOGI("%s: '%.4s' %dx%d pattern %d fps %d%s", __func__, (char*)&fourcc,
+          width, height, s->pattern, fps, fps > 0 ? "" : " (max speed)");
+    return s;
+
+bail:
+    synth_destroy(s);
+    return NULL;
+}
+
+
+void synth_destroy(void *handle)
+{
+    struct synth_context *s = (struct synth_context *)handle;
+
+    if (s == NULL)
+        return;
+
+    if (s->fd >= 0)
+        close(s->fd);
+
+    for (int i = 0; i < 3; i++)
+        free(s->row[i]);
+
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+}
+
+
+int synth_fd(void *handle)
+{
+    return ((struct synth_context *)handle)->fd;
+}
+
+int synth_bytesperline(void *handle)
+{
+    return ((struct synth_context *)handle)->bytesperline;
+}
+
+size_t synth_sizeimage(void *handle)
+{
+    return ((struct synth_context *)handle)->sizeimage;
+}
+
+
+static int synth_set_timer(struct synth_context *s, long period_ns)
+{
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    its.it_interval.tv_sec = period_ns / 1000000000L;
+    its.it_interval.tv_nsec = period_ns % 1000000000L;
+    its.it_value = its.it_interval;
+
+    if (timerfd_settime(s->fd, 0, &its, NULL) != 0) {
+        ALOGE("%s: timerfd_settime failed (%s)", __func__, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int synth_start(void *handle)
+{
+    struct synth_context *s = (struct synth_context *)handle;
+
+    s->sequence = 0;
+
+    // max speed: the eventfd is readable whenever a buffer is queued
+    if (s->fps <= 0)
+        return 0;
+
+    return synth_set_timer(s, 1000000000L / s->fps);
+}
+
+int synth_stop(void *handle)
+{
+    struct synth_context *s = (struct synth_context *)handle;
+
+    if (s->fps <= 0)
+        return 0;
+
+    return synth_set_timer(s, 0);
+}
+
+
+int synth_qbuf(void *handle, int index, void *data)
+{
+    uint64_t one = 1;
+    struct synth_context *s = (struct synth_context *)handle;
+
+    if (index < 0 || index >= SYNTH_MAX_BUFFERS)
+        return -1;
+
+    pthread_mutex_lock(&s->lock);
+    if (s->count == SYNTH_MAX_BUFFERS) {
+        pthread_mutex_unlock(&s->lock);
+        return -1;
+    }
+    s->data[index] = data;
+    s->queue[(s->head + s->count) % SYNTH_MAX_BUFFERS] = index;
+    s->count++;
+    pthread_mutex_unlock(&s->lock);
+
+    if (s->fps <= 0 && write(s->fd, &one, sizeof(one)) != sizeof(one)) {
+        ALOGE("%s: Failed to signal buffer %d", __func__, index);
+    }
+    return 0;
+}
+
+
+int synth_dqbuf(void *handle, struct synth_buffer *buf)
+{
+    int index;
+    uint64_t ticks;
+    struct timespec ts;
+    struct synth_context *s = (struct synth_context *)handle;
+
+    // timer: expirations since the last read, eventfd: one queued buffer
+    if (read(s->fd, &ticks, sizeof(ticks)) != sizeof(ticks)) {
+        return -1;
+    }
+
+    // ticks missed while the dispatcher was busy are frames a sensor would have lost
+    if (s->fps > 0)
+        s->sequence += (uint32_t)(ticks - 1);
+
+    pthread_mutex_lock(&s->lock);
+    if (s->count == 0) {
+        pthread_mutex_unlock(&s->lock);
+        s->sequence++;
+        errno = EAGAIN;
+        return -1;
+    }
+    index = s->queue[s->head];
+    s->head = (s->head + 1) % SYNTH_MAX_BUFFERS;
+    s->count--;
+    pthread_mutex_unlock(&s->lock);
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    buf->index = index;
+    buf->bytesused = s->sizeimage;
+    buf->sequence = s->sequence;
+    buf->timestamp = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+    synth_render(s, (uint8_t *)s->data[index], (uint32_t)(buf->timestamp / 1000 % 100000000));
+    s->sequence++;
+    return 0;
+}
@@ -0,0 +1,66 @@
+#ifndef __SYNTH_H__
+#define __SYNTH_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define SYNTH_MAX_BUFFERS   64
+
+enum synth_pattern {
+    SYNTH_BARS = 0,         /** color bars scrolling left */
+    SYNTH_GRADIENT,         /** scrolling luma ramp */
+    SYNTH_NOISE,            /** fresh random luma every frame */
+};
+
+/** a rendered buffer, like a dequeued v4l2_buffer */
+struct synth_buffer {
+    int         index;
+    uint32_t    bytesused;
+    uint32_t    sequence;   /** frames the generator could not fill leave gaps */
+    uint64_t    timestamp;  /** CLOCK_MONOTONIC, us */
+};
+
+
+/**
+ * test pattern camera. frames are generated when due: every 1/fps on a
+ * timerfd, or with fps <= 0 as soon as an empty buffer is queued (max
+ * speed, bound by how fast consumers give buffers back). the capture
+ * timestamp (ms, last 8 digits) is burnt into the top left corner, so the
+ * latency to a display can be read off a photo of both.
+ *
+ * fourcc: V4L2_PIX_FMT_YUYV, NV12 or YUV420, any size: rows are padded
+ * to an even width (see synth_bytesperline). pattern: "bars", "gradient"
+ * or "noise", NULL for bars.
+ */
+void *synth_create(const char *pattern, uint32_t fourcc, int width, int height, int fps);
+
+void synth_destroy(void *handle);
+
+// readable when synth_dqbuf has a frame for the caller, watch it with a reactor
+int synth_fd(void *handle);
+
+int synth_bytesperline(void *handle);
+
+size_t synth_sizeimage(void *handle);
+
+int synth_start(void *handle);
+
+int synth_stop(void *handle);
+
+// give an empty buffer (sizeimage bytes) to the generator
+int synth_qbuf(void *handle, int index, void *data);
+
+// render the next frame, returns < 0 (EAGAIN) if none is due or no buffer is queued
+int synth_dqbuf(void *handle, struct synth_buffer *buf);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SYNTH_H__ */
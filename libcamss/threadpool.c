@@ -0,0 +1,197 @@
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#define LOG_TAG "threadpool"
+#include "liblog.h"
+
+#include "threadpool.h"
+
+#define THREADPOOL_MAX_THREADS  32
+
+
+/*
+ * jobs are claimed from a 64-bit counter holding (run << 32 | next job), so a
+ * worker that is late for a run can never claim a job of the following one.
+ */
+struct threadpool_context {
+    int             nthreads;
+    pthread_t       threads[THREADPOOL_MAX_THREADS];
+
+    pthread_mutex_t run_lock;   /** one run at a time */
+
+    pthread_mutex_t lock;
+    pthread_cond_t  start;
+    pthread_cond_t  done;
+    uint32_t        run;        /** current run id */
+    int             quit;
+
+    threadpool_fn   fn;
+    void            *arg;
+    int             njobs;
+    uint64_t        next;       /** atomic, run << 32 | job */
+    int             pending;    /** atomic, jobs not finished */
+};
+
+
+static void threadpool_work(struct threadpool_context *pool, uint32_t run,
+                            threadpool_fn fn, void *arg, int njobs)
+{
+    uint64_t cur, job;
+
+    for (;;) {
+        cur = __atomic_load_n(&pool->next, __ATOMIC_ACQUIRE);
+        if ((uint32_t)(cur >> 32) != run)
+            return;
+
+        job = cur & 0xffffffff;
+        if (job >= (uint64_t)njobs)
+            return;
+
+        if (!__atomic_compare_exchange_n(&pool->next, &cur, cur + 1, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            continue;
+
+        fn(arg, (int)job);
+
+        if (__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+            pthread_mutex_lock(&pool->lock);
+            pthread_cond_signal(&pool->done);
+            pthread_mutex_unlock(&pool->lock);
+        }
+    }
+}
+
+
+static void *threadpool_thread(void *data)
+{
+    uint32_t seen = 0;
+    uint32_t run;
+    threadpool_fn fn;
+    void *arg;
+    int njobs;
+    struct threadpool_context *pool = (struct threadpool_context *)data;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->run == seen && !pool->quit)
+            pthread_cond_wait(&pool->start, &pool->lock);
+
+        if (pool->quit) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+
+        seen = run = pool->run;
+        fn = pool->fn;
+        arg = pool->arg;
+        njobs = pool->njobs;
+        pthread_mutex_unlock(&pool->lock);
+
+        threadpool_work(pool, run, fn, arg, njobs);
+    }
+
+    return NULL;
+}
+
+
+void *threadpool_create(int nthreads)
+{
+    struct threadpool_context *pool;
+
+    if (nthreads < 0 || nthreads > THREADPOOL_MAX_THREADS) {
+        ALOGE("%s: bad thread count %d", __func__, nthreads);
+        return NULL;
+    }
+
+    pool = (struct threadpool_context *)calloc(1, sizeof(*pool));
+    if (pool == NULL) {
+        ALOGE("%s: Failed to allocate pool", __func__);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->run_lock, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (int i = 0; i < nthreads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, threadpool_thread, pool)) {
+            ALOGE("%s: failed to create thread %d", __func__, i);
+            threadpool_destroy(pool);
+            return NULL;
+        }
+        pool->nthreads++;
+    }
+
+    return pool;
+}
+
+
+void threadpool_destroy(void *handle)
+{
+    struct threadpool_context *pool = (struct threadpool_context *)handle;
+
+    if (pool == NULL)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->nthreads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->run_lock);
+    free(pool);
+}
+
+
+int threadpool_size(void *handle)
+{
+    struct threadpool_context *pool = (struct threadpool_context *)handle;
+
+    return pool->nthreads + 1;
+}
+
+
+int threadpool_run(void *handle, int njobs, threadpool_fn fn, void *arg)
+{
+    uint32_t run;
+    struct threadpool_context *pool = (struct threadpool_context *)handle;
+
+    if (njobs <= 0)
+        return 0;
+
+    pthread_mutex_lock(&pool->run_lock);
+
+    pthread_mutex_lock(&pool->lock);
+    run = ++pool->run;
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->njobs = njobs;
+    __atomic_store_n(&pool->pending, njobs, __ATOMIC_RELEASE);
+    __atomic_store_n(&pool->next, (uint64_t)run << 32, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    threadpool_work(pool, run, fn, arg, njobs);
+
+    pthread_mutex_lock(&pool->lock);
+    while (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+
+    pthread_mutex_unlock(&pool->run_lock);
+    return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** job body, job is 0..njobs-1 */
+typedef void (*threadpool_fn)(void *arg, int job);
+
+
+// persistent worker threads, the caller of threadpool_run works too
+void *threadpool_create(int nthreads);
+
+void threadpool_destroy(void *handle);
+
+// number of threads working on a run, workers + caller
+int threadpool_size(void *handle);
+
+// run fn for every job across the pool, returns when all are done
+int threadpool_run(void *handle, int njobs, threadpool_fn fn, void *arg);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __THREADPOOL_H__ */
@@ -0,0 +1,329 @@
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+#define LOG_TAG "yuv10"
+#include "liblog.h"
+
+#include "fourcc.h"
+#include "i420.h"
+#include "yuv10.h"
+
+#define YUV10_MASK          0x3ff
+#define YUV10_GREY          512     /** neutral chroma for greyscale sources */
+
+
+/** a 10 bit source, byte strides. Y210 and Y10P only use plane 0 */
+struct yuv10_src {
+    uint32_t        fourcc;
+    const uint8_t   *plane[3];
+    int             stride[3];
+    int             height;
+};
+
+/** one luma row and the 4:2:0 chroma row of an even luma row, lsb aligned */
+struct yuv10_rows {
+    uint16_t    y[YUV10_MAX_WIDTH];
+    uint16_t    u[YUV10_MAX_WIDTH / 2];
+    uint16_t    v[YUV10_MAX_WIDTH / 2];
+};
+
+
+size_t yuv10_packed_size(int samples)
+{
+    return (size_t)samples / 4 * 5;
+}
+
+/**
+ * gcc does not vectorize the 5 byte groups (no permute for them on x86),
+ * so SSSE3 builds shuffle two groups per 16 byte load. the groups the
+ * load would overrun, and other targets, take the scalar loop.
+ */
+void yuv10_unpack(const uint8_t *src, uint16_t *dst, int samples, int shift)
+{
+    int i = 0;
+    const int groups = samples / 4;
+
+#if defined(__SSSE3__)
+    const __m128i msbs = _mm_setr_epi8(0, -1, 1, -1, 2, -1, 3, -1, 5, -1, 6, -1, 7, -1, 8, -1);
+    const __m128i lsbs = _mm_setr_epi8(4, -1, 4, -1, 4, -1, 4, -1, 9, -1, 9, -1, 9, -1, 9, -1);
+    const __m128i lift = _mm_setr_epi16(64, 16, 4, 1, 64, 16, 4, 1);   /** lsb pair to bits 6-7 */
+    const __m128i count = _mm_cvtsi32_si128(shift);
+
+    for (; i * 5 + 16 <= groups * 5; i += 2) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(src + i * 5));
+        __m128i m = _mm_slli_epi16(_mm_shuffle_epi8(in, msbs), 2);
+        __m128i l = _mm_mullo_epi16(_mm_shuffle_epi8(in, lsbs), lift);
+
+        l = _mm_and_si128(_mm_srli_epi16(l, 6), _mm_set1_epi16(3));
+        _mm_storeu_si128((__m128i *)(dst + i * 4), _mm_sll_epi16(_mm_or_si128(m, l), count));
+    }
+#endif
+
+    for (; i < groups; i++) {
+        const uint8_t *g = src + i * 5;
+        uint16_t *d = dst + i * 4;
+
+        d[0] = (uint16_t)(g[0] << 2 | (g[4] & 3)) << shift;
+        d[1] = (uint16_t)(g[1] << 2 | (g[4] >> 2 & 3)) << shift;
+        d[2] = (uint16_t)(g[2] << 2 | (g[4] >> 4 & 3)) << shift;
+        d[3] = (uint16_t)(g[3] << 2 | (g[4] >> 6)) << shift;
+    }
+}
+
+
+static void yuv10_read_luma(const struct yuv10_src *s, int row, int x, int width, uint16_t *y)
+{
+    const uint8_t *line = s->plane[0] + row * s->stride[0];
+    const uint16_t *p = (const uint16_t *)line;
+
+    switch (s->fourcc) {
+        case FOURCC_Y210:
+            p += x * 2;
+            for (int i = 0; i < width; i++)
+                y[i] = p[2 * i] >> 6;
+            break;
+        case FOURCC_Y10P:
+            // x is a multiple of 4, the row buffer has room for the last group
+            yuv10_unpack(line + yuv10_packed_size(x), y, (width + 3) & ~3, 0);
+            break;
+    }
+}
+
+// chroma for the even luma row, 4:2:2 Y210 averages it with the next row
+static void yuv10_read_chroma(const struct yuv10_src *s, int row, int x, int width,
+            uint16_t *u, uint16_t *v)
+{
+    const int n = (width + 1) / 2;
+    const uint16_t *a, *b;
+
+    switch (s->fourcc) {
+        case FOURCC_Y210:
+            a = (const uint16_t *)(s->plane[0] + row * s->stride[0]) + (x & ~1) * 2;
+            b = row + 1 < s->height ? (const uint16_t *)((const uint8_t *)a + s->stride[0]) : a;
+            for (int i = 0; i < n; i++) {
+                u[i] = (a[4 * i + 1] + b[4 * i + 1] + (1 << 6)) >> 7;
+                v[i] = (a[4 * i + 3] + b[4 * i + 3] + (1 << 6)) >> 7;
+            }
+            break;
+        case FOURCC_Y10P:
+            for (int i = 0; i < n; i++) {
+                u[i] = YUV10_GREY;
+                v[i] = YUV10_GREY;
+            }
+            break;
+    }
+}
+
+
+// P010 keeps the msb alignment, I010 the lsb one, 8 bit formats drop the 2 lsbs
+static void yuv10_write_luma(struct i420_buffer *dst, int row, const uint16_t *y)
+{
+    uint8_t *line = i420_buffer_dataY(dst) + row * dst->stride[0];
+    uint16_t *d = (uint16_t *)line;
+
+    switch (dst->format) {
+        case FOURCC_P010:
+            for (int i = 0; i < dst->width; i++)
+                d[i] = y[i] << 6;
+            break;
+        case FOURCC_I010:
+            memcpy(d, y, dst->width * sizeof(*y));
+            break;
+        default:
+            for (int i = 0; i < dst->width; i++)
+                line[i] = y[i] >> 2;
+            break;
+    }
+}
+
+static void yuv10_write_chroma(struct i420_buffer *dst, int row, const uint16_t *u, const uint16_t *v)
+{
+    const int n = (dst->width + 1) / 2;
+    uint8_t *du = i420_buffer_dataU(dst) + row * dst->stride[1];
+    uint8_t *dv = dst->nplanes == 3 ? i420_buffer_dataV(dst) + row * dst->stride[2] : NULL;
+
+    switch (dst->format) {
+        case FOURCC_P010:
+            for (int i = 0; i < n; i++) {
+                ((uint16_t *)du)[2 * i] = u[i] << 6;
+                ((uint16_t *)du)[2 * i + 1] = v[i] << 6;
+            }
+            break;
+        case FOURCC_I010:
+            memcpy(du, u, n * sizeof(*u));
+            memcpy(dv, v, n * sizeof(*v));
+            break;
+        case FOURCC_NV12:
+            for (int i = 0; i < n; i++) {
+                du[2 * i] = u[i] >> 2;
+                du[2 * i + 1] = v[i] >> 2;
+            }
+            break;
+        default:
+            for (int i = 0; i < n; i++) {
+                du[i] = u[i] >> 2;
+                dv[i] = v[i] >> 2;
+            }
+            break;
+    }
+}
+
+
+/** destination rows [dst_y, dst_y + rows), dst_y even like every stripe */
+static int yuv10_convert_rows(const struct yuv10_src *s, int crop_x, int crop_y,
+            struct i420_buffer *dst, int dst_y, int rows)
+{
+    struct yuv10_rows line;
+
+    if (dst->width > YUV10_MAX_WIDTH) {
+        ALOGE("%s: width %d over %d", __func__, dst->width, YUV10_MAX_WIDTH);
+        return -1;
+    }
+
+    // the row loop is for Y210 and Y10P, P010/I010 go through the libyuv kernels
+    if (s->fourcc == FOURCC_P010 || s->fourcc == FOURCC_I010) {
+        return yuv10_convert_planes16(s->fourcc, s->plane, s->stride, crop_x, crop_y + dst_y,
+                                      dst, dst_y, rows, (uint8_t *)line.y);
+    }
+
+    for (int r = dst_y; r < dst_y + rows; r++) {
+        yuv10_read_luma(s, crop_y + r, crop_x, dst->width, line.y);
+        yuv10_write_luma(dst, r, line.y);
+
+        if ((r & 1) == 0) {
+            yuv10_read_chroma(s, crop_y + r, crop_x, dst->width, line.u, line.v);
+            yuv10_write_chroma(dst, r / 2, line.u, line.v);
+        }
+    }
+    return 0;
+}
+
+
+// planes of a tightly packed source frame
+static void yuv10_tight_src(struct yuv10_src *s, uint32_t fourcc, const uint8_t *src,
+            int width, int height)
+{
+    const int chroma_width = (width + 1) / 2;
+
+    memset(s, 0, sizeof(*s));
+    s->fourcc = fourcc;
+    s->height = height;
+    s->plane[0] = src;
+
+    switch (fourcc) {
+        case FOURCC_P010:
+            s->stride[0] = width * 2;
+            s->stride[1] = chroma_width * 4;
+            s->plane[1] = src + s->stride[0] * height;
+            break;
+        case FOURCC_I010:
+            s->stride[0] = width * 2;
+            s->stride[1] = chroma_width * 2;
+            s->stride[2] = chroma_width * 2;
+            s->plane[1] = src + s->stride[0] * height;
+            s->plane[2] = s->plane[1] + s->stride[1] * ((height + 1) / 2);
+            break;
+        case FOURCC_Y210:
+            s->stride[0] = chroma_width * 8;
+            break;
+        case FOURCC_Y10P:
+            s->stride[0] = yuv10_packed_size(width);
+            break;
+    }
+}
+
+static int yuv10_from_p010(const uint8_t *src, int src_width, int src_height,
+            int crop_x, int crop_y, struct i420_buffer *dst, int dst_y, int rows)
+{
+    struct yuv10_src s;
+
+    yuv10_tight_src(&s, FOURCC_P010, src, src_width, src_height);
+    return yuv10_convert_rows(&s, crop_x, crop_y, dst, dst_y, rows);
+}
+
+static int yuv10_from_i010(const uint8_t *src, int src_width, int src_height,
+            int crop_x, int crop_y, struct i420_buffer *dst, int dst_y, int rows)
+{
+    struct yuv10_src s;
+
+    yuv10_tight_src(&s, FOURCC_I010, src, src_width, src_height);
+    return yuv10_convert_rows(&s, crop_x, crop_y, dst, dst_y, rows);
+}
+
+static int yuv10_from_y210(const uint8_t *src, int src_width, int src_height,
+            int crop_x, int crop_y, struct i420_buffer *dst, int dst_y, int rows)
+{
+    struct yuv10_src s;
+
+    yuv10_tight_src(&s, FOURCC_Y210, src, src_width, src_height);
+    return yuv10_convert_rows(&s, crop_x, crop_y, dst, dst_y, rows);
+}
+
+static int yuv10_from_y10p(const uint8_t *src, int src_width, int src_height,
+            int crop_x, int crop_y, struct i420_buffer *dst, int dst_y, int rows)
+{
+    struct yuv10_src s;
+
+    yuv10_tight_src(&s, FOURCC_Y10P, src, src_width, src_height);
+    return yuv10_convert_rows(&s, crop_x, crop_y, dst, dst_y, rows);
+}
+
+
+i420_convert_fn yuv10_find_converter(uint32_t canonical, uint32_t dst_format)
+{
+    switch (dst_format) {
+        case FOURCC_P010:
+        case FOURCC_I010:
+        case FOURCC_I420:
+        case FOURCC_NV12:
+            break;
+        default:
+            return NULL;
+    }
+
+    switch (canonical) {
+        case FOURCC_P010:
+            return yuv10_from_p010;
+        case FOURCC_I010:
+            return yuv10_from_i010;
+        case FOURCC_Y210:
+            return yuv10_from_y210;
+        case FOURCC_Y10P:
+            return yuv10_from_y10p;
+        default:
+            return NULL;
+    }
+}
+
+
+int yuv10_convert_planes(uint32_t fourcc, uint8_t *const plane[3], const int stride[3],
+            int width, int height, struct i420_buffer *dst)
+{
+    struct yuv10_src s;
+
+    if (yuv10_find_converter(fourcc, dst->format) == NULL) {
+        ALOGE("%s: '%.4s' to '%.4s' unsupported", __func__, (char*)&fourcc, (char*)&dst->format);
+        return -1;
+    }
+
+    if (dst->width > width || dst->height > height) {
+        ALOGE("%s: %dx%d does not fit %dx%d", __func__, dst->width, dst->height, width, height);
+        return -1;
+    }
+
+    s.fourcc = fourcc;
+    s.height = height;
+    for (int i = 0; i < 3; i++) {
+        s.plane[i] = plane[i];
+        s.stride[i] = stride[i];
+    }
+
+    return yuv10_convert_rows(&s, 0, 0, dst, 0, dst->height);
+}
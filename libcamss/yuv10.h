@@ -0,0 +1,55 @@
+#ifndef __YUV10_H__
+#define __YUV10_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "i420.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define YUV10_MAX_WIDTH     8192    /** widest row the converters take, they fail above */
+
+
+/**
+ * 10 bit samples in 16 bit containers, shifted left by shift (0 for
+ * I010, 6 for P010/Y210), from the mipi packing: 4 samples in 5 bytes,
+ * the 8 msbs of each first then their 2 lsbs in one byte. samples is a
+ * multiple of 4.
+ */
+void yuv10_unpack(const uint8_t *src, uint16_t *dst, int samples, int shift);
+
+// bytes of samples in the mipi packing
+size_t yuv10_packed_size(int samples);
+
+
+/**
+ * converter (see i420_convert_fn) from a 10 bit source (P010, I010, Y210,
+ * Y10P) into a FOURCC_P010, I010, I420 or NV12 buffer. into P010/I010 the
+ * 10 bits are kept, into I420/NV12 they are rounded down to 8. NULL if
+ * either side is unsupported.
+ */
+i420_convert_fn yuv10_find_converter(uint32_t canonical, uint32_t dst_format);
+
+// same conversion from strided planes (eg. a camss_frame), whole frame
+int yuv10_convert_planes(uint32_t fourcc, uint8_t *const plane[3], const int stride[3],
+            int width, int height, struct i420_buffer *dst);
+
+/**
+ * P010/I010 part of the converters, rows [dst_y, dst_y + rows) from source
+ * row src_y on, with the libyuv 16 bit kernels. row is scratch of 2 *
+ * YUV10_MAX_WIDTH bytes. in yuv10_planes.c, apart from the fourcc.h users
+ * like fourcc_desc.h
+ */
+int yuv10_convert_planes16(uint32_t fourcc, const uint8_t *const plane[3], const int stride[3],
+            int crop_x, int src_y, struct i420_buffer *dst, int dst_y, int rows, uint8_t *row);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __YUV10_H__ */
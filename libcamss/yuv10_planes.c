@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libyuv.h"
+
+#define LOG_TAG "yuv10"
+#include "liblog.h"
+
+#include "i420.h"
+#include "yuv10.h"
+
+#define YUV10_SCALE_LSB     16384   /** Convert16To8Plane: (v * scale) >> 16, I010 >> 2 */
+#define YUV10_SCALE_MSB     256     /** P010 >> 8, the same 8 msbs */
+
+
+/*
+ * whole stripes through the libyuv 16 bit plane kernels (SSSE3/AVX2/NEON).
+ * 8 bit output drops the 2 lsbs like the row loop in yuv10.c. NV12 from
+ * I010 and I420 from P010 have no single call, their chroma goes a row at
+ * a time through the scratch row. strides of the 16 bit kernels are in
+ * samples, ours in bytes.
+ */
+int yuv10_convert_planes16(uint32_t fourcc, const uint8_t *const plane[3], const int stride[3],
+            int crop_x, int src_y, struct i420_buffer *dst, int dst_y, int rows, uint8_t *row)
+{
+    int ret = 0;
+    const int width = dst->width;
+    const int n = (width + 1) / 2;
+    const int chroma_rows = (rows + 1) / 2;
+    const int ss[3] = { stride[0] / 2, stride[1] / 2, stride[2] / 2 };
+    const int ds[3] = { dst->stride[0], dst->stride[1], dst->stride[2] };
+    const uint16_t *sy = (const uint16_t *)(plane[0] + src_y * stride[0]) + crop_x;
+    const uint16_t *su, *sv;
+    uint8_t *dy = i420_buffer_dataY(dst) + dst_y * ds[0];
+    uint8_t *du = i420_buffer_dataU(dst) + dst_y / 2 * ds[1];
+    uint8_t *dv = dst->nplanes == 3 ? i420_buffer_dataV(dst) + dst_y / 2 * ds[2] : NULL;
+
+    if (fourcc == FOURCC_I010) {
+        su = (const uint16_t *)(plane[1] + src_y / 2 * stride[1]) + crop_x / 2;
+        sv = (const uint16_t *)(plane[2] + src_y / 2 * stride[2]) + crop_x / 2;
+
+        switch (dst->format) {
+            case FOURCC_I010:
+                ret = I010Copy(sy, ss[0], su, ss[1], sv, ss[2], (uint16_t *)dy, ds[0] / 2,
+                               (uint16_t *)du, ds[1] / 2, (uint16_t *)dv, ds[2] / 2, width, rows);
+                break;
+            case FOURCC_P010:
+                ret = I010ToP010(sy, ss[0], su, ss[1], sv, ss[2], (uint16_t *)dy, ds[0] / 2,
+                                 (uint16_t *)du, ds[1] / 2, width, rows);
+                break;
+            case FOURCC_NV12:
+                Convert16To8Plane(sy, ss[0], dy, ds[0], YUV10_SCALE_LSB, width, rows);
+                for (int i = 0; i < chroma_rows; i++) {
+                    Convert16To8Plane(su + i * ss[1], ss[1], row, n, YUV10_SCALE_LSB, n, 1);
+                    Convert16To8Plane(sv + i * ss[2], ss[2], row + n, n, YUV10_SCALE_LSB, n, 1);
+                    MergeUVPlane(row, n, row + n, n, du + i * ds[1], ds[1], n, 1);
+                }
+                break;
+            default:
+                ret = I010ToI420(sy, ss[0], su, ss[1], sv, ss[2], dy, ds[0], du, ds[1], dv, ds[2],
+                                 width, rows);
+                break;
+        }
+    } else if (fourcc == FOURCC_P010) {
+        su = (const uint16_t *)(plane[1] + src_y / 2 * stride[1]) + (crop_x & ~1);
+
+        switch (dst->format) {
+            case FOURCC_P010:
+                CopyPlane_16(sy, ss[0], (uint16_t *)dy, ds[0] / 2, width, rows);
+                CopyPlane_16(su, ss[1], (uint16_t *)du, ds[1] / 2, 2 * n, chroma_rows);
+                break;
+            case FOURCC_I010:
+                ret = P010ToI010(sy, ss[0], su, ss[1], (uint16_t *)dy, ds[0] / 2,
+                                 (uint16_t *)du, ds[1] / 2, (uint16_t *)dv, ds[2] / 2, width, rows);
+                break;
+            case FOURCC_NV12:
+                Convert16To8Plane(sy, ss[0], dy, ds[0], YUV10_SCALE_MSB, width, rows);
+                Convert16To8Plane(su, ss[1], du, ds[1], YUV10_SCALE_MSB, 2 * n, chroma_rows);
+                break;
+            default:
+                Convert16To8Plane(sy, ss[0], dy, ds[0], YUV10_SCALE_MSB, width, rows);
+                for (int i = 0; i < chroma_rows; i++) {
+                    Convert16To8Plane(su + i * ss[1], ss[1], row, 2 * n, YUV10_SCALE_MSB, 2 * n, 1);
+                    SplitUVPlane(row, 2 * n, du + i * ds[1], ds[1], dv + i * ds[2], ds[2], n, 1);
+                }
+                break;
+        }
+    } else {
+        ALOGE("%s: '%.4s' is not P010/I010", __func__, (char*)&fourcc);
+        return -1;
+    }
+
+    return ret ? -1 : 0;
+}
@@ -0,0 +1,268 @@
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#define LOG_TAG "au_pool"
+#include "liblog.h"
+
+#include "au_pool.h"
+
+#define AU_POOL_ALIGN           64      /** every access unit starts on a cache line */
+
+#define ALIGN_UP(x, a)          (((x) + (a) - 1) & ~((size_t)(a) - 1))
+
+
+struct au_pool {
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;       /** signalled when bytes come back */
+
+    uint8_t             *data;      /** the ring */
+    size_t              size;
+    size_t              wr;         /** next free byte */
+
+    struct encoder_au   *aus;       /** in allocation order, head - tail held or waiting for the tail */
+    int                 count;
+    unsigned            head;
+    unsigned            tail;
+
+    struct au_pool_stats stats;
+};
+
+
+void *au_pool_create(size_t size, int count)
+{
+    struct au_pool *pool;
+
+    pool = (struct au_pool *)calloc(1, sizeof(*pool));
+    if (pool == NULL) {
+        ALOGE("%s: Failed to allocate pool", __func__);
+        return NULL;
+    }
+
+    pool->size = ALIGN_UP(size, AU_POOL_ALIGN);
+    pool->count = count;
+
+    pool->aus = (struct encoder_au *)calloc(count, sizeof(struct encoder_au));
+    if (pool->aus == NULL)
+        goto bail;
+
+    if (posix_memalign((void **)&pool->data, AU_POOL_ALIGN, pool->size) != 0) {
+        pool->data = NULL;
+        goto bail;
+    }
+
+    // fault the pages in now rather than on the first keyframes
+    memset(pool->data, 0, pool->size);
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    ALOGD("%s: %zu bytes, %d access units", __func__, pool->size, count);
+    return pool;
+
+bail:
+    ALOGE("%s: Failed to allocate %zu bytes / %d access units", __func__, size, count);
+    free(pool->aus);
+    free(pool);
+    return NULL;
+}
+
+
+void au_pool_destroy(void *handle)
+{
+    struct au_pool *pool = (struct au_pool *)handle;
+
+    if (pool == NULL)
+        return;
+
+    if (pool->head != pool->tail) {
+        ALOGE("%s: %u access units still held, leaking pool", __func__, pool->head - pool->tail);
+        return;
+    }
+
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->data);
+    free(pool->aus);
+    free(pool);
+}
+
+
+// place n bytes after wr, wrapping to 0 when the end is too short. the
+// skipped end goes into the span of the access unit so it comes back with it
+static int au_pool_alloc(struct au_pool *pool, size_t n, size_t *start, size_t *offset, size_t *span)
+{
+    size_t rd;
+
+    if (pool->head - pool->tail == (unsigned)pool->count)
+        return -1;
+
+    if (pool->head == pool->tail) {
+        pool->wr = 0;
+        rd = 0;
+    } else {
+        rd = pool->aus[pool->tail % pool->count].start;
+    }
+
+    if (pool->head == pool->tail || pool->wr > rd) {
+        // free: [wr, size) and [0, rd)
+        if (pool->size - pool->wr >= n) {
+            *offset = pool->wr;
+            *span = n;
+        } else if (n <= rd) {
+            *offset = 0;
+            *span = pool->size - pool->wr + n;
+        } else {
+            return -1;
+        }
+    } else if (pool->wr < rd && rd - pool->wr >= n) {
+        // free: [wr, rd)
+        *offset = pool->wr;
+        *span = n;
+    } else {
+        return -1;
+    }
+
+    *start = pool->wr;
+    pool->wr = *offset + n;
+    return 0;
+}
+
+
+struct encoder_au *au_pool_copy(void *handle, const struct encoder_frame *frame, int timeout_ms)
+{
+    int ret;
+    size_t n;
+    size_t nals_size;
+    size_t start, offset, span;
+    uint8_t *p;
+    struct encoder_nal *nals;
+    struct encoder_au *au;
+    struct timespec deadline;
+    struct au_pool *pool = (struct au_pool *)handle;
+
+    // the nal table ahead of the payload, both in the ring
+    nals_size = ALIGN_UP(frame->nnals * sizeof(struct encoder_nal), sizeof(void *));
+    n = ALIGN_UP(nals_size + frame->size, AU_POOL_ALIGN);
+    if (n > pool->size) {
+        ALOGE("%s: %d byte access unit does not fit a %zu byte pool", __func__, frame->size, pool->size);
+        return NULL;
+    }
+
+    if (timeout_ms > 0) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    pthread_mutex_lock(&pool->lock);
+
+    ret = au_pool_alloc(pool, n, &start, &offset, &span);
+    if (ret < 0 && timeout_ms != 0) {
+        pool->stats.waited++;
+        do {
+            if (timeout_ms < 0) {
+                pthread_cond_wait(&pool->cond, &pool->lock);
+            } else if (pthread_cond_timedwait(&pool->cond, &pool->lock, &deadline) == ETIMEDOUT) {
+                ret = au_pool_alloc(pool, n, &start, &offset, &span);
+                break;
+            }
+            ret = au_pool_alloc(pool, n, &start, &offset, &span);
+        } while (ret < 0);
+    }
+
+    if (ret < 0) {
+        pool->stats.exhausted++;
+        pthread_mutex_unlock(&pool->lock);
+        return NULL;
+    }
+
+    au = &pool->aus[pool->head++ % pool->count];
+    au->start = start;
+    au->span = span;
+    au->refcnt = 1;
+
+    pool->stats.copied++;
+    pool->stats.in_use++;
+    pool->stats.bytes_used += span;
+    if (pool->stats.bytes_used > pool->stats.bytes_high_water)
+        pool->stats.bytes_high_water = pool->stats.bytes_used;
+
+    pthread_mutex_unlock(&pool->lock);
+
+    // the bytes are ours now, copy outside the lock
+    p = pool->data + offset;
+    nals = (struct encoder_nal *)p;
+    memcpy(p + nals_size, frame->data, frame->size);
+    for (int i = 0; i < frame->nnals; i++) {
+        nals[i].type = frame->nals[i].type;
+        nals[i].data = p + nals_size + (frame->nals[i].data - frame->data);
+        nals[i].size = frame->nals[i].size;
+    }
+
+    au->pool = pool;
+    au->data = p + nals_size;
+    au->size = frame->size;
+    au->nals = nals;
+    au->nnals = frame->nnals;
+    au->pts = frame->pts;
+    au->dts = frame->dts;
+    au->keyframe = frame->keyframe;
+    au->latency = frame->latency;
+    au->tag = frame->tag;
+    return au;
+}
+
+
+struct encoder_au *encoder_au_ref(struct encoder_au *au)
+{
+    __atomic_add_fetch(&au->refcnt, 1, __ATOMIC_RELAXED);
+    return au;
+}
+
+
+void encoder_au_unref(struct encoder_au *au)
+{
+    struct encoder_au *oldest;
+    struct au_pool *pool = (struct au_pool *)au->pool;
+
+    if (__atomic_sub_fetch(&au->refcnt, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+
+    pool->stats.in_use--;
+
+    // the ring only moves past access units nobody holds, in order
+    while (pool->tail != pool->head) {
+        oldest = &pool->aus[pool->tail % pool->count];
+        if (__atomic_load_n(&oldest->refcnt, __ATOMIC_ACQUIRE) != 0)
+            break;
+        pool->stats.bytes_used -= oldest->span;
+        pool->tail++;
+    }
+
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+int au_pool_get_stats(void *handle, struct au_pool_stats *stats)
+{
+    struct au_pool *pool = (struct au_pool *)handle;
+
+    pthread_mutex_lock(&pool->lock);
+    *stats = pool->stats;
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
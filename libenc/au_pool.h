@@ -0,0 +1,83 @@
+#ifndef __AU_POOL_H__
+#define __AU_POOL_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "encoder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * an encoded access unit in an au_pool, shared by its consumers (muxer,
+ * network senders, recorder). read-only, valid while a reference is held;
+ * the last unref gives its bytes back to the pool.
+ */
+struct encoder_au {
+    int                         refcnt;     /** atomic, use encoder_au_ref/unref */
+    void                        *pool;
+
+    const uint8_t               *data;      /** the nals back to back, as encoder_frame */
+    int                         size;
+    const struct encoder_nal    *nals;      /** over data */
+    int                         nnals;
+
+    int64_t                     pts;
+    int64_t                     dts;
+    int                         keyframe;
+    int64_t                     latency;
+    intptr_t                    tag;
+
+    /** pool private */
+    size_t                      start;
+    size_t                      span;
+};
+
+struct au_pool_stats {
+    uint64_t    copied;         /** access units put in */
+    uint64_t    exhausted;      /** au_pool_copy calls that found no room in time */
+    uint64_t    waited;         /** au_pool_copy calls that had to wait for room */
+    int         in_use;         /** access units held */
+    size_t      bytes_used;
+    size_t      bytes_high_water;
+};
+
+
+/**
+ * pool of count access units over one contiguous ring of size bytes,
+ * allocated and touched once. bytes come back in the order they were
+ * handed out: an access unit still held keeps the ones after it from
+ * being reused, so size it for the longest a consumer holds on (eg. a
+ * sender's retransmit window).
+ */
+void *au_pool_create(size_t size, int count);
+
+// access units still held at destroy are leaked with the pool, not freed under their users
+void au_pool_destroy(void *handle);
+
+/**
+ * copy frame (valid only until the next encoder call) into the pool, the
+ * one copy out of the codec's buffers; returns it with one reference.
+ * when the pool is full wait up to timeout_ms for consumers to let go
+ * (< 0: for ever, 0: not at all) and return NULL if they do not: the
+ * caller drops the frame or stalls the encoder, the backpressure.
+ */
+struct encoder_au *au_pool_copy(void *handle, const struct encoder_frame *frame, int timeout_ms);
+
+// take a reference, returns au
+struct encoder_au *encoder_au_ref(struct encoder_au *au);
+
+// drop a reference, the last one frees its bytes in the pool
+void encoder_au_unref(struct encoder_au *au);
+
+int au_pool_get_stats(void *handle, struct au_pool_stats *stats);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AU_POOL_H__ */
@@ -0,0 +1,582 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#define LOG_TAG "encoder"
+#include "liblog.h"
+
+#include "utils.h"
+#include "fourcc.h"
+#include "frame.h"
+#include "ring.h"
+#include "encoder.h"
+
+#define ENCODER_MAX_INFLIGHT    512     /** frames inside a codec at once, above any lookahead + threads */
+
+
+struct encoder_context {
+    const struct encoder_ops    *ops;
+    void                        *ctx;
+    void                        *old;       /** instance before a re-open, until drained */
+    struct encoder_config       config;
+    int                         keyframe;   /** requested for the next frame */
+
+    int64_t                     starts[ENCODER_MAX_INFLIGHT];  /** latency start by picture tag */
+    unsigned                    next_start;
+};
+
+static const struct encoder_ops *kEncoders[] = {
+    &libx264_ops,
+    &libx265_ops,
+    &libvpx_vp8_ops,
+    &libvpx_vp9_ops,
+};
+
+
+const struct encoder_ops *encoder_find(const char *name)
+{
+    for (size_t i = 0; i < sizeof(kEncoders) / sizeof(kEncoders[0]); i++) {
+        if (strcmp(kEncoders[i]->name, name) == 0)
+            return kEncoders[i];
+    }
+    return NULL;
+}
+
+
+void *encoder_open(const char *name, const struct encoder_config *config)
+{
+    struct encoder_context *e;
+    const struct encoder_ops *ops = encoder_find(name);
+
+    if (ops == NULL) {
+        ALOGE("%s: no encoder '%s'", __func__, name);
+        return NULL;
+    }
+
+    e = (struct encoder_context *)calloc(1, sizeof(*e));
+    if (e == NULL) {
+        ALOGE("%s: Failed to allocate context", __func__);
+        return NULL;
+    }
+
+    e->ops = ops;
+    e->config = *config;
+    if (e->config.format == 0)
+        e->config.format = FOURCC_I420;
+
+    e->ctx = ops->init(&e->config);
+    if (e->ctx == NULL) {
+        free(e);
+        return NULL;
+    }
+
+    return e;
+}
+
+// latency of the input the access unit came from
+static int encoder_output(struct encoder_context *e, int ret, struct encoder_frame *out)
+{
+    if (ret > 0)
+        out->latency = (int64_t)nowUs() - e->starts[out->tag % ENCODER_MAX_INFLIGHT];
+    return ret;
+}
+
+static int encoder_fits(const struct encoder_config *config, const struct encoder_picture *pic)
+{
+    return pic->format == config->format &&
+           pic->width == config->width && pic->height == config->height;
+}
+
+// pic into the current instance, leaves one still draining alone
+static int encoder_submit(struct encoder_context *e, struct encoder_picture *pic, int64_t start,
+                          struct encoder_frame *out)
+{
+    unsigned slot;
+
+    if (!encoder_fits(&e->config, pic)) {
+        ALOGE("%s: '%.4s' %dx%d input, %s is '%.4s' %dx%d", __func__,
+              (char*)&pic->format, pic->width, pic->height, e->ops->name,
+              (char*)&e->config.format, e->config.width, e->config.height);
+        return -1;
+    }
+
+    slot = e->next_start++ % ENCODER_MAX_INFLIGHT;
+    e->starts[slot] = start;
+    pic->tag = slot;
+    pic->keyframe = e->keyframe;
+    e->keyframe = 0;
+
+    return encoder_output(e, e->ops->encode(e->ctx, pic, out), out);
+}
+
+static int encoder_run(struct encoder_context *e, struct encoder_picture *pic, int64_t start,
+                       struct encoder_frame *out)
+{
+    if (e->old) {
+        ALOGW("%s: %s re-opened without a flush, the frames it held are lost", __func__, e->ops->name);
+        e->ops->close(e->old);
+        e->old = NULL;
+    }
+
+    return encoder_submit(e, pic, start, out);
+}
+
+int encoder_encode(void *handle, struct i420_buffer *in, int64_t pts, struct encoder_frame *out)
+{
+    struct encoder_picture pic;
+    struct encoder_context *e = (struct encoder_context *)handle;
+
+    pic.format = in->format;
+    pic.width = in->width;
+    pic.height = in->height;
+    for (int i = 0; i < 3; i++) {
+        pic.plane[i] = i420_buffer_plane(in, i);
+        pic.stride[i] = in->stride[i];
+    }
+    pic.pts = pts;
+
+    return encoder_run(e, &pic, nowUs(), out);
+}
+
+static void encoder_frame_picture(struct camss_frame *frame, struct encoder_picture *pic)
+{
+    pic->format = frame->format;
+    pic->width = frame->width;
+    pic->height = frame->height;
+    memcpy(pic->plane, frame->plane, sizeof(pic->plane));
+    memcpy(pic->stride, frame->stride, sizeof(pic->stride));
+    pic->pts = frame->meta.timestamp;
+}
+
+int encoder_encode_frame(void *handle, struct camss_frame *frame, struct encoder_frame *out)
+{
+    struct encoder_picture pic;
+    struct encoder_context *e = (struct encoder_context *)handle;
+
+    encoder_frame_picture(frame, &pic);
+    return encoder_run(e, &pic, frame->meta.recv_time, out);
+}
+
+int encoder_flush(void *handle, struct encoder_frame *out)
+{
+    int ret;
+    struct encoder_context *e = (struct encoder_context *)handle;
+
+    // after a re-open only the old instance is drained, the new one goes on
+    if (e->old) {
+        ret = e->ops->flush(e->old, out);
+        if (ret <= 0) {
+            e->ops->close(e->old);
+            e->old = NULL;
+        }
+        return encoder_output(e, ret, out);
+    }
+
+    return encoder_output(e, e->ops->flush(e->ctx, out), out);
+}
+
+static int encoder_same_profile(const char *a, const char *b)
+{
+    if (a == NULL || b == NULL)
+        return a == b;
+    return strcmp(a, b) == 0;
+}
+
+/**
+ * c (format filled in) to the running instance where the codec can take
+ * it: 0 applied, 1 it needs an instance opened with c, < 0 on error
+ */
+static int encoder_reconfigure_in_place(struct encoder_context *e, struct encoder_config *c)
+{
+    int ret = 1;
+
+    if (c->format == 0)
+        c->format = FOURCC_I420;
+
+    // only the rate can change in place, the codec says if it can do that
+    if (c->width == e->config.width && c->height == e->config.height &&
+        c->format == e->config.format && c->preset == e->config.preset &&
+        c->threads == e->config.threads && encoder_same_profile(c->profile, e->config.profile)) {
+        ret = e->ops->reconfigure(e->ctx, c);
+        if (ret < 0)
+            return -1;
+    }
+
+    if (ret == 0)
+        e->config = *c;
+    return ret;
+}
+
+// ctx opened with c takes the next frame, the current instance drains as old
+static void encoder_switch(struct encoder_context *e, void *ctx, const struct encoder_config *c)
+{
+    // a fresh encoder starts with an IDR so the stream switches without a gap
+    e->old = e->ctx;
+    e->ctx = ctx;
+    e->config = *c;
+    e->keyframe = 0;
+    ALOGD("%s: %s re-opened %dx%d, %d kbps", __func__, e->ops->name,
+          c->width, c->height, c->bitrate);
+}
+
+int encoder_reconfigure(void *handle, const struct encoder_config *config)
+{
+    int ret;
+    void *ctx;
+    struct encoder_config c = *config;
+    struct encoder_context *e = (struct encoder_context *)handle;
+
+    ret = encoder_reconfigure_in_place(e, &c);
+    if (ret <= 0)
+        return ret;
+
+    if (e->old) {
+        ALOGE("%s: %s is still draining the last re-open", __func__, e->ops->name);
+        return -1;
+    }
+
+    // the old instance stays up until the new one is there
+    ctx = e->ops->init(&c);
+    if (ctx == NULL)
+        return -1;
+
+    encoder_switch(e, ctx, &c);
+    return 1;
+}
+
+void encoder_request_keyframe(void *handle)
+{
+    struct encoder_context *e = (struct encoder_context *)handle;
+
+    e->keyframe = 1;
+}
+
+void encoder_close(void *handle)
+{
+    struct encoder_context *e = (struct encoder_context *)handle;
+
+    if (e == NULL)
+        return;
+
+    if (e->old)
+        e->ops->close(e->old);
+    e->ops->close(e->ctx);
+    free(e);
+}
+
+
+
+struct encoder_async {
+    struct encoder_context *encoder;
+    void                *ring;          /** capture -> encoder thread */
+    pthread_t           thread;
+    int                 quit;           /** atomic */
+
+    pthread_mutex_t     lock;           /** guards config */
+    struct encoder_config config;       /** from encoder_async_reconfigure */
+    int                 reconfigure;    /** atomic, config is pending */
+    int                 keyframe;       /** atomic */
+
+    /** re-open in flight on the opener thread, see encoder_async_control */
+    int                 opening;        /** encoder thread only */
+    pthread_t           opener;
+    struct encoder_config open_config;
+    void                *opened;        /** the new instance, NULL if init failed */
+    int                 open_done;      /** atomic, opened is set */
+
+    encoder_output_cb   callback;
+    void                *opaque;
+
+    /** atomic, written by the encoder thread */
+    uint64_t            encoded;
+    uint64_t            errors;
+    int64_t             latency_last;
+    int64_t             latency_max;
+    int64_t             latency_sum;
+};
+
+
+static void encoder_frame_drop(void *item)
+{
+    camss_frame_unref((struct camss_frame *)item);
+}
+
+static void encoder_async_output(struct encoder_async *a, const struct encoder_frame *out)
+{
+    __atomic_store_n(&a->latency_last, out->latency, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&a->latency_sum, out->latency, __ATOMIC_RELAXED);
+    if (out->latency > a->latency_max)
+        __atomic_store_n(&a->latency_max, out->latency, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&a->encoded, 1, __ATOMIC_RELAXED);
+
+    a->callback(a->opaque, out);
+}
+
+// init of a re-open, hundreds of ms for x265, away from the encoder thread
+static void *encoder_async_opener(void *data)
+{
+    struct encoder_async *a = (struct encoder_async *)data;
+
+    a->opened = a->encoder->ops->init(&a->open_config);
+    __atomic_store_n(&a->open_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// one access unit of the instance before a re-open, 0 once it is drained and closed
+static int encoder_async_drain_step(struct encoder_async *a)
+{
+    int ret;
+    struct encoder_frame out;
+
+    if (a->encoder->old == NULL)
+        return 0;
+
+    ret = encoder_flush(a->encoder, &out);
+    if (ret < 0) {
+        __atomic_add_fetch(&a->errors, 1, __ATOMIC_RELAXED);
+    } else if (ret > 0) {
+        encoder_async_output(a, &out);
+    }
+    return ret > 0;
+}
+
+static void encoder_async_drain(struct encoder_async *a)
+{
+    while (encoder_async_drain_step(a))
+        ;
+}
+
+/**
+ * the opened instance takes over once the opener is done and the one before
+ * it is drained. wait: block for both, for a frame only the new one fits
+ */
+static void encoder_async_switch(struct encoder_async *a, int wait)
+{
+    if (!a->opening)
+        return;
+
+    if (!wait && (!__atomic_load_n(&a->open_done, __ATOMIC_ACQUIRE) || a->encoder->old))
+        return;
+
+    encoder_async_drain(a);
+    pthread_join(a->opener, NULL);
+    a->opening = 0;
+    a->open_done = 0;
+
+    if (a->opened == NULL) {
+        __atomic_add_fetch(&a->errors, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    encoder_switch(a->encoder, a->opened, &a->open_config);
+    a->opened = NULL;
+}
+
+/**
+ * what encoder_async_reconfigure/request_keyframe left, before pic. a
+ * re-open is started on the opener thread and the current instance keeps
+ * encoding, it switches at the first frame boundary after the open
+ */
+static void encoder_async_control(struct encoder_async *a, const struct encoder_picture *pic)
+{
+    int ret;
+    struct encoder_config config;
+
+    // a config that comes during an open waits for it, a later one replaces it
+    if (!a->opening && __atomic_exchange_n(&a->reconfigure, 0, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&a->lock);
+        config = a->config;
+        pthread_mutex_unlock(&a->lock);
+
+        ret = encoder_reconfigure_in_place(a->encoder, &config);
+        if (ret < 0) {
+            __atomic_add_fetch(&a->errors, 1, __ATOMIC_RELAXED);
+        } else if (ret > 0) {
+            a->open_config = config;
+            a->opened = NULL;
+            if (pthread_create(&a->opener, NULL, encoder_async_opener, a)) {
+                ALOGE("%s: failed to create opener thread", __func__);
+                __atomic_add_fetch(&a->errors, 1, __ATOMIC_RELAXED);
+            } else {
+                a->opening = 1;
+            }
+        }
+    }
+
+    // eg. the first frame at a new size: nothing but the new instance can take it
+    encoder_async_switch(a, a->opening && !encoder_fits(&a->encoder->config, pic) &&
+                            encoder_fits(&a->open_config, pic));
+
+    if (__atomic_exchange_n(&a->keyframe, 0, __ATOMIC_RELAXED))
+        encoder_request_keyframe(a->encoder);
+}
+
+static void encoder_async_encode(struct encoder_async *a, struct camss_frame *frame)
+{
+    int ret;
+    struct encoder_picture pic;
+    struct encoder_frame out;
+
+    encoder_frame_picture(frame, &pic);
+    encoder_async_control(a, &pic);
+
+    // the instance before a re-open gives one access unit per frame, so its
+    // lookahead drains over the frames the new one takes to fill its own
+    encoder_async_drain_step(a);
+
+    ret = encoder_submit(a->encoder, &pic, frame->meta.recv_time, &out);
+    camss_frame_unref(frame);
+
+    if (ret < 0) {
+        __atomic_add_fetch(&a->errors, 1, __ATOMIC_RELAXED);
+    } else if (ret > 0) {
+        // out stays valid while the other instance is flushed, its frames go first
+        encoder_async_drain(a);
+        encoder_async_output(a, &out);
+    }
+}
+
+static void *encoder_async_thread(void *data)
+{
+    struct camss_frame *frame;
+    struct encoder_async *a = (struct encoder_async *)data;
+
+    while (!__atomic_load_n(&a->quit, __ATOMIC_ACQUIRE)) {
+        ring_wait(a->ring);
+
+        while ((frame = ring_pop(a->ring)) != NULL) {
+            encoder_async_encode(a, frame);
+        }
+    }
+
+    return NULL;
+}
+
+
+void *encoder_async_create(const char *name, const struct encoder_config *config,
+            int depth, int policy, encoder_output_cb callback, void *opaque)
+{
+    struct encoder_async *a;
+
+    a = (struct encoder_async *)calloc(1, sizeof(*a));
+    if (a == NULL) {
+        ALOGE("%s: Failed to allocate context", __func__);
+        return NULL;
+    }
+
+    a->callback = callback;
+    a->opaque = opaque;
+    pthread_mutex_init(&a->lock, NULL);
+
+    a->encoder = encoder_open(name, config);
+    if (a->encoder == NULL)
+        goto bail;
+
+    a->ring = ring_create(depth, policy, encoder_frame_drop);
+    if (a->ring == NULL)
+        goto bail;
+
+    if (pthread_create(&a->thread, NULL, encoder_async_thread, a)) {
+        ALOGE("%s: failed to create encoder thread", __func__);
+        goto bail;
+    }
+
+    return a;
+
+bail:
+    ring_destroy(a->ring);
+    encoder_close(a->encoder);
+    pthread_mutex_destroy(&a->lock);
+    free(a);
+    return NULL;
+}
+
+
+void encoder_async_submit(void *handle, struct camss_frame *frame)
+{
+    struct encoder_async *a = (struct encoder_async *)handle;
+
+    ring_push(a->ring, camss_frame_ref(frame));
+}
+
+
+void encoder_async_destroy(void *handle)
+{
+    int ret;
+    struct camss_frame *frame;
+    struct encoder_frame out;
+    struct encoder_async *a = (struct encoder_async *)handle;
+
+    if (a == NULL)
+        return;
+
+    __atomic_store_n(&a->quit, 1, __ATOMIC_RELEASE);
+    ring_wakeup(a->ring);
+    pthread_join(a->thread, NULL);
+
+    // the thread is gone, finish its queue and what the codec still holds here
+    while ((frame = ring_pop(a->ring)) != NULL) {
+        encoder_async_encode(a, frame);
+    }
+
+    // an open no frame was left for
+    if (a->opening) {
+        pthread_join(a->opener, NULL);
+        if (a->opened)
+            a->encoder->ops->close(a->opened);
+    }
+
+    encoder_async_drain(a);
+    while ((ret = encoder_flush(a->encoder, &out)) > 0) {
+        encoder_async_output(a, &out);
+    }
+
+    ring_destroy(a->ring);
+    encoder_close(a->encoder);
+    pthread_mutex_destroy(&a->lock);
+    free(a);
+}
+
+
+int encoder_async_get_stats(void *handle, struct encoder_async_stats *stats)
+{
+    struct ring_stats rs;
+    struct encoder_async *a = (struct encoder_async *)handle;
+
+    ring_get_stats(a->ring, &rs);
+
+    stats->submitted = rs.pushed;
+    stats->dropped = rs.dropped_oldest + rs.dropped_newest;
+    stats->encoded = __atomic_load_n(&a->encoded, __ATOMIC_RELAXED);
+    stats->errors = __atomic_load_n(&a->errors, __ATOMIC_RELAXED);
+    stats->latency_last = __atomic_load_n(&a->latency_last, __ATOMIC_RELAXED);
+    stats->latency_max = __atomic_load_n(&a->latency_max, __ATOMIC_RELAXED);
+    stats->latency_avg = stats->encoded ?
+        __atomic_load_n(&a->latency_sum, __ATOMIC_RELAXED) / (int64_t)stats->encoded : 0;
+    return 0;
+}
+
+
+int encoder_async_reconfigure(void *handle, const struct encoder_config *config)
+{
+    struct encoder_async *a = (struct encoder_async *)handle;
+
+    pthread_mutex_lock(&a->lock);
+    a->config = *config;
+    pthread_mutex_unlock(&a->lock);
+
+    __atomic_store_n(&a->reconfigure, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+
+void encoder_async_request_keyframe(void *handle)
+{
+    struct encoder_async *a = (struct encoder_async *)handle;
+
+    __atomic_store_n(&a->keyframe, 1, __ATOMIC_RELAXED);
+}
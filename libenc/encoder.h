@@ -0,0 +1,192 @@
+#ifndef __ENCODER_H__
+#define __ENCODER_H__
+
+#include <stdint.h>
+
+#include "i420.h"
+#include "frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** threading and delay trade-off, see encoder_open */
+enum encoder_preset {
+    ENCODER_PRESET_DEFAULT = 0, /** codec defaults */
+    ENCODER_PRESET_LOWLATENCY,  /** in-frame threading, no lookahead/b-frames: a frame out per frame in */
+    ENCODER_PRESET_THROUGHPUT,  /** frame threads and lookahead for recording, output lags */
+};
+
+struct encoder_config {
+    int         width;
+    int         height;
+    int         fps_num;        /** nominal frame rate fps_num / fps_den, 0: 25 */
+    int         fps_den;
+    int         bitrate;        /** kbps average, 0: constant quality */
+    int         keyint;         /** max frames between keyframes, 0: codec default */
+    uint32_t    format;         /** input FOURCC_I420, NV12 or I010 (10 bit), 0: I420 */
+    const char  *profile;       /** codec profile name, NULL: the best one for format */
+    int         preset;         /** enum encoder_preset */
+    int         threads;        /** 0: one per core */
+};
+
+/** one NAL unit (annex b start code included), or a whole frame for vpx */
+struct encoder_nal {
+    int             type;       /** nal_unit_type of the codec, vpx: VPX_FRAME_IS_* flags */
+    const uint8_t   *data;
+    int             size;
+};
+
+/** input picture, only read during encode */
+struct encoder_picture {
+    uint32_t        format;
+    int             width;
+    int             height;
+    uint8_t         *plane[3];
+    int             stride[3];
+    int64_t         pts;        /** us */
+    int             keyframe;   /** force a keyframe (IDR) */
+    intptr_t        tag;        /** handed back in encoder_frame.tag */
+};
+
+/**
+ * one encoded access unit. the nals sit back to back from data inside the
+ * encoder and stay valid until the next call on it, au_pool_copy (au_pool.h)
+ * it to share it past that.
+ */
+struct encoder_frame {
+    const uint8_t               *data;
+    int                         size;
+    const struct encoder_nal    *nals;
+    int                         nnals;
+
+    int64_t                     pts;        /** of the input, us */
+    int64_t                     dts;        /** below pts when b-frames reorder */
+    int                         keyframe;
+    int64_t                     latency;    /** us from capture (encoder_encode_frame) or the encode call */
+    intptr_t                    tag;        /** of the input picture */
+};
+
+
+/**
+ * a codec backend. encode/flush return 1 with an access unit in out, 0 if
+ * none is ready (lookahead, b-frames; for flush: drained), < 0 on error.
+ * reconfigure gets a config that differs from the open one at most in
+ * bitrate, fps and keyint: 0 when applied on the fly, 1 if the codec has to
+ * be opened again for it, < 0 on error.
+ */
+struct encoder_ops {
+    const char  *name;
+    void        *(*init)(const struct encoder_config *config);
+    int         (*encode)(void *ctx, const struct encoder_picture *pic, struct encoder_frame *out);
+    int         (*flush)(void *ctx, struct encoder_frame *out);
+    int         (*reconfigure)(void *ctx, const struct encoder_config *config);
+    void        (*close)(void *ctx);
+};
+
+/** backends, see encoder_find */
+extern const struct encoder_ops libx264_ops;    /** "x264", H.264 */
+extern const struct encoder_ops libx265_ops;    /** "x265", HEVC, 10 bit from I010 */
+extern const struct encoder_ops libvpx_vp8_ops; /** "vp8" */
+extern const struct encoder_ops libvpx_vp9_ops; /** "vp9", 10 bit (profile 2) from I010 */
+
+// backend by name, NULL if not built in
+const struct encoder_ops *encoder_find(const char *name);
+
+
+/**
+ * open codec name with config. LOWLATENCY threads inside each frame
+ * (x264 sliced threads, x265 wpp, vp9 row-mt + tile columns) with no
+ * lookahead or b-frames, for interactive streams. THROUGHPUT keeps several
+ * frames in flight (frame threads, x265 frame parallelism + wpp, vpx
+ * alt-ref lag) with rate control lookahead, for recording.
+ */
+void *encoder_open(const char *name, const struct encoder_config *config);
+
+/**
+ * encode in, pts in us (eg. camss_frame_meta.timestamp). the codec picture
+ * planes point straight at in's planes, there is no copy into an encoder
+ * owned picture, and in can be reused once this returns.
+ */
+int encoder_encode(void *handle, struct i420_buffer *in, int64_t pts, struct encoder_frame *out);
+
+// encoder_encode on the image planes of a captured frame (passthrough,
+// converted or a crop view), pts from its capture timestamp. the caller
+// keeps its reference
+int encoder_encode_frame(void *handle, struct camss_frame *frame, struct encoder_frame *out);
+
+// at end of stream, call until 0 for the frames the codec holds back
+int encoder_flush(void *handle, struct encoder_frame *out);
+
+/**
+ * change the config of a running encoder. bitrate, fps and keyint go to
+ * the codec in place where it can take them (x264/x265 reconfig, vpx
+ * config_set) and return 0, the next frame is encoded with them.
+ * anything else (size, format, profile, preset, threads, or a codec that
+ * cannot) opens a second instance with config and returns 1: its first
+ * frame is an IDR, and the old instance is kept until encoder_flush
+ * returned 0 for the frames it still holds, call it before the next
+ * encode. < 0 and the encoder goes on as it was.
+ */
+int encoder_reconfigure(void *handle, const struct encoder_config *config);
+
+// the next frame is coded as a keyframe (IDR), eg. on a receiver's request
+void encoder_request_keyframe(void *handle);
+
+void encoder_close(void *handle);
+
+
+/**
+ * called on the encoder thread for every access unit, valid during the
+ * call. an au_pool_copy with a timeout here holds the encoder back when
+ * consumers fall behind, the queue policy then drops pictures, not bits.
+ */
+typedef void (*encoder_output_cb)(void *opaque, const struct encoder_frame *frame);
+
+struct encoder_async_stats {
+    uint64_t    submitted;
+    uint64_t    dropped;        /** by the queue policy */
+    uint64_t    encoded;        /** access units out */
+    uint64_t    errors;
+    int64_t     latency_last;   /** us, capture to access unit */
+    int64_t     latency_max;
+    int64_t     latency_avg;
+};
+
+/**
+ * encoder on its own thread behind a queue of depth frames, so capture
+ * keeps its cadence while the codec uses every core. policy (enum
+ * ring_policy, ring.h) applies when the encoder falls behind,
+ * RING_DROP_OLDEST keeps the newest pictures for live streams.
+ */
+void *encoder_async_create(const char *name, const struct encoder_config *config,
+            int depth, int policy, encoder_output_cb callback, void *opaque);
+
+// a camss_frame_cb: takes its own frame reference, pass to camss_add_consumer
+void encoder_async_submit(void *handle, struct camss_frame *frame);
+
+// encodes what is queued, drains the encoder and joins the thread
+void encoder_async_destroy(void *handle);
+
+int encoder_async_get_stats(void *handle, struct encoder_async_stats *stats);
+
+/**
+ * encoder_reconfigure on the encoder thread, before the next queued frame.
+ * a re-open initializes the new instance on a helper thread while the old
+ * one keeps encoding, and switches at the first frame after that (at once
+ * for a frame only the new config fits, eg. a new size). the old instance
+ * then gives out one held frame per frame, all of them ahead of the new
+ * one's. a later call replaces one not applied yet, profile must stay
+ * valid until then
+ */
+int encoder_async_reconfigure(void *handle, const struct encoder_config *config);
+
+void encoder_async_request_keyframe(void *handle);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ENCODER_H__ */
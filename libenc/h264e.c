@@ -1,5 +0,0 @@
-
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <stdint.h>
@@ -0,0 +1,421 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+
+#include "vpx/vpx_encoder.h"
+#include "vpx/vp8cx.h"
+
+#define LOG_TAG "vpx"
+#include "liblog.h"
+
+#include "fourcc.h"
+#include "encoder.h"
+
+#define VPX_MAX_LAG         32      /** frames libvpx may hold, the lag is capped to this */
+#define VPX_TILE_MIN_WIDTH  256     /** narrowest vp9 tile column */
+
+struct vpx_tag {
+    int64_t             pts;
+    intptr_t            tag;
+};
+
+struct vpx_context {
+    vpx_codec_ctx_t     codec;
+    int                 inited;     // codec needs vpx_codec_destroy
+    vpx_codec_enc_cfg_t cfg;        // enc param
+    int                 vp9;
+    unsigned            kf_max_dist;    // codec default, for keyint 0
+
+    vpx_image_t         img;        // input, planes rebound to every buffer
+    unsigned long       deadline;   // VPX_DL_*
+    unsigned long       duration;   // of one frame, in the us timebase
+
+    // tags of the pictures inside the codec, vpx gives the pts back but no opaque
+    struct vpx_tag      tags[VPX_MAX_LAG + 1];
+    unsigned            tag_head;
+    unsigned            tag_tail;
+
+    struct encoder_nal  *nals;      // last output
+    int                 maxnals;
+    uint8_t             *buf;       // last output when it took several packets
+    size_t              bufsize;
+};
+
+
+static void libvpx_close(void *handle);
+
+static int libvpx_log2(int n)
+{
+    int log2 = 0;
+
+    while ((2 << log2) <= n)
+        log2++;
+    return log2;
+}
+
+// of one frame in us
+static unsigned long libvpx_duration(const struct encoder_config *config)
+{
+    return 1000000LL * (config->fps_den > 0 ? config->fps_den : 1) /
+           (config->fps_num > 0 ? config->fps_num : 25);
+}
+
+static void *libvpx_init(const struct encoder_config *config, int vp9)
+{
+    int                 threads;
+    int                 cpuused;
+    int                 log2;
+    vpx_codec_err_t     err;
+    vpx_codec_flags_t   flags = 0;
+    vpx_codec_enc_cfg_t *cfg;
+    vpx_codec_iface_t   *iface;
+    struct vpx_context  *ctx;
+
+    ctx = (struct vpx_context *)calloc(1, sizeof(struct vpx_context));
+    if (!ctx) {
+        ALOGE("%s: Failed to allocate context", __func__);
+        return NULL;
+    }
+
+    ctx->vp9 = vp9;
+    iface = vp9 ? vpx_codec_vp9_cx() : vpx_codec_vp8_cx();
+
+    cfg = &ctx->cfg;
+    err = vpx_codec_enc_config_default(iface, cfg, 0);
+    if (err != VPX_CODEC_OK) {
+        ALOGE("%s: vpx_codec_enc_config_default failed %d", __func__, err);
+        goto bail;
+    }
+
+    // no vpx_img_alloc: the planes are pointed at the input buffers
+    ctx->img.w = ctx->img.d_w = config->width;
+    ctx->img.h = ctx->img.d_h = config->height;
+    ctx->img.x_chroma_shift = 1;
+    ctx->img.y_chroma_shift = 1;
+
+    switch (config->format) {
+        case FOURCC_I420:
+            ctx->img.fmt = VPX_IMG_FMT_I420;
+            ctx->img.bit_depth = 8;
+            ctx->img.bps = 12;
+            break;
+        case FOURCC_I010:
+            if (!vp9) {
+                ALOGE("%s: vp8 has no 10 bit", __func__);
+                goto bail;
+            }
+            // lsb aligned 16 bit samples, vp9 profile 2
+            ctx->img.fmt = VPX_IMG_FMT_I42016;
+            ctx->img.bit_depth = 10;
+            ctx->img.bps = 24;
+            cfg->g_profile = 2;
+            cfg->g_bit_depth = VPX_BITS_10;
+            cfg->g_input_bit_depth = 10;
+            flags |= VPX_CODEC_USE_HIGHBITDEPTH;
+            break;
+        default:
+            ALOGE("%s: unsupported input '%.4s'", __func__, (char*)&config->format);
+            goto bail;
+    }
+
+    if (vp9 && config->profile != NULL)
+        cfg->g_profile = atoi(config->profile);
+
+    threads = config->threads > 0 ? config->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1)
+        threads = 1;
+
+    cfg->g_w = config->width;
+    cfg->g_h = config->height;
+    cfg->g_threads = threads;
+
+    // pts are capture timestamps in us
+    cfg->g_timebase.num = 1;
+    cfg->g_timebase.den = 1000000;
+    ctx->duration = libvpx_duration(config);
+
+    ctx->kf_max_dist = cfg->kf_max_dist;
+    if (config->keyint > 0) {
+        cfg->kf_mode = VPX_KF_AUTO;
+        cfg->kf_max_dist = config->keyint;
+    }
+
+    switch (config->preset) {
+        case ENCODER_PRESET_LOWLATENCY:
+            // a frame out per frame in, cbr, never drop
+            cfg->g_lag_in_frames = 0;
+            cfg->rc_end_usage = VPX_CBR;
+            cfg->rc_dropframe_thresh = 0;
+            ctx->deadline = VPX_DL_REALTIME;
+            cpuused = vp9 ? 8 : 6;
+            break;
+        case ENCODER_PRESET_THROUGHPUT:
+            // alt-ref lookahead for recording
+            if (cfg->g_lag_in_frames > VPX_MAX_LAG)
+                cfg->g_lag_in_frames = VPX_MAX_LAG;
+            cfg->rc_end_usage = VPX_VBR;
+            ctx->deadline = VPX_DL_GOOD_QUALITY;
+            cpuused = 2;
+            break;
+        default:
+            if (cfg->g_lag_in_frames > VPX_MAX_LAG)
+                cfg->g_lag_in_frames = VPX_MAX_LAG;
+            ctx->deadline = VPX_DL_GOOD_QUALITY;
+            cpuused = 0;
+            break;
+    }
+
+    if (config->bitrate > 0) {
+        cfg->rc_target_bitrate = config->bitrate;
+    } else {
+        cfg->rc_end_usage = VPX_Q;
+    }
+
+    err = vpx_codec_enc_init(&ctx->codec, iface, cfg, flags);
+    if (err != VPX_CODEC_OK) {
+        ALOGE("%s: vpx_codec_enc_init %dx%d failed: %s", __func__,
+              config->width, config->height, vpx_codec_error(&ctx->codec));
+        goto bail;
+    }
+    ctx->inited = 1;
+
+    vpx_codec_control(&ctx->codec, VP8E_SET_CPUUSED, cpuused);
+    if (config->bitrate <= 0)
+        vpx_codec_control(&ctx->codec, VP8E_SET_CQ_LEVEL, vp9 ? 32 : 10);
+
+    if (vp9) {
+        // row based threading inside every tile, tile columns of at least
+        // 256 pixels on top of it, one per thread at most
+        log2 = libvpx_log2(threads);
+        while (log2 > 0 && (config->width >> log2) < VPX_TILE_MIN_WIDTH)
+            log2--;
+
+        vpx_codec_control(&ctx->codec, VP9E_SET_ROW_MT, 1);
+        vpx_codec_control(&ctx->codec, VP9E_SET_TILE_COLUMNS, log2);
+        if (config->preset == ENCODER_PRESET_LOWLATENCY)
+            vpx_codec_control(&ctx->codec, VP9E_SET_AQ_MODE, 3);   // cyclic refresh
+    } else {
+        // vp8 threads over macroblock rows, token partitions let the decoder do the same
+        log2 = libvpx_log2(threads);
+        vpx_codec_control(&ctx->codec, VP8E_SET_TOKEN_PARTITIONS,
+                          log2 > VP8_EIGHT_TOKENPARTITION ? VP8_EIGHT_TOKENPARTITION : log2);
+        if (config->preset == ENCODER_PRESET_THROUGHPUT)
+            vpx_codec_control(&ctx->codec, VP8E_SET_ENABLEAUTOALTREF, 1);
+    }
+
+    ALOGD("%s: %s %dx%d '%.4s', %d kbps, preset %d, %d threads", __func__, vp9 ? "vp9" : "vp8",
+          config->width, config->height, (char*)&config->format, config->bitrate,
+          config->preset, threads);
+    return ctx;
+
+bail:
+    libvpx_close(ctx);
+    return NULL;
+}
+
+static void *libvpx_init_vp8(const struct encoder_config *config)
+{
+    return libvpx_init(config, 0);
+}
+
+static void *libvpx_init_vp9(const struct encoder_config *config)
+{
+    return libvpx_init(config, 1);
+}
+
+
+
+// tag of the picture with pts, dropping the ones before it the codec skipped
+static intptr_t libvpx_tag(struct vpx_context *ctx, int64_t pts)
+{
+    struct vpx_tag *t;
+
+    while (ctx->tag_head != ctx->tag_tail) {
+        t = &ctx->tags[ctx->tag_head++ % (VPX_MAX_LAG + 1)];
+        if (t->pts == pts)
+            return t->tag;
+    }
+    return 0;
+}
+
+static int libvpx_output(struct vpx_context *ctx, const vpx_image_t *img, int64_t pts,
+                         vpx_enc_frame_flags_t flags, struct encoder_frame *out)
+{
+    int                         n = 0;
+    size_t                      size = 0;
+    vpx_codec_iter_t            iter = NULL;
+    const vpx_codec_cx_pkt_t    *pkt;
+    int64_t                     pts_out = 0;
+
+    if (vpx_codec_encode(&ctx->codec, img, pts, ctx->duration, flags, ctx->deadline) != VPX_CODEC_OK) {
+        ALOGE("%s: vpx_codec_encode failed: %s", __func__, vpx_codec_error(&ctx->codec));
+        return -1;
+    }
+
+    // usually one frame; vp8 puts an alt-ref out as an invisible frame of its own
+    while ((pkt = vpx_codec_get_cx_data(&ctx->codec, &iter)) != NULL) {
+        if (pkt->kind != VPX_CODEC_CX_FRAME_PKT)
+            continue;
+
+        if (n >= ctx->maxnals) {
+            struct encoder_nal *nals = realloc(ctx->nals, (n + 1) * sizeof(*nals));
+            if (nals == NULL) {
+                ALOGE("%s: Failed to allocate %d nals", __func__, n + 1);
+                return -1;
+            }
+            ctx->nals = nals;
+            ctx->maxnals = n + 1;
+        }
+
+        ctx->nals[n].type = pkt->data.frame.flags;
+        ctx->nals[n].data = pkt->data.frame.buf;
+        ctx->nals[n].size = pkt->data.frame.sz;
+        size += pkt->data.frame.sz;
+        n++;
+
+        // the access unit goes by the frame that is shown
+        if (n == 1 || !(pkt->data.frame.flags & VPX_FRAME_IS_INVISIBLE))
+            pts_out = pkt->data.frame.pts;
+    }
+
+    if (n == 0)
+        return 0;
+
+    if (n == 1) {
+        out->data = ctx->nals[0].data;
+    } else {
+        // the packets are the codec's own buffers, lay them out back to back
+        if (size > ctx->bufsize) {
+            uint8_t *buf = realloc(ctx->buf, size);
+            if (buf == NULL) {
+                ALOGE("%s: Failed to allocate %zu bytes", __func__, size);
+                return -1;
+            }
+            ctx->buf = buf;
+            ctx->bufsize = size;
+        }
+
+        size = 0;
+        for (int i = 0; i < n; i++) {
+            memcpy(ctx->buf + size, ctx->nals[i].data, ctx->nals[i].size);
+            ctx->nals[i].data = ctx->buf + size;
+            size += ctx->nals[i].size;
+        }
+        out->data = ctx->buf;
+    }
+
+    out->size = size;
+    out->nals = ctx->nals;
+    out->nnals = n;
+    out->pts = pts_out;
+    out->dts = out->pts;
+    out->keyframe = 0;
+    for (int i = 0; i < n; i++) {
+        if (ctx->nals[i].type & VPX_FRAME_IS_KEY)
+            out->keyframe = 1;
+    }
+    out->tag = libvpx_tag(ctx, out->pts);
+    return 1;
+}
+
+
+static int libvpx_encode(void *handle, const struct encoder_picture *pic, struct encoder_frame *out)
+{
+    struct vpx_tag     *t;
+    struct vpx_context *ctx = (struct vpx_context *)handle;
+
+    for (int i = 0; i < 3; i++) {
+        ctx->img.planes[i] = pic->plane[i];
+        ctx->img.stride[i] = pic->stride[i];
+    }
+
+    if (ctx->tag_tail - ctx->tag_head > VPX_MAX_LAG)
+        ctx->tag_head++;
+    t = &ctx->tags[ctx->tag_tail++ % (VPX_MAX_LAG + 1)];
+    t->pts = pic->pts;
+    t->tag = pic->tag;
+
+    return libvpx_output(ctx, &ctx->img, pic->pts,
+                         pic->keyframe ? VPX_EFLAG_FORCE_KF : 0, out);
+}
+
+
+static int libvpx_flush(void *handle, struct encoder_frame *out)
+{
+    struct vpx_context *ctx = (struct vpx_context *)handle;
+
+    if (ctx->tag_head == ctx->tag_tail)
+        return 0;
+
+    return libvpx_output(ctx, NULL, -1, 0, out);
+}
+
+
+// bitrate, keyint and fps all go through vpx_codec_enc_config_set, only
+// a switch to or from constant quality re-opens
+static int libvpx_reconfigure(void *handle, const struct encoder_config *config)
+{
+    vpx_codec_enc_cfg_t cfg;
+    struct vpx_context  *ctx = (struct vpx_context *)handle;
+
+    cfg = ctx->cfg;
+    if ((config->bitrate > 0) != (cfg.rc_end_usage != VPX_Q))
+        return 1;
+
+    if (config->bitrate > 0)
+        cfg.rc_target_bitrate = config->bitrate;
+    if (config->keyint > 0) {
+        cfg.kf_mode = VPX_KF_AUTO;
+        cfg.kf_max_dist = config->keyint;
+    } else {
+        cfg.kf_max_dist = ctx->kf_max_dist;
+    }
+
+    if (vpx_codec_enc_config_set(&ctx->codec, &cfg) != VPX_CODEC_OK) {
+        ALOGE("%s: vpx_codec_enc_config_set failed: %s", __func__, vpx_codec_error(&ctx->codec));
+        return -1;
+    }
+
+    ctx->cfg = cfg;
+    // the timebase is us, the rate only sets the duration handed with each frame
+    ctx->duration = libvpx_duration(config);
+    return 0;
+}
+
+
+static void libvpx_close(void *handle)
+{
+    struct vpx_context *ctx = (struct vpx_context *)handle;
+
+    if (ctx == NULL)
+        return;
+
+    if (ctx->inited)
+        vpx_codec_destroy(&ctx->codec);
+
+    free(ctx->buf);
+    free(ctx->nals);
+    free(ctx);
+}
+
+
+const struct encoder_ops libvpx_vp8_ops = {
+    .name           = "vp8",
+    .init           = libvpx_init_vp8,
+    .encode         = libvpx_encode,
+    .flush          = libvpx_flush,
+    .reconfigure    = libvpx_reconfigure,
+    .close          = libvpx_close,
+};
+
+const struct encoder_ops libvpx_vp9_ops = {
+    .name           = "vp9",
+    .init           = libvpx_init_vp9,
+    .encode         = libvpx_encode,
+    .flush          = libvpx_flush,
+    .reconfigure    = libvpx_reconfigure,
+    .close          = libvpx_close,
+};
@@ -1,102 +1,284 @@
-
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
 
 #include "x264.h"
 
+#define LOG_TAG "x264"
+#include "liblog.h"
+
+#include "fourcc.h"
+#include "encoder.h"
+
 struct x264_context {
-	x264_t			*x264;	// x264 handle
+    x264_t              *x264;      // x264 handle
 
-	x264_param_t	*param;		// enc param
+    x264_param_t        param;      // enc param
 
-	x264_picture_t	*picture;	//
+    x264_picture_t      picture;    // input, planes rebound to every buffer
 
-	int				csp;	// color space
+    int                 csp;        // color space
+    uint32_t            format;     // FOURCC of the input buffers
+    int                 bitrate;    // kbps, 0: crf
+    int                 keyint;
 
+    struct encoder_nal  *nals;      // last output
+    int                 maxnals;
 };
 
 
-void *h264e_init(int width, int height, int frate)
+static void libx264_close(void *handle);
+
+static void *libx264_init(const struct encoder_config *config)
 {
-	x264_param_t		*param;
-    x264_picture_t		*pic_in;
-	struct x264_context *ctx;
+    int                 ret;
+    x264_param_t        *param;
+    struct x264_context *ctx;
+    const char          *profile;
 
     ctx = (struct x264_context *)calloc(1, sizeof(struct x264_context));
     if (!ctx) {
+        ALOGE("%s: Failed to allocate context", __func__);
         return NULL;
     }
 
-	param = (x264_param_t *)malloc(sizeof(x264_param_t));
-    if (!param) {
-		free(ctx);
-        return NULL;
+    ctx->format = config->format ? config->format : FOURCC_I420;
+    switch (ctx->format) {
+        case FOURCC_I420:
+            ctx->csp = X264_CSP_I420;
+            break;
+        case FOURCC_NV12:
+            ctx->csp = X264_CSP_NV12;
+            break;
+        case FOURCC_I010:
+            // lsb aligned 16 bit samples, what x264 takes at 10 bit depth
+            ctx->csp = X264_CSP_I420 | X264_CSP_HIGH_DEPTH;
+            break;
+        default:
+            ALOGE("%s: unsupported input '%.4s'", __func__, (char*)&ctx->format);
+            goto bail;
     }
 
-    pic_in = (x264_picture_t *) malloc(sizeof(x264_picture_t));
-    if (!pic_in) {
-		free(param);
-		free(ctx);
-        return NULL;
+    param = &ctx->param;
+    switch (config->preset) {
+        case ENCODER_PRESET_LOWLATENCY:
+            // zerolatency: sliced threads, no b-frames, no lookahead
+            ret = x264_param_default_preset(param, "veryfast", "zerolatency");
+            break;
+        case ENCODER_PRESET_THROUGHPUT:
+            ret = x264_param_default_preset(param, "medium", NULL);
+            param->b_sliced_threads = 0;
+            break;
+        default:
+            // initial default param
+            x264_param_default(param);
+            ret = 0;
+            break;
     }
 
-    ctx->param = param;
-    ctx->picture = pic_in;
-
-	// use i420 color space
-    ctx->csp = X264_CSP_I420;
+    if (ret < 0) {
+        ALOGE("%s: bad preset %d", __func__, config->preset);
+        goto bail;
+    }
 
-	// initial default param
-    x264_param_default(param);
+    param->i_threads = config->threads > 0 ? config->threads : X264_THREADS_AUTO;
 
-    param->i_width = width;
-    param->i_height = height;
+    param->i_width = config->width;
+    param->i_height = config->height;
     param->i_csp = ctx->csp;
+    param->i_bitdepth = ctx->format == FOURCC_I010 ? 10 : 8;
+
+    param->i_fps_num = config->fps_num > 0 ? config->fps_num : 25;
+    param->i_fps_den = config->fps_den > 0 ? config->fps_den : 1;
+
+    // pts are capture timestamps, rate control follows them
+    param->i_timebase_num = 1;
+    param->i_timebase_den = 1000000;
+    param->b_vfr_input = 1;
+
+    if (config->keyint > 0)
+        param->i_keyint_max = config->keyint;
+
+    if (config->bitrate > 0) {
+        param->rc.i_rc_method = X264_RC_ABR;
+        param->rc.i_bitrate = config->bitrate;
+        // a one second vbv buffer, it also lets reconfigure move the bitrate
+        param->rc.i_vbv_max_bitrate = config->bitrate;
+        param->rc.i_vbv_buffer_size = config->bitrate;
+    }
+
+    // sps/pps ahead of every IDR so a stream can be joined there
+    param->b_repeat_headers = 1;
+    param->b_annexb = 1;
+
+    profile = config->profile;
+    if (profile == NULL)
+        profile = ctx->format == FOURCC_I010 ? "high10" : "high";
+
+    if (x264_param_apply_profile(param, profile) < 0) {
+        ALOGE("%s: profile %s does not fit the input", __func__, profile);
+        goto bail;
+    }
+
+    ctx->x264 = x264_encoder_open(param);
+    if (ctx->x264 == NULL) {
+        ALOGE("%s: x264_encoder_open %dx%d failed", __func__, config->width, config->height);
+        goto bail;
+    }
+
+    ctx->bitrate = config->bitrate;
+    ctx->keyint = config->keyint;
+
+    // no x264_picture_alloc: the planes are pointed at the input buffers
+    x264_picture_init(&ctx->picture);
+    ctx->picture.img.i_csp = ctx->csp;
+    ctx->picture.img.i_plane = ctx->format == FOURCC_NV12 ? 2 : 3;
+
+    ALOGD("%s: %dx%d '%.4s' %s, %d kbps, preset %d", __func__, config->width, config->height,
+          (char*)&ctx->format, profile, config->bitrate, config->preset);
+    return ctx;
+
+bail:
+    libx264_close(ctx);
+    return NULL;
+}
+
 
-    /* Param
-    param->i_log_level  = X264_LOG_DEBUG;
-    param->i_threads  = X264_SYNC_LOOKAHEAD_AUTO;
-    param->i_frame_total = 0;
-    param->i_keyint_max = 10;
-    param->i_bframe  = 5;
-    param->b_open_gop  = 0;
-    param->i_bframe_pyramid = 0;
-    param->rc.i_qp_constant=0;
-    param->rc.i_qp_max=0;
-    param->rc.i_qp_min=0;
-    param->i_bframe_adaptive = X264_B_ADAPT_TRELLIS;
-	param->rc.i_bitrate = 1024 * 10;//rate 10 kbps
-    param->i_fps_den  = 1;
-    param->i_fps_num  = 25;
-    param->i_timebase_den = param->i_fps_num;
-    param->i_timebase_num = param->i_fps_den;
-    */
 
-    x264_param_apply_profile(param, x264_profile_names[5]);
+// the picture is only pointed at pic's planes, x264 reads them during the call
+static int libx264_output(struct x264_context *ctx, x264_picture_t *pic_in,
+                          struct encoder_frame *out)
+{
+    int                 size;
+    int                 nnal;
+    x264_nal_t          *nal;
+    x264_picture_t      pic_out;
+
+    size = x264_encoder_encode(ctx->x264, &nal, &nnal, pic_in, &pic_out);
+    if (size < 0) {
+        ALOGE("%s: x264_encoder_encode failed", __func__);
+        return -1;
+    }
+
+    if (size == 0)
+        return 0;
+
+    if (nnal > ctx->maxnals) {
+        struct encoder_nal *nals = realloc(ctx->nals, nnal * sizeof(*nals));
+        if (nals == NULL) {
+            ALOGE("%s: Failed to allocate %d nals", __func__, nnal);
+            return -1;
+        }
+        ctx->nals = nals;
+        ctx->maxnals = nnal;
+    }
+
+    for (int i = 0; i < nnal; i++) {
+        ctx->nals[i].type = nal[i].i_type;
+        ctx->nals[i].data = nal[i].p_payload;
+        ctx->nals[i].size = nal[i].i_payload;
+    }
+
+    // x264 lays the payloads of one call out back to back
+    out->data = nal[0].p_payload;
+    out->size = size;
+    out->nals = ctx->nals;
+    out->nnals = nnal;
+    out->pts = pic_out.i_pts;
+    out->dts = pic_out.i_dts;
+    out->keyframe = pic_out.b_keyframe;
+    out->tag = (intptr_t)pic_out.opaque;
+    return 1;
+}
 
 
-	ctx->x264 = x264_encoder_open(param);
+static int libx264_encode(void *handle, const struct encoder_picture *pic, struct encoder_frame *out)
+{
+    struct x264_context *ctx = (struct x264_context *)handle;
 
-    x264_picture_alloc(pic_in, ctx->csp, param->i_width, param->i_height);
-	pic_in->img.i_csp = X264_CSP_I420;
-	pic_in->img.i_plane = 3;
+    for (int i = 0; i < ctx->picture.img.i_plane; i++) {
+        ctx->picture.img.plane[i] = pic->plane[i];
+        ctx->picture.img.i_stride[i] = pic->stride[i];
+    }
 
+    // x264 hands opaque back with the output of this picture
+    ctx->picture.opaque = (void *)pic->tag;
+    ctx->picture.i_type = pic->keyframe ? X264_TYPE_IDR : X264_TYPE_AUTO;
+    ctx->picture.i_pts = pic->pts;
 
-	return ctx;
+    return libx264_output(ctx, &ctx->picture, out);
 }
 
 
+// with frame threads a flush call can come back empty while frames are
+// still delayed, like x264's own cli keep calling until one comes out
+static int libx264_flush(void *handle, struct encoder_frame *out)
+{
+    int ret;
+    struct x264_context *ctx = (struct x264_context *)handle;
 
-int h264e_run(int32_t width, int32_t height, int32_t fps)
+    while (x264_encoder_delayed_frames(ctx->x264) > 0) {
+        ret = libx264_output(ctx, NULL, out);
+        if (ret != 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+
+// x264_encoder_reconfig takes the bitrate through the vbv set up at init,
+// not the keyint or a switch between abr and crf
+static int libx264_reconfigure(void *handle, const struct encoder_config *config)
 {
+    x264_param_t        param;
+    struct x264_context *ctx = (struct x264_context *)handle;
+
+    if (config->keyint != ctx->keyint || (config->bitrate > 0) != (ctx->bitrate > 0))
+        return 1;
+
+    // the rate control follows the vfr timestamps, a new fps needs nothing
+    if (config->bitrate == ctx->bitrate)
+        return 0;
+
+    param = ctx->param;
+    param.rc.i_bitrate = config->bitrate;
+    param.rc.i_vbv_max_bitrate = config->bitrate;
+    param.rc.i_vbv_buffer_size = config->bitrate;
+
+    if (x264_encoder_reconfig(ctx->x264, &param) < 0) {
+        ALOGE("%s: x264_encoder_reconfig failed", __func__);
+        return -1;
+    }
 
+    ctx->param = param;
+    ctx->bitrate = config->bitrate;
+    return 0;
 }
 
 
-int h264e_exit(int32_t width, int32_t height, int32_t fps)
+static void libx264_close(void *handle)
 {
+    struct x264_context *ctx = (struct x264_context *)handle;
+
+    if (ctx == NULL)
+        return;
+
+    if (ctx->x264)
+        x264_encoder_close(ctx->x264);
 
+    free(ctx->nals);
+    free(ctx);
 }
+
+
+const struct encoder_ops libx264_ops = {
+    .name           = "x264",
+    .init           = libx264_init,
+    .encode         = libx264_encode,
+    .flush          = libx264_flush,
+    .reconfigure    = libx264_reconfigure,
+    .close          = libx264_close,
+};
@@ -2,3 +2,298 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+
+
+#include "x265.h"
+
+#define LOG_TAG "x265"
+#include "liblog.h"
+
+#include "fourcc.h"
+#include "encoder.h"
+
+struct x265_context {
+    const x265_api      *api;       // of the bit depth, from x265_api_get
+    x265_encoder        *x265;
+
+    x265_param          *param;     // enc param
+
+    x265_picture        *picture;   // input, planes rebound to every buffer
+    x265_picture        *pic_out;
+
+    int                 keyint;     // as opened, param has the codec default for 0
+
+    struct encoder_nal  *nals;      // last output
+    int                 maxnals;
+};
+
+
+static void libx265_close(void *handle);
+
+static void *libx265_init(const struct encoder_config *config)
+{
+    int                 ret;
+    int                 depth;
+    char                value[16];
+    x265_param          *param;
+    struct x265_context *ctx;
+    const x265_api      *api;
+    const char          *profile;
+
+    switch (config->format) {
+        case FOURCC_I420:
+            depth = 8;
+            break;
+        case FOURCC_I010:
+            // lsb aligned 16 bit samples, what x265 takes at 10 bit depth
+            depth = 10;
+            break;
+        default:
+            ALOGE("%s: unsupported input '%.4s'", __func__, (char*)&config->format);
+            return NULL;
+    }
+
+    api = x265_api_get(depth);
+    if (api == NULL) {
+        ALOGE("%s: libx265 has no %d bit encoder", __func__, depth);
+        return NULL;
+    }
+
+    ctx = (struct x265_context *)calloc(1, sizeof(struct x265_context));
+    if (!ctx) {
+        ALOGE("%s: Failed to allocate context", __func__);
+        return NULL;
+    }
+    ctx->api = api;
+
+    ctx->param = param = api->param_alloc();
+    ctx->picture = api->picture_alloc();
+    ctx->pic_out = api->picture_alloc();
+    if (!param || !ctx->picture || !ctx->pic_out) {
+        ALOGE("%s: Failed to allocate param/pictures", __func__);
+        goto bail;
+    }
+
+    switch (config->preset) {
+        case ENCODER_PRESET_LOWLATENCY:
+            // zerolatency: no b-frames or lookahead, one frame thread, wpp inside it
+            ret = api->param_default_preset(param, "veryfast", "zerolatency");
+            break;
+        case ENCODER_PRESET_THROUGHPUT:
+            // frame parallelism (auto thread count) on top of wpp, with lookahead
+            ret = api->param_default_preset(param, "medium", NULL);
+            param->frameNumThreads = 0;
+            break;
+        default:
+            api->param_default(param);
+            ret = 0;
+            break;
+    }
+
+    if (ret < 0) {
+        ALOGE("%s: bad preset %d", __func__, config->preset);
+        goto bail;
+    }
+
+    param->bEnableWavefront = 1;
+    if (config->threads > 0) {
+        snprintf(value, sizeof(value), "%d", config->threads);
+        api->param_parse(param, "pools", value);
+    }
+
+    param->logLevel = X265_LOG_WARNING;
+    param->sourceWidth = config->width;
+    param->sourceHeight = config->height;
+    param->internalCsp = X265_CSP_I420;
+    param->fpsNum = config->fps_num > 0 ? config->fps_num : 25;
+    param->fpsDenom = config->fps_den > 0 ? config->fps_den : 1;
+
+    if (config->keyint > 0)
+        param->keyframeMax = config->keyint;
+
+    if (config->bitrate > 0) {
+        param->rc.rateControlMode = X265_RC_ABR;
+        param->rc.bitrate = config->bitrate;
+        // a one second vbv buffer, it also lets reconfigure move the bitrate
+        param->rc.vbvMaxBitrate = config->bitrate;
+        param->rc.vbvBufferSize = config->bitrate;
+    }
+
+    // closed gop: every keyframe is an IDR with vps/sps/pps ahead of it
+    param->bOpenGOP = 0;
+    param->bRepeatHeaders = 1;
+    param->bAnnexB = 1;
+
+    profile = config->profile;
+    if (profile == NULL)
+        profile = depth == 10 ? "main10" : "main";
+
+    if (api->param_apply_profile(param, profile) < 0) {
+        ALOGE("%s: profile %s does not fit the input", __func__, profile);
+        goto bail;
+    }
+
+    ctx->x265 = api->encoder_open(param);
+    if (ctx->x265 == NULL) {
+        ALOGE("%s: x265_encoder_open %dx%d failed", __func__, config->width, config->height);
+        goto bail;
+    }
+
+    ctx->keyint = config->keyint;
+
+    // no planes of its own: they are pointed at the input buffers
+    api->picture_init(param, ctx->picture);
+
+    ALOGD("%s: %dx%d %d bit %s, %d kbps, preset %d", __func__, config->width, config->height,
+          depth, profile, config->bitrate, config->preset);
+    return ctx;
+
+bail:
+    libx265_close(ctx);
+    return NULL;
+}
+
+
+
+static int libx265_output(struct x265_context *ctx, x265_picture *pic_in,
+                          struct encoder_frame *out)
+{
+    int                 ret;
+    int                 size = 0;
+    uint32_t            nnal;
+    x265_nal            *nal;
+    x265_picture        *pic_out = ctx->pic_out;
+
+    ret = ctx->api->encoder_encode(ctx->x265, &nal, &nnal, pic_in, pic_out);
+    if (ret < 0) {
+        ALOGE("%s: x265_encoder_encode failed", __func__);
+        return -1;
+    }
+
+    if (ret == 0 || nnal == 0)
+        return 0;
+
+    if ((int)nnal > ctx->maxnals) {
+        struct encoder_nal *nals = realloc(ctx->nals, nnal * sizeof(*nals));
+        if (nals == NULL) {
+            ALOGE("%s: Failed to allocate %u nals", __func__, nnal);
+            return -1;
+        }
+        ctx->nals = nals;
+        ctx->maxnals = nnal;
+    }
+
+    for (uint32_t i = 0; i < nnal; i++) {
+        ctx->nals[i].type = nal[i].type;
+        ctx->nals[i].data = nal[i].payload;
+        ctx->nals[i].size = nal[i].sizeBytes;
+        size += nal[i].sizeBytes;
+    }
+
+    // x265 serializes the nals of one call into one buffer
+    out->data = nal[0].payload;
+    out->size = size;
+    out->nals = ctx->nals;
+    out->nnals = nnal;
+    out->pts = pic_out->pts;
+    out->dts = pic_out->dts;
+    out->keyframe = pic_out->sliceType == X265_TYPE_IDR;
+    out->tag = (intptr_t)pic_out->userData;
+    return 1;
+}
+
+
+static int libx265_encode(void *handle, const struct encoder_picture *pic, struct encoder_frame *out)
+{
+    struct x265_context *ctx = (struct x265_context *)handle;
+
+    for (int i = 0; i < 3; i++) {
+        ctx->picture->planes[i] = pic->plane[i];
+        ctx->picture->stride[i] = pic->stride[i];
+    }
+
+    // x265 hands userData back with the output of this picture
+    ctx->picture->userData = (void *)pic->tag;
+    ctx->picture->sliceType = pic->keyframe ? X265_TYPE_IDR : X265_TYPE_AUTO;
+    ctx->picture->pts = pic->pts;
+
+    return libx265_output(ctx, ctx->picture, out);
+}
+
+
+static int libx265_flush(void *handle, struct encoder_frame *out)
+{
+    struct x265_context *ctx = (struct x265_context *)handle;
+
+    return libx265_output(ctx, NULL, out);
+}
+
+
+// x265_encoder_reconfig takes the bitrate through the vbv set up at init.
+// the frame rate drives its rate control and is fixed, as is the keyint
+static int libx265_reconfigure(void *handle, const struct encoder_config *config)
+{
+    int                 ret;
+    x265_param          *param;
+    struct x265_context *ctx = (struct x265_context *)handle;
+
+    if (config->keyint != ctx->keyint ||
+        (config->fps_num > 0 ? config->fps_num : 25) != (int)ctx->param->fpsNum ||
+        (config->fps_den > 0 ? config->fps_den : 1) != (int)ctx->param->fpsDenom ||
+        (config->bitrate > 0) != (ctx->param->rc.rateControlMode == X265_RC_ABR))
+        return 1;
+
+    if (config->bitrate == ctx->param->rc.bitrate)
+        return 0;
+
+    param = ctx->api->param_alloc();
+    if (param == NULL)
+        return -1;
+
+    memcpy(param, ctx->param, ctx->api->sizeof_param);
+    param->rc.bitrate = config->bitrate;
+    param->rc.vbvMaxBitrate = config->bitrate;
+    param->rc.vbvBufferSize = config->bitrate;
+
+    ret = ctx->api->encoder_reconfig(ctx->x265, param);
+    if (ret < 0) {
+        ALOGE("%s: x265_encoder_reconfig failed", __func__);
+    } else {
+        memcpy(ctx->param, param, ctx->api->sizeof_param);
+    }
+
+    ctx->api->param_free(param);
+    return ret < 0 ? -1 : 0;
+}
+
+
+static void libx265_close(void *handle)
+{
+    struct x265_context *ctx = (struct x265_context *)handle;
+
+    if (ctx == NULL)
+        return;
+
+    if (ctx->x265)
+        ctx->api->encoder_close(ctx->x265);
+    if (ctx->picture)
+        ctx->api->picture_free(ctx->picture);
+    if (ctx->pic_out)
+        ctx->api->picture_free(ctx->pic_out);
+    if (ctx->param)
+        ctx->api->param_free(ctx->param);
+
+    free(ctx->nals);
+    free(ctx);
+}
+
+
+const struct encoder_ops libx265_ops = {
+    .name           = "x265",
+    .init           = libx265_init,
+    .encode         = libx265_encode,
+    .flush          = libx265_flush,
+    .reconfigure    = libx265_reconfigure,
+    .close          = libx265_close,
+};
@@ -431,6 +431,52 @@ int v4l2_reqbufs(int fd, struct v4l2_requestbuffers *req)
     return ret;
 }
 
+int v4l2_create_bufs(int fd, struct v4l2_create_buffers *create)
+{
+    int ret = -1;
+    unsigned int count;
+
+    KV4L2_IN();
+
+    if (fd < 0) {
+        ALOGE("%s: invalid fd: %d", __func__, fd);
+        return ret;
+    }
+
+    if (!create) {
+        ALOGE("%s: create is NULL", __func__);
+        return ret;
+    }
+
+    if ((create->memory != V4L2_MEMORY_MMAP) &&
+        (create->memory != V4L2_MEMORY_USERPTR) &&
+        (create->memory != V4L2_MEMORY_DMABUF)) {
+        ALOGE("%s: unsupported memory type", __func__);
+        return ret;
+    }
+
+    if (__v4l2_check_buf_type(create->format.type) == false) {
+        ALOGE("%s: unsupported buffer type", __func__);
+        return ret;
+    }
+
+    count = create->count;
+
+    ret = ioctl(fd, VIDIOC_CREATE_BUFS, create);
+    if (ret) {
+        ALOGE("failed to ioctl: VIDIOC_CREATE_BUFS (%d - %s)", errno, strerror(errno));
+        return ret;
+    }
+
+    if (count != create->count) {
+        ALOGW("number of buffers had been changed: %d => %d", count, create->count);
+    }
+
+    KV4L2_OUT();
+
+    return ret;
+}
+
 int v4l2_querybuf(int fd, struct v4l2_buffer *buf)
 {
     int ret = -1;
@@ -469,6 +515,38 @@ int v4l2_querybuf(int fd, struct v4l2_buffer *buf)
     return ret;
 }
 
+int v4l2_expbuf(int fd, struct v4l2_exportbuffer *expbuf)
+{
+    int ret = -1;
+
+    KV4L2_IN();
+
+    if (fd < 0) {
+        ALOGE("%s: invalid fd: %d", __func__, fd);
+        return ret;
+    }
+
+    if (!expbuf) {
+        ALOGE("%s: expbuf is NULL", __func__);
+        return ret;
+    }
+
+    if (__v4l2_check_buf_type(expbuf->type) == false) {
+        ALOGE("%s: unsupported buffer type", __func__);
+        return ret;
+    }
+
+    ret = ioctl(fd, VIDIOC_EXPBUF, expbuf);
+    if (ret) {
+        ALOGE("failed to ioctl: VIDIOC_EXPBUF (%d - %s)", errno, strerror(errno));
+        return ret;
+    }
+
+    KV4L2_OUT();
+
+    return ret;
+}
+
 int v4l2_qbuf(int fd, struct v4l2_buffer *buf)
 {
     int ret = -1;
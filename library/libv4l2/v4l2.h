@@ -54,8 +54,12 @@ int v4l2_try_fmt(int fd, struct v4l2_format *fmt);
 /*! \ingroup v4l2 */
 int v4l2_reqbufs(int fd, struct v4l2_requestbuffers *req);
 /*! \ingroup v4l2 */
+int v4l2_create_bufs(int fd, struct v4l2_create_buffers *create);
+/*! \ingroup v4l2 */
 int v4l2_querybuf(int fd, struct v4l2_buffer *buf);
 /*! \ingroup v4l2 */
+int v4l2_expbuf(int fd, struct v4l2_exportbuffer *expbuf);
+/*! \ingroup v4l2 */
 int v4l2_qbuf(int fd, struct v4l2_buffer *buf);
 /*! \ingroup v4l2 */
 int v4l2_dqbuf(int fd, struct v4l2_buffer *buf);